@@ -10,9 +10,365 @@
 #include <cstdlib>
 #include <limits>
 #include <cctype>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <deque>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <string_view>
+#include <memory_resource>
+#include <new>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <random>
+
+// x86 builds carry AVX2 and SSE4.2 scan kernels next to the scalar one and
+// pick between them at run time (see EventColumns).
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CALENDAR_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// The local server (--serve) runs on epoll, so it is only built on Linux.
+#ifdef __linux__
+#define CALENDAR_SERVER 1
+#include <arpa/inet.h>
+#include <csignal>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// ==================== Memory ====================
+// Every allocation in the program is counted here, so query paths can be
+// checked for how often they reach the heap (batch mode's --alloc-stats
+// reports it per command). Each thread counts its own, so the count costs
+// no shared cache line.
+static thread_local uint64_t allocation_count = 0;
+
+// Kept out of line: once inlined, GCC pairs the malloc and free below
+// with new and delete expressions and warns about a mismatch.
+#if defined(__GNUC__) || defined(__clang__)
+#define CALENDAR_NOINLINE __attribute__((noinline))
+#else
+#define CALENDAR_NOINLINE
+#endif
+
+CALENDAR_NOINLINE void* operator new(size_t size) {
+    ++allocation_count;
+    if (void* block = malloc(size ? size : 1)) return block;
+    throw bad_alloc();
+}
+
+CALENDAR_NOINLINE void operator delete(void* block) noexcept { free(block); }
+CALENDAR_NOINLINE void operator delete(void* block, size_t) noexcept { free(block); }
+
+// Allocations made so far by the calling thread.
+uint64_t allocationCount() { return allocation_count; }
+
+// Fixed-size blocks carved out of 64 KiB slabs and recycled through a free
+// list, for objects the calendar creates by the million (events and index
+// nodes). Slabs are kept for the life of the program.
+template <size_t Size>
+class SlabPool {
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static const size_t ALIGN = alignof(max_align_t);
+    static const size_t BLOCK = (Size + ALIGN - 1) / ALIGN * ALIGN;
+    static const size_t SLAB = max<size_t>(BLOCK, 64 << 10);
+
+    FreeBlock* free_list;
+    char* cursor;
+    char* limit;
+    mutex lock;
+
+    SlabPool() : free_list(nullptr), cursor(nullptr), limit(nullptr) {}
+
+public:
+    static SlabPool& instance() {
+        static SlabPool* pool = new SlabPool();  // never destroyed: blocks may outlive main
+        return *pool;
+    }
+
+    void* allocate() {
+        lock_guard<mutex> guard(lock);
+        if (free_list) {
+            FreeBlock* block = free_list;
+            free_list = block->next;
+            return block;
+        }
+        if (cursor == limit) {
+            cursor = static_cast<char*>(::operator new(SLAB));
+            limit = cursor + SLAB / BLOCK * BLOCK;
+        }
+        void* block = cursor;
+        cursor += BLOCK;
+        return block;
+    }
+
+    void deallocate(void* pointer) {
+        if (!pointer) return;
+        lock_guard<mutex> guard(lock);
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+        block->next = free_list;
+        free_list = block;
+    }
+};
+
+// Per-thread arena for the temporaries of one query or render: grid
+// cells, merge heaps, result lists. Allocation is a pointer bump and the
+// whole arena is dropped at once when the outermost Scope closes. With no
+// Scope open, resource() is the ordinary heap, so code that never opens
+// one (worker threads, tests) cannot grow the arena without bound.
+// Nothing allocated from it may outlive the Scope it was made in.
+class ScratchArena {
+private:
+    static const size_t INITIAL = 1 << 20;
+
+    unique_ptr<char[]> buffer;
+    unique_ptr<pmr::monotonic_buffer_resource> arena;
+    int depth;
+
+    ScratchArena() : depth(0) {}
+
+    static ScratchArena& local() {
+        thread_local ScratchArena scratch;
+        return scratch;
+    }
+
+public:
+    class Scope {
+    public:
+        Scope() {
+            ScratchArena& scratch = local();
+            if (scratch.depth++ == 0 && !scratch.arena) {
+                scratch.buffer.reset(new char[INITIAL]);
+                scratch.arena.reset(new pmr::monotonic_buffer_resource(scratch.buffer.get(), INITIAL,
+                                                                        pmr::new_delete_resource()));
+            }
+        }
+        ~Scope() {
+            ScratchArena& scratch = local();
+            if (--scratch.depth == 0) scratch.arena->release();
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    static pmr::memory_resource* resource() {
+        ScratchArena& scratch = local();
+        if (scratch.depth > 0) return scratch.arena.get();
+        return pmr::new_delete_resource();
+    }
+};
+
+// ==================== Terminal Frames ====================
+// While the UI runs, cout writes into an in-memory frame instead of the
+// terminal. clearScreen() starts a new frame and present(), called before
+// every read from the keyboard, emits it with a single write: on a
+// terminal only the lines that differ from what is already on screen are
+// rewritten, using ANSI cursor addressing rather than spawning "clear".
+// Frames that would scroll or wrap are redrawn in full.
+class FrameRenderer {
+private:
+    // A stringbuf whose contents can be read in place; clearing it keeps
+    // its capacity, so steady-state frames do not allocate.
+    class FrameBuffer : public stringbuf {
+    public:
+        string_view view() const { return string_view(pbase(), static_cast<size_t>(pptr() - pbase())); }
+        void reset() { str(string()); }
+    };
+
+    FrameBuffer frame;
+    streambuf* terminal;          // cout's own buffer while capturing, else nullptr
+    string shown;                 // text on screen now; its last line holds the cursor
+    vector<string_view> screen;   // lines of shown
+    vector<string_view> lines;    // lines of the frame being presented
+    bool fresh;                   // clearScreen() was called since the last present()
+    string output;                // reused for every frame
+
+    FrameRenderer() : terminal(nullptr), fresh(true) { splitLines(shown, screen); }
+
+    // Lines of text without their '\n' (and '\r'); always at least one.
+    static void splitLines(string_view text, vector<string_view>& result) {
+        result.clear();
+        size_t start = 0;
+        while (true) {
+            size_t end = text.find('\n', start);
+            string_view line = text.substr(start, end == string_view::npos ? string_view::npos : end - start);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            result.push_back(line);
+            if (end == string_view::npos) break;
+            start = end + 1;
+        }
+    }
+
+    // Printed width: escape sequences and UTF-8 continuation bytes take
+    // no columns.
+    static size_t visibleWidth(string_view line) {
+        size_t width = 0;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '\033') {
+                while (i + 1 < line.size() && !isalpha(static_cast<unsigned char>(line[i + 1]))) ++i;
+                ++i;
+            } else if ((static_cast<unsigned char>(line[i]) & 0xC0) != 0x80) {
+                ++width;
+            }
+        }
+        return width;
+    }
+
+    static bool terminalSize(size_t& rows, size_t& columns) {
+#ifndef _WIN32
+        winsize size;
+        if (!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0) return false;
+        rows = size.ws_row;
+        columns = size.ws_col;
+        return true;
+#else
+        (void)rows;
+        (void)columns;
+        return false;
+#endif
+    }
+
+    static bool fits(const vector<string_view>& lines, size_t rows, size_t columns) {
+        if (lines.size() >= rows) return false;
+        for (string_view line : lines) {
+            if (visibleWidth(line) >= columns) return false;
+        }
+        return true;
+    }
+
+    void emit(string_view bytes) {
+        if (!terminal) {
+            cout << bytes << flush;
+            return;
+        }
+#ifndef _WIN32
+        fflush(stdout);
+        size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t written = ::write(STDOUT_FILENO, bytes.data() + done, bytes.size() - done);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            done += static_cast<size_t>(written);
+        }
+#else
+        terminal->sputn(bytes.data(), static_cast<streamsize>(bytes.size()));
+        terminal->pubsync();
+#endif
+    }
+
+public:
+    static FrameRenderer& instance() {
+        static FrameRenderer renderer;
+        return renderer;
+    }
+
+    bool capturing() const { return terminal != nullptr; }
+
+    void begin() {
+        if (capturing()) return;
+        terminal = cout.rdbuf(&frame);
+        shown.clear();
+        splitLines(shown, screen);
+        fresh = true;
+    }
+
+    void end() {
+        if (!capturing()) return;
+        present();
+        cout.rdbuf(terminal);
+        terminal = nullptr;
+    }
+
+    void clear() {
+        if (!capturing()) {
+            emit("\033[H\033[2J\033[3J");
+            return;
+        }
+        frame.reset();
+        fresh = true;
+    }
+
+    void present() {
+        if (!capturing()) {
+            cout.flush();
+            return;
+        }
+        string_view text = frame.view();
+        output.clear();
+
+        if (!fresh) {
+            // Same screen: the new text simply continues below.
+            output.append(text.data(), text.size());
+            shown.append(text.data(), text.size());
+        } else {
+            splitLines(text, lines);
+            size_t rows, columns;
+            if (!terminalSize(rows, columns) || !fits(lines, rows, columns) || !fits(screen, rows, columns)) {
+                output.append("\033[H\033[2J\033[3J").append(text.data(), text.size());
+            } else {
+                // Rewrite changed lines in place; the last one is always
+                // written so the cursor ends where the frame does.
+                for (size_t i = 0; i < lines.size(); ++i) {
+                    if (i + 1 < lines.size() && i < screen.size() && screen[i] == lines[i]) continue;
+                    char move_to[32];
+                    snprintf(move_to, sizeof(move_to), "\033[%zu;1H", i + 1);
+                    output.append(move_to).append(lines[i].data(), lines[i].size()).append("\033[K");
+                }
+                output.append("\033[J");
+            }
+            shown.assign(text.data(), text.size());
+            fresh = false;
+        }
+        splitLines(shown, screen);
+        frame.reset();
+        if (!output.empty()) emit(output);
+    }
+
+    // Records what the terminal echoed while a line was typed, keeping the
+    // on-screen model in step with the cursor.
+    void noteInput(const string& typed) {
+        if (!capturing()) return;
+#ifndef _WIN32
+        if (!isatty(STDIN_FILENO)) return;
+#endif
+        shown.append(typed).push_back('\n');
+        splitLines(shown, screen);
+    }
+};
+
 // ==================== Utility Functions ====================
 string toLower(const string& str) {
     string result = str;
@@ -37,22 +393,277 @@ int safeStoi(const string& input, int fallback = 0) {
 
 string getInput(const string& prompt) {
     cout << prompt;
+    FrameRenderer::instance().present();
     string input;
     getline(cin, input);
+    FrameRenderer::instance().noteInput(input);
     return trim(input);
 }
 
 void clearScreen() {
-    #ifdef _WIN32
-        system("cls");
-    #else
-        system("clear");
-    #endif
+    FrameRenderer::instance().clear();
 }
 
 void waitForEnter(const string& message = "\nPress Enter to continue...") {
     cout << message;
+    FrameRenderer::instance().present();
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    FrameRenderer::instance().noteInput("");
+}
+
+// ==================== Civil Time ====================
+// Calendar arithmetic on plain day numbers (days since 1970-01-01) and a
+// table of the local zone's UTC offset transitions, built once on first
+// use. After that every conversion is a binary search plus integer math:
+// no libc time calls, no locks and no allocation, so it is safe to call
+// from any thread. The table reflects TZ as it was at first use.
+
+constexpr bool isLeapYear(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date. Days past the end
+// of the month carry over into the next one.
+constexpr long daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yoe = year - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Inverse of daysFromCivil.
+constexpr void civilFromDays(long days, int& year, int& month, int& day) {
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long doe = days - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    year = static_cast<int>(yoe + era * 400 + (month <= 2));
+}
+
+constexpr int daysInMonth(int year, int month) {
+    return month == 2 ? (isLeapYear(year) ? 29 : 28)
+                      : (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+}
+
+// 0 = Sunday. 1970-01-01 was a Thursday.
+constexpr int weekdayFromDays(long days) {
+    return static_cast<int>(days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6);
+}
+
+constexpr long long floorDiv(long long value, long long divisor) {
+    return value / divisor - (value % divisor < 0 ? 1 : 0);
+}
+
+// Instants the civil time functions below work on: years 1 to 9999 UTC.
+// Anything further out is clamped to them first, so adding a zone offset
+// can never overflow.
+constexpr time_t EARLIEST_TIME = static_cast<time_t>(daysFromCivil(1, 1, 1) * 86400LL);
+constexpr time_t LATEST_TIME = static_cast<time_t>(daysFromCivil(10000, 1, 1) * 86400LL - 1);
+
+constexpr time_t clampTime(time_t t) {
+    return t < EARLIEST_TIME ? EARLIEST_TIME : (t > LATEST_TIME ? LATEST_TIME : t);
+}
+
+static_assert(daysFromCivil(1970, 1, 1) == 0, "epoch is day 0");
+static_assert(daysFromCivil(2000, 3, 1) == 11017, "leap day handling");
+static_assert(weekdayFromDays(daysFromCivil(2026, 10, 16)) == 5, "2026-10-16 is a Friday");
+
+// UTC offsets of the local zone. The constructor samples localtime_r once
+// a week from 1900 to 2100 and bisects every change down to the second;
+// no zone changes its offset twice within a week. Instants outside that
+// span fall back to localtime_r.
+class LocalZone {
+private:
+    struct Transition {
+        time_t at;   // first instant this offset applies to
+        int offset;  // seconds east of UTC
+    };
+
+    static const time_t FIRST = -2208988800LL;  // 1900-01-01 UTC
+    static const time_t LAST = 4102444800LL;    // 2100-01-01 UTC
+
+    vector<Transition> transitions;
+
+    static bool probe(time_t t, int& offset) {
+        tm local;
+#ifdef _WIN32
+        if (localtime_s(&local, &t) != 0) return false;
+#else
+        if (!localtime_r(&t, &local)) return false;
+#endif
+        long long seconds = daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) * 86400LL +
+                            local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+        offset = static_cast<int>(seconds - t);
+        return true;
+    }
+
+    LocalZone() {
+        const time_t STEP = 7 * 86400;
+        int offset = 0;
+        probe(FIRST, offset);
+        transitions.push_back(Transition{FIRST, offset});
+        for (time_t t = FIRST + STEP; t - STEP < LAST; t += STEP) {
+            int next;
+            if (!probe(t, next) || next == offset) continue;
+            time_t lo = t - STEP, hi = t;  // old offset at lo, new one at hi
+            while (hi - lo > 1) {
+                time_t mid = lo + (hi - lo) / 2;
+                int probed;
+                if (probe(mid, probed) && probed == offset) lo = mid;
+                else hi = mid;
+            }
+            transitions.push_back(Transition{hi, next});
+            offset = next;
+        }
+    }
+
+public:
+    static const LocalZone& instance() {
+        static const LocalZone zone;  // initialised once, thread-safely
+        return zone;
+    }
+
+    int offsetAt(time_t t) const {
+        if (t < FIRST || t >= LAST) {
+            int offset;
+            return probe(t, offset) ? offset : transitions.back().offset;
+        }
+        auto it = upper_bound(transitions.begin(), transitions.end(), t,
+            [](time_t value, const Transition& transition) { return value < transition.at; });
+        return prev(it)->offset;
+    }
+
+    // Instant of a local wall-clock reading, given as seconds since the
+    // epoch as though local time were UTC. Like mktime, a reading skipped
+    // by a forward transition lands after it, and an ambiguous one picks
+    // the earlier instant.
+    time_t fromLocal(long long local) const {
+        int before = offsetAt(static_cast<time_t>(local - 86400));
+        int after = offsetAt(static_cast<time_t>(local + 86400));
+        time_t early = static_cast<time_t>(local - before);
+        time_t late = static_cast<time_t>(local - after);
+        bool early_fits = offsetAt(early) == before;
+        bool late_fits = offsetAt(late) == after;
+        if (early_fits && late_fits) return min(early, late);
+        if (late_fits) return late;
+        return early;
+    }
+};
+
+// A local timestamp broken down into its fields.
+struct CivilTime {
+    int year;
+    int month;    // 1-12
+    int day;      // 1-31
+    int hour;
+    int minute;
+    int second;
+    int weekday;  // 0 = Sunday
+    long day_number;
+};
+
+CivilTime localCivil(time_t t) {
+    t = clampTime(t);
+    long long local = static_cast<long long>(t) + LocalZone::instance().offsetAt(t);
+    CivilTime civil;
+    civil.day_number = static_cast<long>(floorDiv(local, 86400));
+    long seconds = static_cast<long>(local - civil.day_number * 86400LL);
+    civilFromDays(civil.day_number, civil.year, civil.month, civil.day);
+    civil.hour = static_cast<int>(seconds / 3600);
+    civil.minute = static_cast<int>(seconds / 60 % 60);
+    civil.second = static_cast<int>(seconds % 60);
+    civil.weekday = weekdayFromDays(civil.day_number);
+    return civil;
+}
+
+// Local calendar day a timestamp falls on, as a plain day number.
+long localDayNumber(time_t t) {
+    t = clampTime(t);
+    return static_cast<long>(floorDiv(static_cast<long long>(t) + LocalZone::instance().offsetAt(t), 86400));
+}
+
+// Timestamp of a local wall-clock time. Out-of-range days, hours and so on
+// carry over, as with mktime.
+time_t localTimeFromCivil(int year, int month, int day, int hour = 0, int minute = 0, int second = 0) {
+    return LocalZone::instance().fromLocal(daysFromCivil(year, month, day) * 86400LL +
+                                           hour * 3600LL + minute * 60LL + second);
+}
+
+// Local midnight at the start of a day number.
+time_t localDayStart(long day_number) {
+    return LocalZone::instance().fromLocal(day_number * 86400LL);
+}
+
+static const char* const DAY_NAMES[] = {
+    "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+static const char* const MONTH_NAMES[] = {
+    "January", "February", "March", "April", "May", "June",
+    "July", "August", "September", "October", "November", "December"
+};
+
+// strftime-style formatting of a local time into the caller's buffer,
+// which is always NUL-terminated. Understands %Y %y %m %d %e %H %I %M %S
+// %p %A %a %B %b and %%; anything else is copied through. Returns the
+// length written.
+size_t formatTime(char* buffer, size_t size, time_t t, const char* format) {
+    if (size == 0) return 0;
+    CivilTime civil = localCivil(t);
+    size_t length = 0;
+    auto put = [&](char c) {
+        if (length + 1 < size) buffer[length++] = c;
+    };
+    auto text = [&](const char* s, size_t limit) {
+        for (size_t i = 0; s[i] && i < limit; ++i) put(s[i]);
+    };
+    auto number = [&](int value, int width, char pad) {
+        char digits[12];
+        int count = 0;
+        unsigned magnitude = value < 0 ? 0u - static_cast<unsigned>(value) : static_cast<unsigned>(value);
+        do {
+            digits[count++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (value < 0) put('-');
+        for (int i = count; i < width; ++i) put(pad);
+        while (count > 0) put(digits[--count]);
+    };
+
+    for (const char* p = format; *p; ++p) {
+        if (*p != '%' || !p[1]) {
+            put(*p);
+            continue;
+        }
+        switch (*++p) {
+            case 'Y': number(civil.year, 4, '0'); break;
+            case 'y': number(((civil.year % 100) + 100) % 100, 2, '0'); break;
+            case 'm': number(civil.month, 2, '0'); break;
+            case 'd': number(civil.day, 2, '0'); break;
+            case 'e': number(civil.day, 2, ' '); break;
+            case 'H': number(civil.hour, 2, '0'); break;
+            case 'I': number(civil.hour % 12 == 0 ? 12 : civil.hour % 12, 2, '0'); break;
+            case 'M': number(civil.minute, 2, '0'); break;
+            case 'S': number(civil.second, 2, '0'); break;
+            case 'p': text(civil.hour < 12 ? "AM" : "PM", 2); break;
+            case 'A': text(DAY_NAMES[civil.weekday], 16); break;
+            case 'a': text(DAY_NAMES[civil.weekday], 3); break;
+            case 'B': text(MONTH_NAMES[civil.month - 1], 16); break;
+            case 'b': text(MONTH_NAMES[civil.month - 1], 3); break;
+            case '%': put('%'); break;
+            default:
+                put('%');
+                put(*p);
+                break;
+        }
+    }
+    buffer[length] = '\0';
+    return length;
 }
 
 time_t stringToTime(const string& date_str, const string& format = "%Y-%m-%d %H:%M") {
@@ -62,12 +673,13 @@ time_t stringToTime(const string& date_str, const string& format = "%Y-%m-%d %H:
     if (ss.fail()) {
         return 0;
     }
-    return mktime(&timeinfo);
+    return localTimeFromCivil(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                              timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
 }
 
 string timeToString(time_t t, const string& format = "%Y-%m-%d %H:%M") {
-    char buffer[20];
-    strftime(buffer, sizeof(buffer), format.c_str(), localtime(&t));
+    char buffer[64];
+    formatTime(buffer, sizeof(buffer), t, format.c_str());
     return buffer;
 }
 
@@ -80,7 +692,7 @@ string getTimePart(time_t t) {
 }
 
 string getDayName(time_t t) {
-    return timeToString(t, "%A");
+    return DAY_NAMES[weekdayFromDays(localDayNumber(t))];
 }
 
 // ==================== Enums ====================
@@ -139,21 +751,181 @@ string getColorCode(Color color) {
     }
 }
 
+// ==================== String Pool ====================
+// Titles, locations and attendee names repeat across most events, so each
+// distinct text is stored once and events hold 4-byte handles to it.
+// Entries are reference counted and their slots reused once the last
+// handle goes away. Interning takes a lock; reading a handle's text and
+// copying handles do not, so handles may be read from any thread. Entries
+// never move once created.
+class StringPool {
+private:
+    struct Entry {
+        string text;
+        atomic<uint32_t> refs;
+        uint32_t folded;  // id of the lower-cased text (itself if already lower case)
+
+        Entry() : refs(0), folded(0) {}
+    };
+
+    static const uint32_t CHUNK_BITS = 12;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1u << 16;
+
+    atomic<Entry*> chunks[MAX_CHUNKS];
+    uint32_t next_id;
+    vector<uint32_t> free_ids;
+    unordered_map<string_view, uint32_t> lookup;
+    mutex lock;
+
+    StringPool() : next_id(1) {
+        for (auto& chunk : chunks) chunk.store(nullptr, memory_order_relaxed);
+        chunks[0].store(new Entry[CHUNK_SIZE], memory_order_release);  // id 0 is the permanent ""
+    }
+
+    Entry& entry(uint32_t id) const {
+        return chunks[id >> CHUNK_BITS].load(memory_order_acquire)[id & (CHUNK_SIZE - 1)];
+    }
+
+    uint32_t internLocked(string_view text) {
+        if (text.empty()) return 0;
+        auto it = lookup.find(text);
+        if (it != lookup.end()) {
+            entry(it->second).refs.fetch_add(1, memory_order_relaxed);
+            return it->second;
+        }
+        uint32_t id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = next_id++;
+            if ((id & (CHUNK_SIZE - 1)) == 0) {
+                if ((id >> CHUNK_BITS) >= MAX_CHUNKS) throw length_error("string pool is full");
+                chunks[id >> CHUNK_BITS].store(new Entry[CHUNK_SIZE], memory_order_release);
+            }
+        }
+        Entry& e = entry(id);
+        e.text.assign(text.data(), text.size());
+        e.refs.store(1, memory_order_relaxed);
+        lookup.emplace(string_view(e.text), id);
+
+        string lower = toLower(e.text);
+        e.folded = lower == e.text ? id : internLocked(lower);
+        return id;
+    }
+
+    void releaseLocked(uint32_t id) {
+        Entry& e = entry(id);
+        // Interned again meanwhile, or already freed by a racing release.
+        if (e.refs.load(memory_order_acquire) != 0 || e.text.empty()) return;
+        lookup.erase(string_view(e.text));
+        uint32_t folded = e.folded;
+        string().swap(e.text);
+        free_ids.push_back(id);
+        if (folded != id && entry(folded).refs.fetch_sub(1, memory_order_acq_rel) == 1) releaseLocked(folded);
+    }
+
+public:
+    static StringPool& instance() {
+        static StringPool* pool = new StringPool();  // never destroyed: handles may outlive main
+        return *pool;
+    }
+
+    // Looking up text already in the pool does not allocate.
+    uint32_t intern(string_view text) {
+        if (text.empty()) return 0;
+        lock_guard<mutex> guard(lock);
+        return internLocked(text);
+    }
+
+    void retain(uint32_t id) {
+        if (id != 0) entry(id).refs.fetch_add(1, memory_order_relaxed);
+    }
+
+    void release(uint32_t id) {
+        if (id == 0 || entry(id).refs.fetch_sub(1, memory_order_acq_rel) != 1) return;
+        lock_guard<mutex> guard(lock);
+        releaseLocked(id);
+    }
+
+    const string& text(uint32_t id) const { return entry(id).text; }
+    uint32_t folded(uint32_t id) const { return id == 0 ? 0 : entry(id).folded; }
+
+    // Distinct texts currently held.
+    size_t size() {
+        lock_guard<mutex> guard(lock);
+        return lookup.size();
+    }
+};
+
+// Handle to a pooled string. Converts to const string&, so it reads like
+// one; equality is a comparison of ids.
+class InternedString {
+private:
+    uint32_t handle;
+
+public:
+    InternedString() : handle(0) {}
+    InternedString(const string& text) : handle(StringPool::instance().intern(text)) {}
+    InternedString(const char* text) : handle(StringPool::instance().intern(text)) {}
+    explicit InternedString(string_view text) : handle(StringPool::instance().intern(text)) {}
+    InternedString(const InternedString& other) : handle(other.handle) { StringPool::instance().retain(handle); }
+    InternedString(InternedString&& other) noexcept : handle(other.handle) { other.handle = 0; }
+    ~InternedString() { StringPool::instance().release(handle); }
+
+    InternedString& operator=(InternedString other) noexcept {
+        swap(handle, other.handle);
+        return *this;
+    }
+
+    const string& str() const { return StringPool::instance().text(handle); }
+    operator const string&() const { return str(); }
+    const char* c_str() const { return str().c_str(); }
+    bool empty() const { return handle == 0; }
+    size_t size() const { return str().size(); }
+    uint32_t id() const { return handle; }
+    uint32_t folded() const { return StringPool::instance().folded(handle); }  // id of the lower-cased text
+
+    // Same text ignoring ASCII case, still without comparing characters.
+    bool equalsIgnoreCase(const InternedString& other) const { return folded() == other.folded(); }
+
+    bool operator==(const InternedString& other) const { return handle == other.handle; }
+    bool operator!=(const InternedString& other) const { return handle != other.handle; }
+};
+
+ostream& operator<<(ostream& out, const InternedString& text) {
+    return out << text.str();
+}
+
+typedef vector<InternedString> NameList;
+
+NameList internAll(const vector<string>& names) {
+    return NameList(names.begin(), names.end());
+}
+
 // ==================== Event Class ====================
 class Event {
 private:
-    static int next_id;
+    static atomic<int> next_id;  // events are created on any thread
+    bool tombstone = false;  // set by Calendar::deleteEvent until the next compaction
+
+    friend class Calendar;
+
+    Event()
+        : id(0), start_time(0), end_time(0), color(Color::DEFAULT), priority(Priority::MEDIUM),
+          is_all_day(false), is_recurring(false) {}
 
 public:
     int id;
-    string title;
+    InternedString title;
     time_t start_time;
     time_t end_time;
     Color color;
     Priority priority;
     string description;
-    string location;
-    vector<string> attendees;
+    InternedString location;
+    NameList attendees;
     bool is_all_day;
     bool is_recurring;
     string recurrence_pattern;
@@ -161,17 +933,43 @@ public:
     Event(const string& title, time_t start, time_t end, 
           Color color = Color::DEFAULT, Priority priority = Priority::MEDIUM,
           const string& desc = "", const string& loc = "", 
-          const vector<string>& att = {}, bool all_day = false,
+          const NameList& att = {}, bool all_day = false,
           bool recurring = false, const string& recur_pattern = "")
-        : id(next_id++), title(title), start_time(start), end_time(end),
+        : id(next_id.fetch_add(1, memory_order_relaxed)), title(title), start_time(start), end_time(end),
           color(color), priority(priority), description(desc),
           location(loc), attendees(att), is_all_day(all_day),
           is_recurring(recurring), recurrence_pattern(recur_pattern) {}
 
+    // Id the next new event will get; later ones are larger.
+    static int nextId() { return next_id.load(memory_order_relaxed); }
+
+    // Keeps freshly created ids above one loaded from storage.
+    static void reserveId(int used_id) {
+        int next = next_id.load(memory_order_relaxed);
+        while (used_id >= next && !next_id.compare_exchange_weak(next, used_id + 1, memory_order_relaxed)) {}
+    }
+
+    // Blank event carrying a persisted id, to be filled in by a loader.
+    static Event withId(int id) {
+        Event event;
+        event.id = id;
+        reserveId(id);
+        return event;
+    }
+
+    // Stored events come from a slab pool rather than one heap block each.
+    static void* operator new(size_t size) {
+        return size == sizeof(Event) ? SlabPool<sizeof(Event)>::instance().allocate() : ::operator new(size);
+    }
+    static void operator delete(void* block, size_t size) {
+        if (size == sizeof(Event)) SlabPool<sizeof(Event)>::instance().deallocate(block);
+        else ::operator delete(block);
+    }
+
+    bool isDeleted() const { return tombstone; }
+
     bool isSameDay(time_t day) const {
-        tm t1 = *localtime(&start_time);
-        tm t2 = *localtime(&day);
-        return (t1.tm_year == t2.tm_year && t1.tm_mon == t2.tm_mon && t1.tm_mday == t2.tm_mday);
+        return localDayNumber(start_time) == localDayNumber(day);
     }
 
     bool isBetween(time_t start, time_t end) const {
@@ -185,12 +983,21 @@ public:
     }
 
     void printSummary(bool detailed = false) const {
+        printSummary(detailed, start_time, end_time);
+    }
+
+    // Summary for one occurrence of the event, which may differ in time.
+    void printSummary(bool detailed, time_t start, time_t end) const {
         string color_code = getColorCode(color);
+        char from[24], to[24];
         cout << color_code << "[" << id << "] " << title << TermColor::RESET << " (";
         if (is_all_day) {
-            cout << dateToString(start_time) << " - All Day";
+            formatTime(from, sizeof(from), start, "%Y-%m-%d");
+            cout << from << " - All Day";
         } else {
-            cout << timeToString(start_time) << " - " << timeToString(end_time);
+            formatTime(from, sizeof(from), start, "%Y-%m-%d %H:%M");
+            formatTime(to, sizeof(to), end, "%Y-%m-%d %H:%M");
+            cout << from << " - " << to;
         }
         cout << ") [" << toString(priority) << "]";
         
@@ -204,13 +1011,13 @@ public:
             }
             if (is_recurring) cout << "\n  Recurring: " << recurrence_pattern;
         }
-        cout << endl;
+        cout << '\n';
     }
 
     void printDetails() const {
         string color_code = getColorCode(color);
-        cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << endl;
-        cout << color_code << "Title: " << title << TermColor::RESET << endl;
+        cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << '\n';
+        cout << color_code << "Title: " << title << TermColor::RESET << '\n';
         cout << "Time: ";
         if (is_all_day) {
             cout << dateToString(start_time) << " (All Day)";
@@ -226,653 +1033,8593 @@ public:
             for (const auto& name : attendees) cout << name << ", ";
         }
         if (is_recurring) cout << "\nRecurrence: " << recurrence_pattern;
-        cout << endl;
+        cout << '\n';
     }
 };
 
-int Event::next_id = 1;
+atomic<int> Event::next_id{1};
+
+// ==================== Interval Index ====================
+// AVL tree keyed on (start_time, id). Every node also keeps the largest
+// end_time of its subtree so overlap and stabbing queries can skip whole
+// subtrees, answering in O(log n + k) instead of walking every event.
+class IntervalTree {
+public:
+    struct Node {
+        time_t start;
+        time_t end;
+        time_t max_end;
+        int id;
+        Event* event;
+        int height;
+        Node* left;
+        Node* right;
+
+        static void* operator new(size_t size) {
+            return size == sizeof(Node) ? SlabPool<sizeof(Node)>::instance().allocate() : ::operator new(size);
+        }
+        static void operator delete(void* block, size_t size) {
+            if (size == sizeof(Node)) SlabPool<sizeof(Node)>::instance().deallocate(block);
+            else ::operator delete(block);
+        }
+    };
+
+    // AVL height never exceeds 1.44 * log2(n + 2), so 96 levels covers any
+    // tree that fits in memory and lets cursors walk without allocating.
+    static const int MAX_HEIGHT = 96;
+
+    // Yields the events overlapping [lo, hi] in (start_time, id) order.
+    class Cursor {
+    private:
+        const Node* stack[MAX_HEIGHT];
+        int depth;
+        time_t lo;
+        time_t hi;
+
+        void pushLeft(const Node* node) {
+            while (node && node->max_end >= lo) {
+                stack[depth++] = node;
+                node = node->left;
+            }
+        }
+
+    public:
+        Cursor(const Node* root, time_t lo, time_t hi) : depth(0), lo(lo), hi(hi) {
+            pushLeft(root);
+        }
+
+        Event* next() {
+            while (depth > 0) {
+                const Node* node = stack[--depth];
+                if (node->start > hi) {
+                    depth = 0;
+                    return nullptr;
+                }
+                pushLeft(node->right);
+                if (node->end >= lo && !node->event->isDeleted()) return node->event;
+            }
+            return nullptr;
+        }
+    };
 
-// ==================== Calendar Class ====================
-class Calendar {
 private:
-    vector<Event> events;
-    string name;
-    string owner;
+    Node* root;
+    size_t count;
 
-    void sortEvents() {
-        sort(events.begin(), events.end(), 
-            [](const Event& a, const Event& b) { return a.start_time < b.start_time; });
+    static int height(const Node* n) { return n ? n->height : 0; }
+    static time_t maxEnd(const Node* n) { return n ? n->max_end : numeric_limits<time_t>::min(); }
+
+    static bool keyLess(time_t start_a, int id_a, time_t start_b, int id_b) {
+        return start_a < start_b || (start_a == start_b && id_a < id_b);
     }
 
-public:
-    Calendar(const string& name = "My Calendar", const string& owner = "User")
-        : name(name), owner(owner) {}
+    static void update(Node* n) {
+        n->height = 1 + max(height(n->left), height(n->right));
+        n->max_end = max(n->end, max(maxEnd(n->left), maxEnd(n->right)));
+    }
 
-    void addEvent(const Event& event) {
-        events.push_back(event);
-        sortEvents();
+    static Node* rotateRight(Node* n) {
+        Node* l = n->left;
+        n->left = l->right;
+        l->right = n;
+        update(n);
+        update(l);
+        return l;
     }
 
-    bool deleteEvent(int id) {
-        auto it = remove_if(events.begin(), events.end(), 
-            [id](const Event& e) { return e.id == id; });
-        if (it != events.end()) {
-            events.erase(it, events.end());
-            return true;
+    static Node* rotateLeft(Node* n) {
+        Node* r = n->right;
+        n->right = r->left;
+        r->left = n;
+        update(n);
+        update(r);
+        return r;
+    }
+
+    static Node* rebalance(Node* n) {
+        update(n);
+        int balance = height(n->left) - height(n->right);
+        if (balance > 1) {
+            if (height(n->left->left) < height(n->left->right)) n->left = rotateLeft(n->left);
+            return rotateRight(n);
         }
-        return false;
+        if (balance < -1) {
+            if (height(n->right->right) < height(n->right->left)) n->right = rotateRight(n->right);
+            return rotateLeft(n);
+        }
+        return n;
     }
 
-    Event* findEvent(int id) {
-        for (auto& e : events) {
-            if (e.id == id) return &e;
+    static Node* insertNode(Node* n, Node* fresh) {
+        if (!n) return fresh;
+        if (keyLess(fresh->start, fresh->id, n->start, n->id)) {
+            n->left = insertNode(n->left, fresh);
+        } else {
+            n->right = insertNode(n->right, fresh);
         }
-        return nullptr;
+        return rebalance(n);
     }
 
-    vector<Event> getEventsForDay(time_t day) const {
-        vector<Event> result;
-        for (const auto& e : events) {
-            if (e.isSameDay(day)) {
-                result.push_back(e);
-            }
+    // Detaches the leftmost node of the subtree into *out.
+    static Node* detachMin(Node* n, Node** out) {
+        if (!n->left) {
+            *out = n;
+            return n->right;
         }
-        return result;
+        n->left = detachMin(n->left, out);
+        return rebalance(n);
     }
 
-    vector<Event> getEventsBetween(time_t start, time_t end) const {
-        vector<Event> result;
-        for (const auto& e : events) {
-            if (e.isBetween(start, end)) {
-                result.push_back(e);
-            }
+    // Removes the node of this event. A deleted event keeps its node until
+    // compaction, so an id stored again can have two nodes with one key,
+    // on either side of each other after rotations: they are told apart
+    // by the event.
+    static Node* eraseNode(Node* n, const Event* event, bool& erased) {
+        if (!n) return nullptr;
+        time_t start = event->start_time;
+        int id = event->id;
+        if (keyLess(start, id, n->start, n->id)) {
+            n->left = eraseNode(n->left, event, erased);
+        } else if (keyLess(n->start, n->id, start, id)) {
+            n->right = eraseNode(n->right, event, erased);
+        } else if (n->event != event) {
+            n->left = eraseNode(n->left, event, erased);
+            if (!erased) n->right = eraseNode(n->right, event, erased);
+        } else {
+            erased = true;
+            Node* left = n->left;
+            Node* right = n->right;
+            delete n;
+            if (!right) return left;
+            Node* successor = nullptr;
+            right = detachMin(right, &successor);
+            successor->left = left;
+            successor->right = right;
+            return rebalance(successor);
         }
-        return result;
+        return rebalance(n);
     }
 
-// Fix the displayDay function - remove the UNDERLINE usage or replace with BOLD
-void displayDay(time_t day) const {
-    clearScreen();
-    auto day_events = getEventsForDay(day);
-    
-    cout << TermColor::BOLD << "\n=== " << getDayName(day) << " " << dateToString(day) 
-         << " ===" << TermColor::RESET << "\n\n";
-    
-    if (day_events.empty()) {
-        cout << "No events scheduled for this day.\n";
-    } else {
-        for (const auto& e : day_events) {
-            e.printSummary(true);
-            cout << string(60, '-') << "\n";
-        }
+    // Builds a perfectly balanced subtree from events already in key order.
+    static Node* buildSorted(Event* const* sorted, size_t lo, size_t hi) {
+        if (lo >= hi) return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        Event* event = sorted[mid];
+        Node* n = new Node{event->start_time, event->end_time, event->end_time,
+                           event->id, event, 1, nullptr, nullptr};
+        n->left = buildSorted(sorted, lo, mid);
+        n->right = buildSorted(sorted, mid + 1, hi);
+        update(n);
+        return n;
     }
-    waitForEnter();
-}
 
-// Fix the displayWeek function - remove BG_BLUE or replace with BLUE
-void displayWeek(time_t reference_day) const {
-    clearScreen();
-    tm ref = *localtime(&reference_day);
-    ref.tm_mday -= ref.tm_wday; // Start from Sunday
-    mktime(&ref);
+    static void destroy(Node* n) {
+        if (!n) return;
+        destroy(n->left);
+        destroy(n->right);
+        delete n;
+    }
 
-    vector<tm> week_days(7);
-    for (int i = 0; i < 7; ++i) {
-        week_days[i] = ref;
-        week_days[i].tm_mday += i;
-        mktime(&week_days[i]);
+public:
+    IntervalTree() : root(nullptr), count(0) {}
+    ~IntervalTree() { destroy(root); }
+
+    IntervalTree(const IntervalTree&) = delete;
+    IntervalTree& operator=(const IntervalTree&) = delete;
+
+    size_t size() const { return count; }
+
+    void insert(Event* event) {
+        Node* fresh = new Node{event->start_time, event->end_time, event->end_time,
+                               event->id, event, 1, nullptr, nullptr};
+        root = insertNode(root, fresh);
+        ++count;
     }
 
-    cout << TermColor::BOLD << "\n=== Week View (" 
-         << dateToString(mktime(&week_days.front()))
-         << " to "
-         << dateToString(mktime(&week_days.back()))
-         << ") ===" << TermColor::RESET << "\n\n";
+    // Must be called while the event still carries the times it was indexed with.
+    bool erase(const Event* event) {
+        bool erased = false;
+        root = eraseNode(root, event, erased);
+        if (erased) --count;
+        return erased;
+    }
 
-    // Print day headers
-    cout << setw(10) << "Time";
-    for (const auto& day : week_days) {
-        char buffer[20];
-        strftime(buffer, sizeof(buffer), "%a %m/%d", &day);
-        cout << setw(20) << buffer;
+    void clear() {
+        destroy(root);
+        root = nullptr;
+        count = 0;
     }
-    cout << '\n' << string(150, '-') << '\n';
 
-    // Print hourly grid
-    for (int hour = 8; hour <= 20; ++hour) {
-        cout << setw(10) << (hour <= 12 ? to_string(hour) + " AM" : 
-                           (hour == 12 ? "12 PM" : to_string(hour - 12) + " PM"));
-        
-        for (const auto& day : week_days) {
-            time_t current_time = mktime((tm*)&day) + hour * 3600;
-            bool event_printed = false;
-            
-            for (const auto& e : events) {
-                if (e.isAtTime(current_time)) {
-                    string title = e.title.substr(0, 18);
-                    cout << getColorCode(e.color) << setw(20) << title << TermColor::RESET;
-                    event_printed = true;
-                    break;
-                }
-            }
-            if (!event_printed) cout << setw(20) << "";
-        }
-        cout << '\n';
+    // Replaces the contents with events sorted by (start_time, id) in O(n).
+    void build(const vector<Event*>& sorted) {
+        destroy(root);
+        root = buildSorted(sorted.data(), 0, sorted.size());
+        count = sorted.size();
     }
 
-    // Print all-day events
-    cout << "\n" << TermColor::BOLD << "All-Day Events:" << TermColor::RESET << "\n";
-    for (const auto& day : week_days) {
-        time_t day_time = mktime((tm*)&day);
-        auto day_events = getEventsForDay(day_time);
-        
-        bool has_all_day = false;
-        for (const auto& e : day_events) {
-            if (e.is_all_day) {
-                if (!has_all_day) {
-                    cout << setw(10) << dateToString(day_time) << ": ";
-                    has_all_day = true;
-                }
-                cout << getColorCode(e.color) << "[" << e.title << "] " << TermColor::RESET;
-            }
-        }
-        if (has_all_day) cout << '\n';
+    static bool keyLess(const Event* a, const Event* b) {
+        return keyLess(a->start_time, a->id, b->start_time, b->id);
     }
-    waitForEnter();
-}
-    void displayMonth(time_t current_date) const {
-        clearScreen();
-        tm t = *localtime(&current_date);
-        t.tm_mday = 1;
-        mktime(&t);
-        
-        int first_day = t.tm_wday;
-        int days_in_month = 31;
-        
-        t.tm_mon++;
-        t.tm_mday = 0;
-        mktime(&t);
-        days_in_month = t.tm_mday;
 
-        cout << TermColor::BOLD << "\n=== Calendar for " << put_time(&t, "%B %Y") 
-             << " ===" << TermColor::RESET << "\n\n";
-        cout << " Sun Mon Tue Wed Thu Fri Sat\n";
+    Cursor overlapping(time_t lo, time_t hi) const { return Cursor(root, lo, hi); }
 
-        // Get events for this month
-        time_t month_start = mktime(&t);
-        t.tm_mday = days_in_month;
-        time_t month_end = mktime(&t);
-        auto month_events = getEventsBetween(month_start, month_end);
+    // Every indexed event in (start_time, id) order.
+    Cursor inOrder() const {
+        return Cursor(root, numeric_limits<time_t>::min(), numeric_limits<time_t>::max());
+    }
 
-        for (int i = 0; i < first_day; ++i) cout << "    ";
-        for (int day = 1; day <= days_in_month; ++day) {
-            t.tm_mday = day;
-            mktime(&t);
-            bool has_event = false;
-            
-            for (const auto& e : month_events) {
-                if (e.isSameDay(mktime(&t))) {
-                    has_event = true;
-                    break;
-                }
-            }
-            
-            if (has_event) {
-                cout << TermColor::BOLD << "[" << setw(2) << day << "]" << TermColor::RESET;
-            } else {
-                cout << " " << setw(2) << day << " ";
-            }
-            
-            if ((day + first_day) % 7 == 0) cout << '\n';
+    // Earliest-starting event that covers the given instant.
+    Event* firstAt(time_t t) const {
+        Cursor cursor(root, t, t);
+        return cursor.next();
+    }
+};
+
+// ==================== Event Columns ====================
+// Hot fields of the stored one-off events laid out column by column, so a
+// range scan reads 17 bytes per event instead of chasing Event objects with
+// their strings and attendee lists. Event objects stay the cold store,
+// reached by id through Calendar::findEvent. Rows are unordered: removal
+// swaps the last row into the hole. Filters run over the whole columns
+// with AVX2 or SSE4.2 when the CPU has them, picked once at run time, and
+// a scalar loop everywhere else.
+class EventColumns {
+public:
+    enum Flags : uint8_t { ALL_DAY = 1 };
+
+    // Rows whose event overlaps [lo, hi] and has at least min_priority are
+    // written to out, which must have room for every row; returns how many.
+    typedef size_t (*Kernel)(const int64_t* starts, const int64_t* ends, const uint8_t* priorities,
+                             size_t count, int64_t lo, int64_t hi, uint8_t min_priority, uint32_t* out);
+
+private:
+    vector<int64_t> starts;
+    vector<int64_t> ends;
+    vector<int32_t> ids;
+    vector<uint8_t> priorities;
+    vector<uint8_t> colors;
+    vector<uint8_t> flags;
+    pmr::unsynchronized_pool_resource row_memory;  // hash nodes of rows
+    pmr::unordered_map<int, uint32_t> rows;        // id -> row
+    bool built;
+
+    static size_t filterScalar(const int64_t* starts, const int64_t* ends, const uint8_t* priorities,
+                               size_t count, int64_t lo, int64_t hi, uint8_t min_priority, uint32_t* out) {
+        size_t found = 0;
+        for (size_t i = 0; i < count; ++i) {
+            out[found] = static_cast<uint32_t>(i);
+            found += (starts[i] <= hi) & (ends[i] >= lo) & (priorities[i] >= min_priority);
         }
-        cout << "\n\n" << TermColor::BOLD << "Legend: " << TermColor::RESET 
-             << "[##] = Day with events\n";
-        waitForEnter();
+        return found;
     }
 
-    void displayAgenda(time_t start, time_t end) const {
-        clearScreen();
-        auto agenda_events = getEventsBetween(start, end);
-        
-        cout << TermColor::BOLD << "\n=== Agenda View (" 
-             << dateToString(start) << " to " << dateToString(end) 
-             << ") ===" << TermColor::RESET << "\n\n";
-        
-        if (agenda_events.empty()) {
-            cout << "No events found in this period.\n";
-        } else {
-            string current_date;
-            for (const auto& e : agenda_events) {
-                string event_date = dateToString(e.start_time);
-                if (event_date != current_date) {
-                    current_date = event_date;
-                    cout << "\n" << TermColor::BOLD << current_date << " (" 
-                         << getDayName(e.start_time) << ")" << TermColor::RESET << "\n";
-                    cout << string(60, '=') << "\n";
-                }
-                e.printSummary(true);
-                cout << string(60, '-') << "\n";
+#ifdef CALENDAR_X86_KERNELS
+    __attribute__((target("avx2")))
+    static size_t filterAvx2(const int64_t* starts, const int64_t* ends, const uint8_t* priorities,
+                             size_t count, int64_t lo, int64_t hi, uint8_t min_priority, uint32_t* out) {
+        const __m256i low = _mm256_set1_epi64x(lo);
+        const __m256i high = _mm256_set1_epi64x(hi);
+        const __m256i least = _mm256_set1_epi64x(min_priority);
+        size_t found = 0, i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m256i start = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(starts + i));
+            __m256i end = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends + i));
+            int32_t packed;
+            memcpy(&packed, priorities + i, sizeof(packed));
+            __m256i priority = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+            __m256i reject = _mm256_or_si256(_mm256_cmpgt_epi64(start, high), _mm256_cmpgt_epi64(low, end));
+            reject = _mm256_or_si256(reject, _mm256_cmpgt_epi64(least, priority));
+            unsigned mask = ~static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(reject))) & 0xFu;
+            while (mask) {
+                out[found++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+                mask &= mask - 1;
             }
         }
-        waitForEnter();
+        size_t tail = filterScalar(starts + i, ends + i, priorities + i, count - i, lo, hi, min_priority, out + found);
+        for (size_t k = found; k < found + tail; ++k) out[k] += static_cast<uint32_t>(i);
+        return found + tail;
     }
 
-    void listAllEvents() const {
-        clearScreen();
-        cout << TermColor::BOLD << "\n=== All Events ===" << TermColor::RESET << "\n\n";
-        
-        if (events.empty()) {
-            cout << "No events in calendar.\n";
-        } else {
-            for (const auto& e : events) {
-                e.printSummary(true);
-                cout << string(60, '=') << "\n";
-            }
+    __attribute__((target("sse4.2")))
+    static size_t filterSse42(const int64_t* starts, const int64_t* ends, const uint8_t* priorities,
+                              size_t count, int64_t lo, int64_t hi, uint8_t min_priority, uint32_t* out) {
+        const __m128i low = _mm_set1_epi64x(lo);
+        const __m128i high = _mm_set1_epi64x(hi);
+        const __m128i least = _mm_set1_epi64x(min_priority);
+        size_t found = 0, i = 0;
+        for (; i + 2 <= count; i += 2) {
+            __m128i start = _mm_loadu_si128(reinterpret_cast<const __m128i*>(starts + i));
+            __m128i end = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ends + i));
+            int16_t packed;
+            memcpy(&packed, priorities + i, sizeof(packed));
+            __m128i priority = _mm_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<uint16_t>(packed)));
+            __m128i reject = _mm_or_si128(_mm_cmpgt_epi64(start, high), _mm_cmpgt_epi64(low, end));
+            reject = _mm_or_si128(reject, _mm_cmpgt_epi64(least, priority));
+            unsigned mask = ~static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(reject))) & 0x3u;
+            if (mask & 1u) out[found++] = static_cast<uint32_t>(i);
+            if (mask & 2u) out[found++] = static_cast<uint32_t>(i + 1);
         }
-        waitForEnter();
+        if (i < count && filterScalar(starts + i, ends + i, priorities + i, 1, lo, hi, min_priority, out + found)) {
+            out[found++] = static_cast<uint32_t>(i);
+        }
+        return found;
+    }
+#endif
+
+    void removeRow(uint32_t row) {
+        uint32_t last = static_cast<uint32_t>(ids.size() - 1);
+        if (row != last) {
+            starts[row] = starts[last];
+            ends[row] = ends[last];
+            ids[row] = ids[last];
+            priorities[row] = priorities[last];
+            colors[row] = colors[last];
+            flags[row] = flags[last];
+            rows[ids[row]] = row;
+        }
+        starts.pop_back();
+        ends.pop_back();
+        ids.pop_back();
+        priorities.pop_back();
+        colors.pop_back();
+        flags.pop_back();
+    }
+
+public:
+    EventColumns() : rows(&row_memory), built(false) {}
+
+    // Kernel for this CPU, chosen on first use.
+    static Kernel kernel() {
+        static const Kernel chosen = [] {
+#ifdef CALENDAR_X86_KERNELS
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return &filterAvx2;
+            if (__builtin_cpu_supports("sse4.2")) return &filterSse42;
+#endif
+            return &filterScalar;
+        }();
+        return chosen;
+    }
+
+    static const char* kernelName() {
+#ifdef CALENDAR_X86_KERNELS
+        if (kernel() == &filterAvx2) return "avx2";
+        if (kernel() == &filterSse42) return "sse4.2";
+#endif
+        return "scalar";
     }
+
+    // The owner fills the columns on first use and from then on passes
+    // every change through put() and remove(); until then both do nothing.
+    bool isBuilt() const { return built; }
+    size_t size() const { return ids.size(); }
+
+    void reset() {
+        starts.clear();
+        ends.clear();
+        ids.clear();
+        priorities.clear();
+        colors.clear();
+        flags.clear();
+        rows.clear();
+        built = false;
+    }
+
+    void reserve(size_t count) {
+        starts.reserve(count);
+        ends.reserve(count);
+        ids.reserve(count);
+        priorities.reserve(count);
+        colors.reserve(count);
+        flags.reserve(count);
+        rows.reserve(count);
+    }
+
+    void markBuilt() { built = true; }
+
+    void append(int id, int64_t start, int64_t end, uint8_t priority, uint8_t color, uint8_t flag) {
+        rows[id] = static_cast<uint32_t>(ids.size());
+        starts.push_back(start);
+        ends.push_back(end);
+        ids.push_back(id);
+        priorities.push_back(priority);
+        colors.push_back(color);
+        flags.push_back(flag);
+    }
+
+    // Inserts or refreshes the row of an event.
+    void put(const Event& event) {
+        if (!built) return;
+        auto it = rows.find(event.id);
+        if (it == rows.end()) {
+            append(event.id, event.start_time, event.end_time, static_cast<uint8_t>(event.priority),
+                   static_cast<uint8_t>(event.color), event.is_all_day ? ALL_DAY : 0);
+            return;
+        }
+        uint32_t row = it->second;
+        starts[row] = event.start_time;
+        ends[row] = event.end_time;
+        priorities[row] = static_cast<uint8_t>(event.priority);
+        colors[row] = static_cast<uint8_t>(event.color);
+        flags[row] = event.is_all_day ? ALL_DAY : 0;
+    }
+
+    // Refreshes the row of an event only if it has one.
+    void refresh(const Event& event) {
+        if (built && rows.count(event.id)) put(event);
+    }
+
+    void remove(int id) {
+        if (!built) return;
+        auto it = rows.find(id);
+        if (it == rows.end()) return;
+        uint32_t row = it->second;
+        rows.erase(it);
+        removeRow(row);
+    }
+
+    // Rows overlapping [lo, hi] with at least min_priority, in row order.
+    void filter(time_t lo, time_t hi, Priority min_priority, pmr::vector<uint32_t>& out) const {
+        out.resize(ids.size());
+        size_t found = kernel()(starts.data(), ends.data(), priorities.data(), ids.size(), lo, hi,
+                                static_cast<uint8_t>(min_priority), out.data());
+        out.resize(found);
+    }
+
+    int id(uint32_t row) const { return ids[row]; }
+    time_t start(uint32_t row) const { return static_cast<time_t>(starts[row]); }
+    time_t end(uint32_t row) const { return static_cast<time_t>(ends[row]); }
+    Priority priority(uint32_t row) const { return static_cast<Priority>(priorities[row]); }
+    Color color(uint32_t row) const { return static_cast<Color>(colors[row]); }
+    bool allDay(uint32_t row) const { return (flags[row] & ALL_DAY) != 0; }
 };
 
-// ==================== Calendar UI Class ====================
-class CalendarUI {
+// ==================== Text Index ====================
+// Inverted index over the title, location and description of every stored
+// event, recurring series included. Words are runs of letters and digits
+// folded to lower case; bytes above 0x7f count as letters, so UTF-8 words
+// stay whole. A query word matches its own term, the terms it is a prefix
+// of, and, through a trigram index over the vocabulary, terms that contain
+// it or are spelled close to it. Hits must match every query word and are
+// ranked BM25-style, with title words weighing most.
+struct SearchHit {
+    int id;
+    float score;
+};
+
+class TextIndex {
 private:
-    Calendar calendar;
-    time_t current_date;
+    static const size_t MAX_WORD = 32;        // longer words are cut here
+    static const size_t MAX_EXPANSIONS = 64;  // prefix or trigram terms per query word
 
-    time_t promptDate(const string& prompt, bool include_time = true) {
-        while (true) {
-            string format = include_time ? "YYYY-MM-DD HH:MM" : "YYYY-MM-DD";
-            string input = getInput(prompt + " (" + format + "): ");
-            time_t t = stringToTime(input, include_time ? "%Y-%m-%d %H:%M" : "%Y-%m-%d");
-            if (t != 0) return t;
-            cout << "Invalid format. Please try again.\n";
+    // Per-field word counts of one event; all zero once it is removed.
+    struct Posting {
+        int32_t id;
+        uint8_t title;
+        uint8_t location;
+        uint8_t description;
+        uint8_t reserved;
+
+        bool live() const { return (title | location | description) != 0; }
+    };
+
+    struct Term {
+        string text;
+        vector<Posting> postings;  // by id once built
+        uint32_t live;
+        uint32_t dead;
+    };
+
+    struct Expansion {
+        uint32_t term;
+        float weight;
+    };
+
+    deque<Term> terms;  // stable addresses: term_ids points into the texts
+    unordered_map<string_view, uint32_t> term_ids;
+    unordered_map<uint32_t, vector<uint32_t>> trigrams;  // trigram -> terms containing it
+    mutable vector<uint32_t> sorted_terms;               // by text, for prefix lookups
+    mutable size_t sorted_count;                         // terms already in sorted_terms
+    vector<pair<uint32_t, Posting>> pending;             // words of the event being indexed
+    size_t documents;
+    bool built;
+
+    template <typename Visit>
+    static void forEachWord(string_view text, Visit visit) {
+        char word[MAX_WORD];
+        size_t length = 0;
+        for (size_t i = 0; i <= text.size(); ++i) {
+            unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+            if (isalnum(c) || c >= 0x80) {
+                if (length < MAX_WORD) word[length++] = static_cast<char>(tolower(c));
+            } else if (length > 0) {
+                visit(string_view(word, length));
+                length = 0;
+            }
         }
     }
 
-    Color promptColor() {
-        map<string, Color> color_map = {
-            {"red", Color::RED}, {"blue", Color::BLUE}, {"green", Color::GREEN},
-            {"yellow", Color::YELLOW}, {"purple", Color::PURPLE}, {"orange", Color::ORANGE},
-            {"gray", Color::GRAY}, {"", Color::DEFAULT}
-        };
+    static uint32_t trigramKey(const char* text) {
+        return static_cast<unsigned char>(text[0]) << 16 | static_cast<unsigned char>(text[1]) << 8 |
+               static_cast<unsigned char>(text[2]);
+    }
 
-        while (true) {
-            cout << "Available colors:\n";
-            for (const auto& pair : color_map) {
-                if (!pair.first.empty()) {
-                    cout << getColorCode(pair.second) << pair.first << TermColor::RESET << " ";
+    // Trigrams of the word padded with a space on each side, so even
+    // one-letter words have some and word boundaries count.
+    template <typename Visit>
+    static void forEachTrigram(string_view word, Visit visit) {
+        char padded[MAX_WORD + 2];
+        padded[0] = ' ';
+        memcpy(padded + 1, word.data(), word.size());
+        padded[word.size() + 1] = ' ';
+        for (size_t i = 0; i < word.size(); ++i) visit(trigramKey(padded + i));
+    }
+
+    uint32_t termId(string_view word) {
+        auto it = term_ids.find(word);
+        if (it != term_ids.end()) return it->second;
+        uint32_t id = static_cast<uint32_t>(terms.size());
+        terms.push_back(Term{string(word), {}, 0, 0});
+        term_ids.emplace(terms.back().text, id);
+        forEachTrigram(word, [this, id](uint32_t key) {
+            vector<uint32_t>& list = trigrams[key];
+            if (list.empty() || list.back() != id) list.push_back(id);
+        });
+        return id;
+    }
+
+    // Gathers the words of one event into pending, one entry per term.
+    void collect(string_view title, string_view location, string_view description, bool create) {
+        pending.clear();
+        auto count = [this, create](string_view text, uint8_t Posting::*field) {
+            forEachWord(text, [this, create, field](string_view word) {
+                uint32_t id;
+                if (create) {
+                    id = termId(word);
+                } else {
+                    auto it = term_ids.find(word);
+                    if (it == term_ids.end()) return;
+                    id = it->second;
                 }
-            }
-            cout << "\nDefault color will be used if empty\n";
+                auto entry = find_if(pending.begin(), pending.end(),
+                    [id](const pair<uint32_t, Posting>& p) { return p.first == id; });
+                if (entry == pending.end()) {
+                    pending.emplace_back(id, Posting{0, 0, 0, 0, 0});
+                    entry = pending.end() - 1;
+                }
+                uint8_t& slot = entry->second.*field;
+                if (slot < 255) ++slot;
+            });
+        };
+        count(title, &Posting::title);
+        count(location, &Posting::location);
+        count(description, &Posting::description);
+    }
 
-            string input = toLower(getInput("Color: "));
-            if (color_map.count(input)) {
-                return color_map[input];
-            } else if (input.empty()) {
-                return Color::DEFAULT;
-            }
-            cout << "Invalid color. Please try again.\n";
-        }
+    static vector<Posting>::iterator findPosting(vector<Posting>& postings, int id) {
+        return lower_bound(postings.begin(), postings.end(), id,
+            [](const Posting& p, int key) { return p.id < key; });
     }
 
-    Priority promptPriority() {
-        while (true) {
-            string input = toLower(getInput("Priority (Low/Medium/High) [Medium]: "));
-            if (input == "high") return Priority::HIGH;
-            if (input == "low") return Priority::LOW;
-            if (input.empty() || input == "medium") return Priority::MEDIUM;
-            cout << "Invalid priority. Please try again.\n";
-        }
+    static const Posting* findPosting(const vector<Posting>& postings, int id) {
+        auto it = lower_bound(postings.begin(), postings.end(), id,
+            [](const Posting& p, int key) { return p.id < key; });
+        return it != postings.end() && it->id == id && it->live() ? &*it : nullptr;
     }
 
-    vector<string> promptAttendees() {
-        vector<string> attendees;
-        cout << "Enter attendees (one per line, empty to finish):\n";
-        while (true) {
-            string name = getInput("> ");
-            if (name.empty()) break;
-            attendees.push_back(name);
+    float idf(const Term& term) const {
+        double df = term.live;
+        return static_cast<float>(log(1.0 + (documents - df + 0.5) / (df + 0.5)));
+    }
+
+    // Saturating word counts, weighted by field.
+    static float fieldScore(const Posting& p) {
+        const float K = 1.2f;
+        auto saturate = [K](uint8_t count) { return count * (K + 1) / (count + K); };
+        return 3 * saturate(p.title) + 2 * saturate(p.location) + saturate(p.description);
+    }
+
+    const vector<uint32_t>& sortedTerms() const {
+        if (sorted_count == terms.size()) return sorted_terms;
+        auto by_text = [this](uint32_t a, uint32_t b) { return terms[a].text < terms[b].text; };
+        size_t old_size = sorted_terms.size();
+        for (size_t id = sorted_count; id < terms.size(); ++id) sorted_terms.push_back(static_cast<uint32_t>(id));
+        sort(sorted_terms.begin() + old_size, sorted_terms.end(), by_text);
+        inplace_merge(sorted_terms.begin(), sorted_terms.begin() + old_size, sorted_terms.end(), by_text);
+        sorted_count = terms.size();
+        return sorted_terms;
+    }
+
+    // Terms a query word stands for: itself, its completions, then terms
+    // containing it or sharing most of its trigrams.
+    void expand(string_view word, pmr::vector<Expansion>& result) const {
+        result.clear();
+        auto exact = term_ids.find(word);
+        if (exact != term_ids.end() && terms[exact->second].live > 0) result.push_back(Expansion{exact->second, 1.0f});
+
+        if (word.size() >= 2) {
+            const vector<uint32_t>& sorted = sortedTerms();
+            auto it = lower_bound(sorted.begin(), sorted.end(), word,
+                [this](uint32_t id, string_view key) { return string_view(terms[id].text) < key; });
+            size_t added = 0;
+            for (; it != sorted.end() && added < MAX_EXPANSIONS; ++it) {
+                const Term& term = terms[*it];
+                if (term.text.compare(0, word.size(), word.data(), word.size()) != 0) break;
+                if (term.text.size() == word.size() || term.live == 0) continue;
+                result.push_back(Expansion{*it, 0.6f});
+                ++added;
+            }
+        }
+        if (word.size() < 3) return;
+
+        pmr::unordered_map<uint32_t, uint32_t> shared(ScratchArena::resource());
+        pmr::vector<uint32_t> keys(ScratchArena::resource());
+        forEachTrigram(word, [&keys](uint32_t key) {
+            if (find(keys.begin(), keys.end(), key) == keys.end()) keys.push_back(key);
+        });
+        for (uint32_t key : keys) {
+            auto list = trigrams.find(key);
+            if (list == trigrams.end()) continue;
+            for (uint32_t id : list->second) ++shared[id];
+        }
+        size_t direct = result.size();
+        for (const auto& candidate : shared) {
+            const Term& term = terms[candidate.first];
+            if (term.live == 0 || term.text.compare(0, word.size(), word.data(), word.size()) == 0) continue;
+            float weight;
+            if (term.text.find(word.data(), 0, word.size()) != string::npos) {
+                weight = 0.4f;
+            } else {
+                float dice = 2.0f * candidate.second / (keys.size() + term.text.size());
+                if (dice < 0.6f) continue;
+                weight = 0.5f * dice;
+            }
+            result.push_back(Expansion{candidate.first, weight});
+        }
+        if (result.size() - direct > MAX_EXPANSIONS) {
+            nth_element(result.begin() + direct, result.begin() + direct + MAX_EXPANSIONS, result.end(),
+                [](const Expansion& a, const Expansion& b) { return a.weight > b.weight; });
+            result.resize(direct + MAX_EXPANSIONS);
         }
-        return attendees;
     }
-    std::string timeToString(time_t time) {
-        tm* local_tm = localtime(&time);  // Convert to local time
-        
-        char buffer[80];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", local_tm);
-        return std::string(buffer);
+
+    size_t postingCount(const pmr::vector<Expansion>& expansions) const {
+        size_t count = 0;
+        for (const Expansion& e : expansions) count += terms[e.term].live;
+        return count;
     }
 
+public:
+    TextIndex() : sorted_count(0), documents(0), built(false) {}
 
-    void addEvent() {
-    clearScreen();
-    cout << TermColor::BOLD << "=== Add New Event ===" << TermColor::RESET << "\n\n";
+    // Like EventColumns: the owner fills the index on first use, then
+    // passes every change through put() and remove().
+    bool isBuilt() const { return built; }
+    size_t termCount() const { return terms.size(); }
 
-    string title = getInput("Event Title: ");
-    while (title.empty()) {
-        cout << "Title cannot be empty!\n";
-        title = getInput("Event Title: ");
+    // Sorts the terms put() added into the order prefix lookups use. A
+    // search does this itself; callers that let several threads search
+    // at once do it first, while only one of them holds the index.
+    void sortNewTerms() const { sortedTerms(); }
+
+    void reset() {
+        terms.clear();
+        term_ids.clear();
+        trigrams.clear();
+        sorted_terms.clear();
+        sorted_count = 0;
+        documents = 0;
+        built = false;
     }
 
-    // Get current date and time
-    time_t now = time(nullptr);
-    tm* local_tm = localtime(&now);
-    
-    // Set default start time to current time
-    time_t start = mktime(local_tm);
-    
-    // Get priority first as it affects time handling
-    Priority priority = promptPriority();
-    
-    time_t end;
-    string start_date = dateToString(start);
-    string start_time = getTimePart(start);
-    
-    if (priority == Priority::LOW) {
-        // For LOW priority - use current date, ask for start time, duration fixed to 1 hour
-        string time_input = getInput("Start time (HH:MM) [" + start_time + "]: ");
-        if (!time_input.empty()) {
-            string full_datetime = start_date + " " + time_input;
-            time_t new_start = stringToTime(full_datetime, "%Y-%m-%d %H:%M");
-            if (new_start != 0) {
-                start = new_start;
-            } else {
-                cout << "Invalid time format, using current time.\n";
+    // Adds an event while the index is being filled, in any id order.
+    void append(int id, string_view title, string_view location, string_view description) {
+        collect(title, location, description, true);
+        for (auto& entry : pending) {
+            entry.second.id = id;
+            Term& term = terms[entry.first];
+            term.postings.push_back(entry.second);
+            ++term.live;
+        }
+        ++documents;
+    }
+
+    void markBuilt() {
+        for (Term& term : terms) {
+            if (!is_sorted(term.postings.begin(), term.postings.end(),
+                           [](const Posting& a, const Posting& b) { return a.id < b.id; })) {
+                sort(term.postings.begin(), term.postings.end(),
+                     [](const Posting& a, const Posting& b) { return a.id < b.id; });
             }
         }
-        end = start + 3600; // Fixed 1 hour duration
-        cout << "Low priority - duration set to 1 hour\n";
-    } 
-    else if (priority == Priority::MEDIUM) {
-        // For MEDIUM priority - use current date, ask for start time, duration fixed to 2 hours
-        string time_input = getInput("Start time (HH:MM) [" + start_time + "]: ");
-        if (!time_input.empty()) {
-            string full_datetime = start_date + " " + time_input;
-            time_t new_start = stringToTime(full_datetime, "%Y-%m-%d %H:%M");
-            if (new_start != 0) {
-                start = new_start;
+        sortedTerms();
+        built = true;
+    }
+
+    void put(const Event& event) {
+        if (!built) return;
+        collect(event.title.str(), event.location.str(), event.description, true);
+        for (auto& entry : pending) {
+            entry.second.id = event.id;
+            Term& term = terms[entry.first];
+            auto it = findPosting(term.postings, event.id);
+            if (it != term.postings.end() && it->id == event.id) {
+                if (!it->live()) --term.dead;
+                else --term.live;
+                *it = entry.second;
             } else {
-                cout << "Invalid time format, using current time.\n";
+                term.postings.insert(it, entry.second);
             }
+            ++term.live;
         }
-        end = start + 7200; // Fixed 2 hours duration
-        cout << "Medium priority - duration set to 2 hours\n";
+        ++documents;
     }
-    else { // HIGH priority
-        // For HIGH priority - ask for full start and end datetime
-        string default_start = timeToString(start);
-        string start_input = getInput("Start date & time (YYYY-MM-DD HH:MM) [" + default_start + "]: ");
-        if (!start_input.empty()) {
-            time_t new_start = stringToTime(start_input, "%Y-%m-%d %H:%M");
-            if (new_start != 0) {
-                start = new_start;
-            } else {
-                cout << "Invalid format, using current time.\n";
+
+    // Must be given the event as it was indexed, before any edit.
+    void remove(const Event& event) {
+        if (!built) return;
+        collect(event.title.str(), event.location.str(), event.description, false);
+        for (const auto& entry : pending) {
+            Term& term = terms[entry.first];
+            auto it = findPosting(term.postings, event.id);
+            if (it == term.postings.end() || it->id != event.id || !it->live()) continue;
+            it->title = it->location = it->description = 0;
+            --term.live;
+            // Removed postings are dropped in bulk once they outnumber the rest.
+            if (++term.dead > 64 && term.dead > term.live) {
+                term.postings.erase(remove_if(term.postings.begin(), term.postings.end(),
+                    [](const Posting& p) { return !p.live(); }), term.postings.end());
+                term.dead = 0;
+            }
+        }
+        if (documents > 0) --documents;
+    }
+
+    // Best matches for every word of the query, highest score first.
+    // Inside a ScratchArena::Scope the result is allocated from the arena
+    // and must not be used after that Scope ends.
+    pmr::vector<SearchHit> search(string_view query, size_t limit) const {
+        pmr::memory_resource* scratch = ScratchArena::resource();
+        pmr::vector<SearchHit> hits(scratch);
+        pmr::vector<pmr::string> words(scratch);
+        forEachWord(query, [&words](string_view word) {
+            if (find(words.begin(), words.end(), word) == words.end()) words.emplace_back(word);
+        });
+        if (words.empty() || limit == 0) return hits;
+
+        pmr::vector<pmr::vector<Expansion>> expansions(scratch);
+        for (const pmr::string& word : words) {
+            expansions.emplace_back();
+            expand(word, expansions.back());
+            if (expansions.back().empty()) return hits;
+        }
+        // Rarest word first: it bounds the candidates the others filter.
+        sort(expansions.begin(), expansions.end(),
+             [this](const pmr::vector<Expansion>& a, const pmr::vector<Expansion>& b) {
+                 return postingCount(a) < postingCount(b);
+             });
+
+        // Candidates: the union of the first word's postings, best
+        // expansion score per event, kept in id order.
+        pmr::vector<SearchHit> merged(scratch);
+        for (const Expansion& e : expansions[0]) {
+            const Term& term = terms[e.term];
+            float scale = e.weight * idf(term);
+            merged.clear();
+            merged.reserve(hits.size() + term.live);
+            auto it = hits.begin();
+            for (const Posting& p : term.postings) {
+                if (!p.live()) continue;
+                while (it != hits.end() && it->id < p.id) merged.push_back(*it++);
+                float score = scale * fieldScore(p);
+                if (it != hits.end() && it->id == p.id) merged.push_back(SearchHit{p.id, max(score, (it++)->score)});
+                else merged.push_back(SearchHit{p.id, score});
+            }
+            merged.insert(merged.end(), it, hits.end());
+            hits.swap(merged);
+        }
+
+        for (size_t w = 1; w < expansions.size() && !hits.empty(); ++w) {
+            size_t kept = 0;
+            for (const SearchHit& hit : hits) {
+                float best = 0;
+                for (const Expansion& e : expansions[w]) {
+                    const Term& term = terms[e.term];
+                    if (const Posting* p = findPosting(term.postings, hit.id)) {
+                        best = max(best, e.weight * idf(term) * fieldScore(*p));
+                    }
+                }
+                if (best > 0) hits[kept++] = SearchHit{hit.id, hit.score + best};
+            }
+            hits.resize(kept);
+        }
+
+        auto ranked = [](const SearchHit& a, const SearchHit& b) {
+            return a.score != b.score ? a.score > b.score : a.id < b.id;
+        };
+        if (hits.size() > limit) {
+            partial_sort(hits.begin(), hits.begin() + limit, hits.end(), ranked);
+            hits.resize(limit);
+        } else {
+            sort(hits.begin(), hits.end(), ranked);
+        }
+        return hits;
+    }
+};
+
+// ==================== Recurrence ====================
+// Recurring events are stored once and expanded on demand. A pattern is the
+// frequency optionally followed by ';key=value' options, for example
+//   Weekly;interval=2;count=10;until=2026-12-31;except=2026-11-12,2026-11-26
+enum class Frequency { NONE, DAILY, WEEKLY, MONTHLY };
+
+struct RecurrenceRule {
+    static const string HELP;
+
+    Frequency frequency;
+    int interval;
+    long count;               // 0 = no limit
+    long until_day;           // last local day an occurrence may start on
+    vector<long> exceptions;  // skipped local days, sorted
+
+    RecurrenceRule()
+        : frequency(Frequency::NONE), interval(1), count(0),
+          until_day(numeric_limits<long>::max()) {}
+
+    bool valid() const { return frequency != Frequency::NONE; }
+
+    bool isException(long day) const {
+        return binary_search(exceptions.begin(), exceptions.end(), day);
+    }
+
+    static RecurrenceRule parse(const string& pattern) {
+        RecurrenceRule rule;
+        stringstream ss(pattern);
+        string part;
+        if (!getline(ss, part, ';')) return rule;
+        part = toLower(trim(part));
+        if (part == "daily") rule.frequency = Frequency::DAILY;
+        else if (part == "weekly") rule.frequency = Frequency::WEEKLY;
+        else if (part == "monthly") rule.frequency = Frequency::MONTHLY;
+        else return rule;
+
+        while (getline(ss, part, ';')) {
+            size_t eq = part.find('=');
+            if (eq == string::npos) continue;
+            string key = toLower(trim(part.substr(0, eq)));
+            string value = trim(part.substr(eq + 1));
+            if (key == "interval") {
+                rule.interval = max(1, safeStoi(value, 1));
+            } else if (key == "count") {
+                rule.count = max(0, safeStoi(value, 0));
+            } else if (key == "until") {
+                time_t until = stringToTime(value, "%Y-%m-%d");
+                if (until != 0) rule.until_day = localDayNumber(until);
+            } else if (key == "except") {
+                stringstream dates(value);
+                string date;
+                while (getline(dates, date, ',')) {
+                    time_t skipped = stringToTime(trim(date), "%Y-%m-%d");
+                    if (skipped != 0) rule.exceptions.push_back(localDayNumber(skipped));
+                }
+            }
+        }
+        sort(rule.exceptions.begin(), rule.exceptions.end());
+        return rule;
+    }
+};
+
+const string RecurrenceRule::HELP =
+    "(Daily/Weekly/Monthly, optionally ;interval=N;count=N;until=YYYY-MM-DD;except=YYYY-MM-DD,...)";
+
+// One scheduled appearance of an event. One-off events have a single
+// occurrence carrying their own times.
+struct Occurrence {
+    const Event* event;
+    time_t start_time;
+    time_t end_time;
+
+    void printSummary(bool detailed = false) const {
+        event->printSummary(detailed, start_time, end_time);
+    }
+
+    // Copy of the event moved to this occurrence's times.
+    Event toEvent() const {
+        Event copy = *event;
+        copy.start_time = start_time;
+        copy.end_time = end_time;
+        return copy;
+    }
+};
+
+struct RecurringSeries {
+    Event* event;
+    RecurrenceRule rule;
+};
+
+// Walks the occurrences of one recurring event that overlap [lo, hi] in
+// start order. It jumps arithmetically to the first candidate near lo, so a
+// series spanning years costs nothing until a window reaches it.
+class OccurrenceCursor {
+private:
+    const Event* event;
+    const RecurrenceRule* rule;
+    long first_day;
+    int year, month, day, hour, minute, second;
+    time_t duration;
+    time_t lo;
+    time_t hi;
+    bool day_touch;  // day queries: ending exactly at lo does not count
+    long index;
+    Occurrence current;
+    bool has_current;
+
+    // Local day of occurrence k, with monthly dates clamped to the month's end.
+    long dayOf(long k) const {
+        if (rule->frequency == Frequency::MONTHLY) {
+            long months = (year * 12L + month - 1) + k * rule->interval;
+            int y = static_cast<int>(months / 12);
+            int m = static_cast<int>(months % 12) + 1;
+            return daysFromCivil(y, m, min(day, daysInMonth(y, m)));
+        }
+        long step = rule->frequency == Frequency::WEEKLY ? 7 : 1;
+        return first_day + k * step * rule->interval;
+    }
+
+    long firstCandidate() const {
+        long lo_day = localDayNumber(lo);
+        long span_days = duration / 86400 + 1;
+        long k = 0;
+        if (rule->frequency == Frequency::MONTHLY) {
+            int y, m, d;
+            civilFromDays(lo_day - span_days, y, m, d);
+            long months = (y * 12L + m - 1) - (year * 12L + month - 1) - 1;
+            k = months / rule->interval;
+        } else {
+            long step = (rule->frequency == Frequency::WEEKLY ? 7 : 1) * rule->interval;
+            k = (lo_day - span_days - first_day) / step;
+        }
+        return max(0L, k);
+    }
+
+    void seek() {
+        has_current = false;
+        for (;; ++index) {
+            if (rule->count > 0 && index >= rule->count) return;
+            long occurrence_day = dayOf(index);
+            if (occurrence_day > rule->until_day) return;
+            int y, m, d;
+            civilFromDays(occurrence_day, y, m, d);
+            time_t start = localTimeFromCivil(y, m, d, hour, minute, second);
+            if (start > hi) return;
+            time_t end = start + duration;
+            time_t reach = day_touch ? max(start, end - 1) : end;
+            if (reach < lo || rule->isException(occurrence_day)) continue;
+            current = Occurrence{event, start, end};
+            has_current = true;
+            ++index;
+            return;
+        }
+    }
+
+public:
+    OccurrenceCursor(const Event* event, const RecurrenceRule* rule, time_t lo, time_t hi, bool day_touch)
+        : event(event), rule(rule), duration(max<time_t>(0, event->end_time - event->start_time)),
+          lo(lo), hi(hi), day_touch(day_touch), index(0), current{event, 0, 0}, has_current(false) {
+        CivilTime first = localCivil(event->start_time);
+        year = first.year;
+        month = first.month;
+        day = first.day;
+        hour = first.hour;
+        minute = first.minute;
+        second = first.second;
+        first_day = first.day_number;
+        index = firstCandidate();
+        seek();
+    }
+
+    bool valid() const { return has_current; }
+    const Occurrence& peek() const { return current; }
+
+    bool advance() {
+        seek();
+        return has_current;
+    }
+};
+
+// ==================== Attendee Index ====================
+// Each attendee's own interval tree of one-off events plus their recurring
+// series, so one person's schedule costs O(log n + k) rather than a scan of
+// every event with a name compare on each. People are keyed by the folded
+// id of their interned name, so "Alice" and "alice" share a schedule, as
+// with equalsIgnoreCase. A schedule is dropped when its last event leaves,
+// while the events in it still hold the folded name alive. One-off records
+// of a mapped snapshot are listed by record number instead, so indexing
+// them loads nothing; those schedules hold their folded name themselves.
+class AttendeeIndex {
+public:
+    // A snapshot record in a schedule. reach is the latest end_time of
+    // this and every earlier entry, so a range query can skip the prefix
+    // that ends before it.
+    struct BaseRecord {
+        uint32_t record;
+        int64_t reach;
+    };
+
+    struct Schedule {
+        IntervalTree one_offs;
+        vector<RecurringSeries> series;
+        vector<BaseRecord> base_records;  // in snapshot (key) order
+        InternedString person;            // keeps the folded name alive for base_records
+    };
+
+private:
+    unordered_map<uint32_t, unique_ptr<Schedule>> schedules;
+    bool built;
+
+    // Folded ids of the event's attendees, each once.
+    template <typename Visit>
+    static void forEachPerson(const Event& event, Visit visit) {
+        for (size_t i = 0; i < event.attendees.size(); ++i) {
+            uint32_t person = event.attendees[i].folded();
+            if (person == 0) continue;
+            bool seen = false;
+            for (size_t j = 0; j < i && !seen; ++j) seen = event.attendees[j].folded() == person;
+            if (!seen) visit(person);
+        }
+    }
+
+    static bool parseSeries(const Event& event, RecurrenceRule& rule) {
+        if (!event.is_recurring) return false;
+        rule = RecurrenceRule::parse(event.recurrence_pattern);
+        return rule.valid();
+    }
+
+    Schedule& schedule(uint32_t person) {
+        unique_ptr<Schedule>& slot = schedules[person];
+        if (!slot) slot.reset(new Schedule());
+        return *slot;
+    }
+
+public:
+    AttendeeIndex() : built(false) {}
+
+    // Like the text index: filled on first use, then kept current through
+    // put() and remove().
+    bool isBuilt() const { return built; }
+    size_t people() const { return schedules.size(); }
+
+    void reset() {
+        schedules.clear();
+        built = false;
+    }
+
+    // Fills the index in one pass; events must not repeat.
+    template <typename Events>
+    void build(const Events& events) {
+        schedules.clear();
+        unordered_map<uint32_t, vector<Event*>> one_offs;
+        for (Event* event : events) {
+            RecurrenceRule rule;
+            bool series = parseSeries(*event, rule);
+            forEachPerson(*event, [&](uint32_t person) {
+                if (series) schedule(person).series.push_back(RecurringSeries{event, rule});
+                else one_offs[person].push_back(event);
+            });
+        }
+        for (auto& person : one_offs) {
+            vector<Event*>& list = person.second;
+            sort(list.begin(), list.end(), [](const Event* a, const Event* b) { return IntervalTree::keyLess(a, b); });
+            schedule(person.first).one_offs.build(list);
+        }
+        built = true;
+    }
+
+    // Lists a snapshot one-off record under a person, given by their
+    // folded name. Records must arrive in snapshot order.
+    void listBase(const InternedString& person, uint32_t record, int64_t end_time) {
+        Schedule& s = schedule(person.id());
+        if (s.person.empty()) s.person = person;
+        int64_t reach = s.base_records.empty() ? end_time : max(s.base_records.back().reach, end_time);
+        s.base_records.push_back(BaseRecord{record, reach});
+    }
+
+    void put(Event* event) {
+        if (!built || event->attendees.empty()) return;
+        RecurrenceRule rule;
+        bool series = parseSeries(*event, rule);
+        forEachPerson(*event, [&](uint32_t person) {
+            if (series) schedule(person).series.push_back(RecurringSeries{event, rule});
+            else schedule(person).one_offs.insert(event);
+        });
+    }
+
+    // Must be given the event as it was indexed, before any edit.
+    void remove(const Event* event) {
+        if (!built) return;
+        forEachPerson(*event, [&](uint32_t person) {
+            auto it = schedules.find(person);
+            if (it == schedules.end()) return;
+            Schedule& s = *it->second;
+            if (!s.one_offs.erase(event)) {
+                s.series.erase(remove_if(s.series.begin(), s.series.end(),
+                    [event](const RecurringSeries& r) { return r.event == event; }), s.series.end());
+            }
+            if (s.one_offs.size() == 0 && s.series.empty() && s.base_records.empty()) schedules.erase(it);
+        });
+    }
+
+    // Calls visit(person, schedule) for everyone with events.
+    template <typename Visit>
+    void forEachSchedule(Visit visit) const {
+        for (const auto& entry : schedules) visit(entry.first, *entry.second);
+    }
+
+    // The person's schedule, or an empty one.
+    const Schedule& find(const InternedString& name) const {
+        static const Schedule nobody;
+        auto it = schedules.find(name.folded());
+        return it == schedules.end() ? nobody : *it->second;
+    }
+};
+
+// ==================== Snapshot Storage ====================
+// Binary calendar snapshot, version 1. Layout:
+//   header | records | time index | id index | string table
+// Records are fixed width. One-off events come first, sorted by
+// (start_time, id), followed by the recurring series. The time index holds
+// one int64 per one-off record: the largest end_time of the implicit
+// balanced subtree rooted at that record (the middle of its range), so
+// range queries run in O(log n + k) straight from the mapped pages. Text
+// lives in the string table as length-prefixed, 4-byte aligned entries;
+// an attendee list is a count followed by string offsets. Offset 0 is
+// always the empty string.
+static const char SNAPSHOT_MAGIC[8] = {'C', 'A', 'L', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t one_off_count;
+    uint64_t records_offset;
+    uint64_t index_offset;
+    uint64_t ids_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    int64_t max_id;
+};
+
+struct SnapshotRecord {
+    int64_t start_time;
+    int64_t end_time;
+    int32_t id;
+    uint8_t color;
+    uint8_t priority;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t title;
+    uint32_t description;
+    uint32_t location;
+    uint32_t recurrence;
+    uint32_t attendees;
+    uint32_t reserved2;
+};
+
+struct SnapshotId {
+    int32_t id;
+    uint32_t record;
+};
+
+static_assert(sizeof(SnapshotHeader) == 80, "snapshot header layout changed");
+static_assert(sizeof(SnapshotRecord) == 48, "snapshot record layout changed");
+static_assert(sizeof(SnapshotId) == 8, "snapshot id layout changed");
+
+enum SnapshotFlags : uint8_t { SNAPSHOT_ALL_DAY = 1, SNAPSHOT_RECURRING = 2 };
+
+class MappedSnapshot {
+private:
+    const char* data;
+    size_t length;
+    vector<char> buffer;  // platforms without mmap read the file instead
+    const SnapshotHeader* header;
+    const SnapshotRecord* records;
+    const int64_t* max_end;
+    const SnapshotId* ids;
+    const char* strings;
+
+    MappedSnapshot()
+        : data(nullptr), length(0), header(nullptr), records(nullptr),
+          max_end(nullptr), ids(nullptr), strings(nullptr) {}
+
+    bool sectionFits(uint64_t offset, uint64_t count, uint64_t width) const {
+        return offset <= length && count <= (length - offset) / width;
+    }
+
+    bool validate(string& error) {
+        if (length < sizeof(SnapshotHeader)) {
+            error = "file too small";
+            return false;
+        }
+        header = reinterpret_cast<const SnapshotHeader*>(data);
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            error = "not a calendar snapshot";
+            return false;
+        }
+        if (header->version != SNAPSHOT_VERSION || header->record_size != sizeof(SnapshotRecord)) {
+            error = "unsupported snapshot version";
+            return false;
+        }
+        if (header->one_off_count > header->record_count ||
+            header->record_count > numeric_limits<uint32_t>::max() ||
+            !sectionFits(header->records_offset, header->record_count, sizeof(SnapshotRecord)) ||
+            !sectionFits(header->index_offset, header->one_off_count, sizeof(int64_t)) ||
+            !sectionFits(header->ids_offset, header->record_count, sizeof(SnapshotId)) ||
+            !sectionFits(header->strings_offset, header->strings_size, 1) ||
+            header->records_offset % 8 != 0 || header->index_offset % 8 != 0 ||
+            header->ids_offset % 8 != 0 || header->strings_offset % 4 != 0) {
+            error = "corrupt snapshot header";
+            return false;
+        }
+        records = reinterpret_cast<const SnapshotRecord*>(data + header->records_offset);
+        max_end = reinterpret_cast<const int64_t*>(data + header->index_offset);
+        ids = reinterpret_cast<const SnapshotId*>(data + header->ids_offset);
+        strings = data + header->strings_offset;
+        return true;
+    }
+
+public:
+    ~MappedSnapshot() {
+#ifndef _WIN32
+        if (data && buffer.empty()) munmap(const_cast<char*>(data), length);
+#endif
+    }
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    static unique_ptr<MappedSnapshot> open(const string& path, string& error) {
+        unique_ptr<MappedSnapshot> snapshot(new MappedSnapshot());
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            error = "cannot read " + path;
+            return nullptr;
+        }
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "cannot map " + path;
+            return nullptr;
+        }
+        snapshot->data = static_cast<const char*>(mapped);
+        snapshot->length = static_cast<size_t>(info.st_size);
+#else
+        ifstream in(path, ios::binary);
+        if (!in) {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        snapshot->buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        snapshot->data = snapshot->buffer.data();
+        snapshot->length = snapshot->buffer.size();
+#endif
+        if (!snapshot->validate(error)) return nullptr;
+        return snapshot;
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(header->record_count); }
+    uint32_t oneOffCount() const { return static_cast<uint32_t>(header->one_off_count); }
+    int maxId() const { return static_cast<int>(header->max_id); }
+    const SnapshotRecord& record(uint32_t index) const { return records[index]; }
+
+    // Text in place in the mapped string table.
+    string_view textView(uint32_t offset) const {
+        if (offset > header->strings_size || header->strings_size - offset < sizeof(uint32_t)) return {};
+        uint32_t len;
+        memcpy(&len, strings + offset, sizeof(len));
+        if (len > header->strings_size - offset - sizeof(uint32_t)) return {};
+        return string_view(strings + offset + sizeof(uint32_t), len);
+    }
+
+    string text(uint32_t offset) const { return string(textView(offset)); }
+
+    // Calls visit(item_offset) for each item of a stored list. Equal
+    // strings share one offset, so it can key a cache.
+    template <typename Visit>
+    void forEachListOffset(uint32_t offset, Visit visit) const {
+        if (offset > header->strings_size || header->strings_size - offset < sizeof(uint32_t)) return;
+        uint32_t count;
+        memcpy(&count, strings + offset, sizeof(count));
+        if (count > (header->strings_size - offset) / sizeof(uint32_t) - 1) return;
+        const uint32_t* items = reinterpret_cast<const uint32_t*>(strings + offset + sizeof(uint32_t));
+        for (uint32_t i = 0; i < count; ++i) visit(items[i]);
+    }
+
+    // Calls visit(text) for each item of a stored list, in place, so
+    // nothing is interned.
+    template <typename Visit>
+    void forEachListItem(uint32_t offset, Visit visit) const {
+        forEachListOffset(offset, [this, &visit](uint32_t item) { visit(textView(item)); });
+    }
+
+    NameList list(uint32_t offset) const {
+        NameList result;
+        forEachListItem(offset, [&result](string_view item) { result.push_back(InternedString(item)); });
+        return result;
+    }
+
+    // Record index of an event id, or -1. The id table comes from the file,
+    // so an entry pointing past the records counts as a miss.
+    long findRecord(int id) const {
+        const SnapshotId* first = ids;
+        const SnapshotId* last = ids + header->record_count;
+        const SnapshotId* it = lower_bound(first, last, id,
+            [](const SnapshotId& entry, int key) { return entry.id < key; });
+        if (it == last || it->id != id || it->record >= header->record_count) return -1;
+        return static_cast<long>(it->record);
+    }
+
+    Event materialize(uint32_t index) const {
+        const SnapshotRecord& r = records[index];
+        Event event = Event::withId(r.id);
+        event.title = text(r.title);
+        event.start_time = static_cast<time_t>(r.start_time);
+        event.end_time = static_cast<time_t>(r.end_time);
+        event.color = static_cast<Color>(r.color);
+        event.priority = static_cast<Priority>(r.priority);
+        event.description = text(r.description);
+        event.location = text(r.location);
+        event.attendees = list(r.attendees);
+        event.is_all_day = (r.flags & SNAPSHOT_ALL_DAY) != 0;
+        event.is_recurring = (r.flags & SNAPSHOT_RECURRING) != 0;
+        event.recurrence_pattern = text(r.recurrence);
+        return event;
+    }
+
+    // Walks one-off records overlapping [lo, hi] in key order using the
+    // implicit interval tree, like IntervalTree::Cursor does for memory.
+    class Cursor {
+    private:
+        struct Span {
+            uint32_t first;
+            uint32_t last;
+        };
+
+        const MappedSnapshot* snapshot;
+        Span stack[64];
+        int depth;
+        time_t lo;
+        time_t hi;
+        bool day_touch;  // day queries: ending exactly at lo does not count
+
+        void pushLeft(uint32_t first, uint32_t last) {
+            while (first < last) {
+                uint32_t mid = first + (last - first) / 2;
+                if (snapshot->max_end[mid] < lo) return;
+                stack[depth++] = Span{first, last};
+                last = mid;
+            }
+        }
+
+    public:
+        Cursor() : snapshot(nullptr), depth(0), lo(0), hi(0), day_touch(false) {}
+
+        Cursor(const MappedSnapshot* snapshot, time_t lo, time_t hi, bool day_touch)
+            : snapshot(snapshot), depth(0), lo(lo), hi(hi), day_touch(day_touch) {
+            pushLeft(0, snapshot->oneOffCount());
+        }
+
+        // Next matching record index, or -1.
+        long next() {
+            while (depth > 0) {
+                Span span = stack[--depth];
+                uint32_t mid = span.first + (span.last - span.first) / 2;
+                const SnapshotRecord& r = snapshot->records[mid];
+                if (r.start_time > hi) {
+                    depth = 0;
+                    return -1;
+                }
+                pushLeft(mid + 1, span.last);
+                int64_t reach = day_touch ? max(r.start_time, r.end_time - 1) : r.end_time;
+                if (reach >= lo) return mid;
+            }
+            return -1;
+        }
+    };
+};
+
+// Builds a snapshot in memory and writes it out in one go. One-off events
+// must be added in (start_time, id) order.
+class SnapshotWriter {
+private:
+    vector<SnapshotRecord> one_offs;
+    vector<SnapshotRecord> series;
+    string strings;
+    unordered_map<string, uint32_t> interned;
+    int max_id;
+
+    void pad() {
+        while (strings.size() % 4 != 0) strings.push_back('\0');
+    }
+
+    void appendWord(uint32_t value) {
+        strings.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    uint32_t addString(const string& text) {
+        auto it = interned.find(text);
+        if (it != interned.end()) return it->second;
+        uint32_t offset = static_cast<uint32_t>(strings.size());
+        appendWord(static_cast<uint32_t>(text.size()));
+        strings += text;
+        pad();
+        interned.emplace(text, offset);
+        return offset;
+    }
+
+    uint32_t addList(const NameList& items) {
+        if (items.empty()) return 0;
+        vector<uint32_t> offsets;
+        for (const auto& item : items) offsets.push_back(addString(item));
+        uint32_t offset = static_cast<uint32_t>(strings.size());
+        appendWord(static_cast<uint32_t>(offsets.size()));
+        for (uint32_t item : offsets) appendWord(item);
+        return offset;
+    }
+
+    SnapshotRecord toRecord(const Event& event) {
+        SnapshotRecord r = {};
+        r.start_time = event.start_time;
+        r.end_time = event.end_time;
+        r.id = event.id;
+        r.color = static_cast<uint8_t>(event.color);
+        r.priority = static_cast<uint8_t>(event.priority);
+        r.flags = (event.is_all_day ? SNAPSHOT_ALL_DAY : 0) | (event.is_recurring ? SNAPSHOT_RECURRING : 0);
+        r.title = addString(event.title);
+        r.description = addString(event.description);
+        r.location = addString(event.location);
+        r.recurrence = addString(event.recurrence_pattern);
+        r.attendees = addList(event.attendees);
+        max_id = max(max_id, event.id);
+        return r;
+    }
+
+    static int64_t buildIndex(const vector<SnapshotRecord>& records, vector<int64_t>& max_end,
+                              size_t first, size_t last) {
+        if (first >= last) return numeric_limits<int64_t>::min();
+        size_t mid = first + (last - first) / 2;
+        int64_t reach = max(records[mid].end_time,
+                            max(buildIndex(records, max_end, first, mid),
+                                buildIndex(records, max_end, mid + 1, last)));
+        max_end[mid] = reach;
+        return reach;
+    }
+
+public:
+    SnapshotWriter() : max_id(0) {
+        appendWord(0);  // offset 0: the empty string / empty list
+        interned.emplace("", 0);
+    }
+
+    void addOneOff(const Event& event) { one_offs.push_back(toRecord(event)); }
+    void addSeries(const Event& event) { series.push_back(toRecord(event)); }
+
+    bool write(const string& path, string& error) {
+        vector<int64_t> max_end(one_offs.size());
+        buildIndex(one_offs, max_end, 0, one_offs.size());
+
+        vector<SnapshotId> ids;
+        ids.reserve(one_offs.size() + series.size());
+        for (size_t i = 0; i < one_offs.size(); ++i) {
+            ids.push_back(SnapshotId{one_offs[i].id, static_cast<uint32_t>(i)});
+        }
+        for (size_t i = 0; i < series.size(); ++i) {
+            ids.push_back(SnapshotId{series[i].id, static_cast<uint32_t>(one_offs.size() + i)});
+        }
+        sort(ids.begin(), ids.end(), [](const SnapshotId& a, const SnapshotId& b) { return a.id < b.id; });
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.record_size = sizeof(SnapshotRecord);
+        header.record_count = one_offs.size() + series.size();
+        header.one_off_count = one_offs.size();
+        header.records_offset = sizeof(SnapshotHeader);
+        header.index_offset = header.records_offset + header.record_count * sizeof(SnapshotRecord);
+        header.ids_offset = header.index_offset + one_offs.size() * sizeof(int64_t);
+        header.strings_offset = header.ids_offset + ids.size() * sizeof(SnapshotId);
+        header.strings_size = strings.size();
+        header.max_id = max_id;
+
+        string temp_path = path + ".tmp";
+        FILE* out = fopen(temp_path.c_str(), "wb");
+        if (!out) {
+            error = "cannot create " + temp_path;
+            return false;
+        }
+        // An empty vector may have no buffer at all, which fwrite must not see.
+        auto writeAll = [out](const void* data, size_t size, size_t count) {
+            return count == 0 || fwrite(data, size, count, out) == count;
+        };
+        bool ok = writeAll(&header, sizeof(header), 1);
+        ok = ok && writeAll(one_offs.data(), sizeof(SnapshotRecord), one_offs.size());
+        ok = ok && writeAll(series.data(), sizeof(SnapshotRecord), series.size());
+        ok = ok && writeAll(max_end.data(), sizeof(int64_t), max_end.size());
+        ok = ok && writeAll(ids.data(), sizeof(SnapshotId), ids.size());
+        ok = ok && writeAll(strings.data(), 1, strings.size());
+        ok = ok && fflush(out) == 0;
+#ifndef _WIN32
+        ok = ok && fsync(fileno(out)) == 0;
+#endif
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            remove(temp_path.c_str());
+            error = "write to " + temp_path + " failed";
+            return false;
+        }
+#ifdef _WIN32
+        remove(path.c_str());
+#endif
+        if (rename(temp_path.c_str(), path.c_str()) != 0) {
+            remove(temp_path.c_str());
+            error = "cannot replace " + path;
+            return false;
+        }
+        return true;
+    }
+};
+
+// The read-only base of a Calendar opened from a snapshot. Records become
+// Event objects only when a query first touches them ("faulting"), and an
+// edited or deleted record is shadowed so the mapped index skips it while
+// the in-memory layer takes over.
+class SnapshotLayer {
+private:
+    unordered_map<uint32_t, unique_ptr<Event>> faulted;  // record -> pristine event
+    unordered_map<int, uint32_t> faulted_ids;             // id -> record, for faulted events
+    unordered_set<uint32_t> shadowed;
+    mutex fault_lock;  // queries running side by side fault records in together
+
+public:
+    shared_ptr<const MappedSnapshot> file;  // shared with snapshot images being written
+
+    explicit SnapshotLayer(unique_ptr<MappedSnapshot> file) : file(move(file)) {}
+
+    size_t liveCount() const { return file->size() - shadowed.size(); }
+
+    bool isShadowed(uint32_t record) const {
+        return !shadowed.empty() && shadowed.count(record) != 0;
+    }
+
+    Event* fault(uint32_t record) {
+        lock_guard<mutex> guard(fault_lock);
+        auto it = faulted.find(record);
+        if (it != faulted.end()) return it->second.get();
+        unique_ptr<Event> event(new Event(file->materialize(record)));
+        Event* raw = event.get();
+        faulted_ids[raw->id] = record;
+        faulted.emplace(record, move(event));
+        return raw;
+    }
+
+    // Shadowed records in ascending order.
+    vector<uint32_t> shadowedRecords() const {
+        vector<uint32_t> records(shadowed.begin(), shadowed.end());
+        sort(records.begin(), records.end());
+        return records;
+    }
+
+    Event* findById(int id) {
+        long record = file->findRecord(id);
+        if (record < 0 || isShadowed(static_cast<uint32_t>(record))) return nullptr;
+        return fault(static_cast<uint32_t>(record));
+    }
+
+    // Hands a faulted event over to the in-memory layer and shadows its
+    // record. Returns nullptr if the event does not belong to this layer.
+    unique_ptr<Event> promote(const Event* event) {
+        lock_guard<mutex> guard(fault_lock);
+        auto id_it = faulted_ids.find(event->id);
+        if (id_it == faulted_ids.end()) return nullptr;
+        auto it = faulted.find(id_it->second);
+        if (it == faulted.end() || it->second.get() != event) return nullptr;
+        unique_ptr<Event> owned = move(it->second);
+        shadowed.insert(id_it->second);
+        faulted.erase(it);
+        faulted_ids.erase(id_it);
+        return owned;
+    }
+
+    // Drops a record that was never faulted in.
+    bool shadow(int id) {
+        long record = file->findRecord(id);
+        if (record < 0 || isShadowed(static_cast<uint32_t>(record))) return false;
+        shadowed.insert(static_cast<uint32_t>(record));
+        return true;
+    }
+};
+
+// What a snapshot of a Calendar will hold, detached from the calendar:
+// copies of its in-memory events, plus the mapped base file and the
+// records in it that were shadowed when the image was taken. The calendar
+// can go on changing, or drop its base, while another thread writes the
+// image out.
+class SnapshotImage {
+private:
+    vector<Event> one_offs;  // live in-memory one-offs in (start_time, id) order
+    vector<Event> series;
+    shared_ptr<const MappedSnapshot> base;
+    vector<uint32_t> shadowed;  // ascending
+
+    friend class Calendar;
+
+public:
+    // Merges the base records with the in-memory one-offs and writes the
+    // result atomically over path.
+    bool write(const string& path, string& error) const {
+        SnapshotWriter writer;
+        uint32_t base_end = base ? base->oneOffCount() : 0;
+        auto skipShadowed = [this, base_end](uint32_t record) {
+            while (record < base_end && binary_search(shadowed.begin(), shadowed.end(), record)) ++record;
+            return record;
+        };
+        uint32_t record = skipShadowed(0);
+        size_t next = 0;
+        while (next < one_offs.size() || record < base_end) {
+            bool take_base = false;
+            if (record < base_end) {
+                const SnapshotRecord& r = base->record(record);
+                take_base = next == one_offs.size() || r.start_time < one_offs[next].start_time ||
+                            (r.start_time == one_offs[next].start_time && r.id < one_offs[next].id);
+            }
+            if (take_base) {
+                writer.addOneOff(base->materialize(record));
+                record = skipShadowed(record + 1);
+            } else {
+                writer.addOneOff(one_offs[next++]);
+            }
+        }
+        for (const Event& event : series) writer.addSeries(event);
+        return writer.write(path, error);
+    }
+};
+
+// Live base-layer events overlapping a window, faulted in as they are
+// reached. Walks either the whole snapshot through its time index or one
+// person's listed records.
+class SnapshotCursor {
+private:
+    SnapshotLayer* layer;
+    MappedSnapshot::Cursor cursor;
+    const AttendeeIndex::BaseRecord* listed;  // both null unless walking a list
+    const AttendeeIndex::BaseRecord* listed_end;
+    time_t lo;
+    time_t hi;
+
+public:
+    SnapshotCursor() : layer(nullptr), listed(nullptr), listed_end(nullptr), lo(0), hi(0) {}
+
+    SnapshotCursor(SnapshotLayer* layer, time_t lo, time_t hi, bool day_touch)
+        : layer(layer), cursor(layer->file.get(), lo, hi, day_touch), listed(nullptr), listed_end(nullptr),
+          lo(lo), hi(hi) {}
+
+    SnapshotCursor(SnapshotLayer* layer, const vector<AttendeeIndex::BaseRecord>& records, time_t lo, time_t hi)
+        : layer(layer), listed(nullptr), listed_end(records.data() + records.size()), lo(lo), hi(hi) {
+        listed = partition_point(records.data(), listed_end,
+                                 [lo](const AttendeeIndex::BaseRecord& entry) { return entry.reach < lo; });
+    }
+
+    Event* next() {
+        if (!layer) return nullptr;
+        if (listed_end) {
+            while (listed != listed_end) {
+                uint32_t record = (listed++)->record;
+                const SnapshotRecord& r = layer->file->record(record);
+                if (r.start_time > hi) break;
+                if (r.end_time >= lo && !layer->isShadowed(record)) return layer->fault(record);
+            }
+            listed = listed_end;
+            return nullptr;
+        }
+        long record;
+        while ((record = cursor.next()) >= 0) {
+            if (!layer->isShadowed(static_cast<uint32_t>(record))) {
+                return layer->fault(static_cast<uint32_t>(record));
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Merges an in-memory cursor with the snapshot base into one stream in
+// (start_time, id) order.
+template <typename Primary>
+class LayeredCursor {
+private:
+    Primary primary;
+    SnapshotCursor base;
+    Event* primary_head;
+    Event* base_head;
+    bool primed;
+
+public:
+    LayeredCursor(const Primary& primary, const SnapshotCursor& base)
+        : primary(primary), base(base), primary_head(nullptr), base_head(nullptr), primed(false) {}
+
+    Event* next() {
+        if (!primed) {
+            primary_head = primary.next();
+            base_head = base.next();
+            primed = true;
+        }
+        Event* result;
+        if (base_head && (!primary_head || IntervalTree::keyLess(base_head, primary_head))) {
+            result = base_head;
+            base_head = base.next();
+        } else {
+            result = primary_head;
+            if (primary_head) primary_head = primary.next();
+        }
+        return result;
+    }
+};
+
+// ==================== Journal ====================
+// Append-only write-ahead log of Calendar mutations. The file starts with
+// an 8-byte magic followed by records of the form
+//   [u32 payload length][u32 CRC-32 of payload][payload]
+// where the payload's first byte is the operation. Additions carry the
+// whole event, deletions the id, and edits a mask of the changed fields
+// followed by their new values, so the CRC makes a whole edit apply or not
+// at all. Every record sets state rather than transforming it, so replaying
+// a journal over a snapshot that already contains some of its records is
+// harmless.
+static const char JOURNAL_MAGIC[8] = {'C', 'A', 'L', 'J', 'R', 'N', 'L', '1'};
+
+enum class JournalOp : uint8_t { ADD = 1, DELETE = 2, EDIT = 3 };
+
+enum class JournalField : uint8_t {
+    TITLE = 1, TIMES, COLOR, PRIORITY, DESCRIPTION, LOCATION, ATTENDEES, ALL_DAY, RECURRENCE
+};
+
+inline uint16_t fieldBit(JournalField field) { return static_cast<uint16_t>(1u << (static_cast<int>(field) - 1)); }
+
+uint32_t crc32(const char* data, size_t length) {
+    // Built once, on first use, by whichever thread gets there first;
+    // the others wait for it.
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> built{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            built[i] = c;
+        }
+        return built;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+class ByteWriter {
+public:
+    string bytes;
+
+    void u8(uint8_t value) { bytes.push_back(static_cast<char>(value)); }
+    void u16(uint16_t value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void i32(int32_t value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void i64(int64_t value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+    void str(const string& value) {
+        i32(static_cast<int32_t>(value.size()));
+        bytes += value;
+    }
+
+    template <typename Strings>
+    void strs(const Strings& values) {
+        i32(static_cast<int32_t>(values.size()));
+        for (const auto& value : values) str(value);
+    }
+};
+
+class ByteReader {
+private:
+    const char* current;
+    const char* end;
+
+    bool take(void* out, size_t size) {
+        if (static_cast<size_t>(end - current) < size) {
+            ok = false;
+            return false;
+        }
+        memcpy(out, current, size);
+        current += size;
+        return true;
+    }
+
+public:
+    bool ok;
+
+    ByteReader(const char* data, size_t size) : current(data), end(data + size), ok(true) {}
+
+    uint8_t u8() {
+        uint8_t value = 0;
+        take(&value, sizeof(value));
+        return value;
+    }
+
+    uint16_t u16() {
+        uint16_t value = 0;
+        take(&value, sizeof(value));
+        return value;
+    }
+
+    int32_t i32() {
+        int32_t value = 0;
+        take(&value, sizeof(value));
+        return value;
+    }
+
+    int64_t i64() {
+        int64_t value = 0;
+        take(&value, sizeof(value));
+        return value;
+    }
+
+    string str() {
+        int32_t size = i32();
+        if (!ok || size < 0 || static_cast<size_t>(end - current) < static_cast<size_t>(size)) {
+            ok = false;
+            return "";
+        }
+        string value(current, static_cast<size_t>(size));
+        current += size;
+        return value;
+    }
+
+    NameList names() {
+        NameList values;
+        int32_t count = i32();
+        for (int32_t i = 0; ok && i < count; ++i) values.emplace_back(str());
+        return values;
+    }
+};
+
+// One decoded journal record. For edits only the fields in the mask are
+// meaningful in event.
+struct JournalEntry {
+    JournalOp op;
+    int id;
+    uint16_t fields;  // fieldBit() of each edited field
+    Event event;
+
+    // Copies the edited fields onto the current version of the event.
+    void applyEdit(Event& target) const {
+        for (int f = static_cast<int>(JournalField::TITLE); f <= static_cast<int>(JournalField::RECURRENCE); ++f) {
+            if (fields & fieldBit(static_cast<JournalField>(f))) applyField(static_cast<JournalField>(f), target);
+        }
+    }
+
+    void applyField(JournalField field, Event& target) const {
+        switch (field) {
+            case JournalField::TITLE: target.title = event.title; break;
+            case JournalField::TIMES:
+                target.start_time = event.start_time;
+                target.end_time = event.end_time;
+                break;
+            case JournalField::COLOR: target.color = event.color; break;
+            case JournalField::PRIORITY: target.priority = event.priority; break;
+            case JournalField::DESCRIPTION: target.description = event.description; break;
+            case JournalField::LOCATION: target.location = event.location; break;
+            case JournalField::ATTENDEES: target.attendees = event.attendees; break;
+            case JournalField::ALL_DAY: target.is_all_day = event.is_all_day; break;
+            case JournalField::RECURRENCE:
+                target.is_recurring = event.is_recurring;
+                target.recurrence_pattern = event.recurrence_pattern;
+                break;
+        }
+    }
+};
+
+class Journal {
+public:
+    struct Options {
+        size_t group_commit;  // records buffered before they are written
+        size_t fsync_every;   // writes between fsyncs; 0 leaves syncing to the OS
+    };
+
+private:
+    string path;
+    FILE* file;
+    Options options;
+    string pending;
+    size_t pending_records;
+    size_t writes_since_sync;
+    uint64_t written;  // bytes in the file, header included
+    bool torn;         // a failed write could not be cut back off the file
+
+    static void encodeEvent(ByteWriter& out, const Event& event) {
+        out.str(event.title);
+        out.i64(event.start_time);
+        out.i64(event.end_time);
+        out.u8(static_cast<uint8_t>(event.color));
+        out.u8(static_cast<uint8_t>(event.priority));
+        out.str(event.description);
+        out.str(event.location);
+        out.strs(event.attendees);
+        out.u8(event.is_all_day);
+        out.u8(event.is_recurring);
+        out.str(event.recurrence_pattern);
+    }
+
+    static void decodeEvent(ByteReader& in, Event& event) {
+        event.title = in.str();
+        event.start_time = static_cast<time_t>(in.i64());
+        event.end_time = static_cast<time_t>(in.i64());
+        event.color = static_cast<Color>(in.u8());
+        event.priority = static_cast<Priority>(in.u8());
+        event.description = in.str();
+        event.location = in.str();
+        event.attendees = in.names();
+        event.is_all_day = in.u8() != 0;
+        event.is_recurring = in.u8() != 0;
+        event.recurrence_pattern = in.str();
+    }
+
+    // False if the record completed a group that could not be written; it
+    // stays buffered either way.
+    bool append(const ByteWriter& payload, string& error) {
+        uint32_t size = static_cast<uint32_t>(payload.bytes.size());
+        uint32_t checksum = crc32(payload.bytes.data(), payload.bytes.size());
+        pending.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        pending.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+        pending += payload.bytes;
+        return ++pending_records < options.group_commit || flush(error);
+    }
+
+    // Unbuffered, so a failed write leaves nothing behind in stdio to be
+    // written later: pending is the only buffer.
+    bool openForAppend(string& error) {
+        file = fopen(path.c_str(), "ab");
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        setvbuf(file, nullptr, _IONBF, 0);
+        return true;
+    }
+
+    static void encodeField(ByteWriter& out, JournalField field, const Event& event) {
+        switch (field) {
+            case JournalField::TITLE: out.str(event.title); break;
+            case JournalField::TIMES:
+                out.i64(event.start_time);
+                out.i64(event.end_time);
+                break;
+            case JournalField::COLOR: out.u8(static_cast<uint8_t>(event.color)); break;
+            case JournalField::PRIORITY: out.u8(static_cast<uint8_t>(event.priority)); break;
+            case JournalField::DESCRIPTION: out.str(event.description); break;
+            case JournalField::LOCATION: out.str(event.location); break;
+            case JournalField::ATTENDEES: out.strs(event.attendees); break;
+            case JournalField::ALL_DAY: out.u8(event.is_all_day); break;
+            case JournalField::RECURRENCE:
+                out.u8(event.is_recurring);
+                out.str(event.recurrence_pattern);
+                break;
+        }
+    }
+
+    static void decodeField(ByteReader& in, JournalField field, Event& event) {
+        switch (field) {
+            case JournalField::TITLE: event.title = in.str(); break;
+            case JournalField::TIMES:
+                event.start_time = static_cast<time_t>(in.i64());
+                event.end_time = static_cast<time_t>(in.i64());
+                break;
+            case JournalField::COLOR: event.color = static_cast<Color>(in.u8()); break;
+            case JournalField::PRIORITY: event.priority = static_cast<Priority>(in.u8()); break;
+            case JournalField::DESCRIPTION: event.description = in.str(); break;
+            case JournalField::LOCATION: event.location = in.str(); break;
+            case JournalField::ATTENDEES: event.attendees = in.names(); break;
+            case JournalField::ALL_DAY: event.is_all_day = in.u8() != 0; break;
+            case JournalField::RECURRENCE:
+                event.is_recurring = in.u8() != 0;
+                event.recurrence_pattern = in.str();
+                break;
+        }
+    }
+
+    static uint16_t changedFields(const Event& before, const Event& after) {
+        uint16_t fields = 0;
+        if (before.title != after.title) fields |= fieldBit(JournalField::TITLE);
+        if (before.start_time != after.start_time || before.end_time != after.end_time) {
+            fields |= fieldBit(JournalField::TIMES);
+        }
+        if (before.color != after.color) fields |= fieldBit(JournalField::COLOR);
+        if (before.priority != after.priority) fields |= fieldBit(JournalField::PRIORITY);
+        if (before.description != after.description) fields |= fieldBit(JournalField::DESCRIPTION);
+        if (before.location != after.location) fields |= fieldBit(JournalField::LOCATION);
+        if (before.attendees != after.attendees) fields |= fieldBit(JournalField::ATTENDEES);
+        if (before.is_all_day != after.is_all_day) fields |= fieldBit(JournalField::ALL_DAY);
+        if (before.is_recurring != after.is_recurring || before.recurrence_pattern != after.recurrence_pattern) {
+            fields |= fieldBit(JournalField::RECURRENCE);
+        }
+        return fields;
+    }
+
+    bool syncFile() {
+        writes_since_sync = 0;
+#ifndef _WIN32
+        return fsync(fileno(file)) == 0;
+#else
+        return true;
+#endif
+    }
+
+public:
+    Journal() : file(nullptr), options{1, 1}, pending_records(0), writes_since_sync(0), written(0), torn(false) {}
+    ~Journal() { close(); }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    void setOptions(const Options& value) { options = value; }
+    bool isOpen() const { return file != nullptr; }
+    uint64_t size() const { return written + pending.size(); }
+
+    // Reads every intact record in order, stopping at the first torn or
+    // corrupt one. valid_length receives the size of the intact prefix.
+    static bool read(const string& path, const function<void(const JournalEntry&)>& apply,
+                     uint64_t& valid_length, string& error) {
+        valid_length = 0;
+        ifstream in(path, ios::binary);
+        if (!in) return true;  // no journal yet
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (data.empty()) return true;
+        if (data.size() < sizeof(JOURNAL_MAGIC) ||
+            memcmp(data.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+            error = "not a calendar journal";
+            return false;
+        }
+        size_t offset = sizeof(JOURNAL_MAGIC);
+        while (data.size() - offset >= 2 * sizeof(uint32_t)) {
+            uint32_t size, checksum;
+            memcpy(&size, data.data() + offset, sizeof(size));
+            memcpy(&checksum, data.data() + offset + sizeof(size), sizeof(checksum));
+            size_t body = offset + 2 * sizeof(uint32_t);
+            if (data.size() - body < size || crc32(data.data() + body, size) != checksum) break;
+
+            ByteReader reader(data.data() + body, size);
+            JournalOp op = static_cast<JournalOp>(reader.u8());
+            int id = reader.i32();
+            JournalEntry entry{op, id, 0, Event::withId(id)};
+            if (entry.op == JournalOp::ADD) {
+                decodeEvent(reader, entry.event);
+            } else if (entry.op == JournalOp::EDIT) {
+                entry.fields = reader.u16();
+                if (entry.fields >> static_cast<int>(JournalField::RECURRENCE)) reader.ok = false;
+                for (int f = static_cast<int>(JournalField::TITLE); f <= static_cast<int>(JournalField::RECURRENCE); ++f) {
+                    JournalField field = static_cast<JournalField>(f);
+                    if (entry.fields & fieldBit(field)) decodeField(reader, field, entry.event);
+                }
+            } else if (entry.op != JournalOp::DELETE) {
+                reader.ok = false;
+            }
+            if (!reader.ok) break;
+            apply(entry);
+            offset = body + size;
+        }
+        valid_length = offset;
+        return true;
+    }
+
+    // Opens the journal for appending. A torn tail beyond valid_length
+    // (as reported by read) is cut off first.
+    bool open(const string& journal_path, uint64_t valid_length, string& error) {
+        close();
+        path = journal_path;
+        ifstream in(path, ios::binary);
+        string data;
+        if (in) data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        in.close();
+        if (data.size() != valid_length || valid_length < sizeof(JOURNAL_MAGIC)) {
+            // Rewrite the intact prefix (or a fresh header) and swap it in.
+            string intact = valid_length >= sizeof(JOURNAL_MAGIC)
+                ? data.substr(0, static_cast<size_t>(valid_length))
+                : string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+            if (!replaceFile(intact, error)) return false;
+        }
+        if (!openForAppend(error)) return false;
+        written = max<uint64_t>(valid_length, sizeof(JOURNAL_MAGIC));
+        torn = false;
+        return true;
+    }
+
+    // Atomically replaces the journal file's contents.
+    bool replaceFile(const string& contents, string& error) {
+        string temp_path = path + ".tmp";
+        FILE* out = fopen(temp_path.c_str(), "wb");
+        if (!out) {
+            error = "cannot create " + temp_path;
+            return false;
+        }
+        bool ok = fwrite(contents.data(), 1, contents.size(), out) == contents.size() && fflush(out) == 0;
+#ifndef _WIN32
+        ok = ok && fsync(fileno(out)) == 0;
+#endif
+        ok = (fclose(out) == 0) && ok;
+#ifdef _WIN32
+        if (ok) remove(path.c_str());
+#endif
+        if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+            remove(temp_path.c_str());
+            error = "cannot rewrite " + path;
+            return false;
+        }
+        return true;
+    }
+
+    // Drops the first `covered` bytes of records, which a new snapshot now
+    // contains, keeping anything appended after them. A snapshot covering
+    // records that could not be written also clears that failure.
+    bool dropPrefix(uint64_t covered, string& error) {
+        bool everything = covered == size();
+        if (!flush(error) && !everything) return false;
+        pending.clear();
+        pending_records = 0;
+        ifstream in(path, ios::binary);
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+        if (everything) covered = data.size();
+        else if (covered < sizeof(JOURNAL_MAGIC) || covered > data.size()) covered = sizeof(JOURNAL_MAGIC);
+        string kept = string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) + data.substr(static_cast<size_t>(covered));
+        fclose(file);
+        file = nullptr;
+        bool ok = replaceFile(kept, error);
+        if (!openForAppend(error)) return false;
+        written = ok ? kept.size() : data.size();
+        if (ok) torn = false;
+        return ok;
+    }
+
+    // Group commit: writes everything buffered with one call and fsyncs
+    // once every options.fsync_every writes. A failed or short write is cut
+    // back off the file, so no torn record is left for later ones to follow,
+    // and the records stay buffered for the next try.
+    bool flush(string& error) {
+        if (!file || pending.empty()) return true;
+        if (torn) {
+            error = path + " ends in a torn record";
+            return false;
+        }
+        errno = 0;
+        if (fwrite(pending.data(), 1, pending.size(), file) != pending.size()) {
+            error = "cannot write " + path + (errno ? string(": ") + strerror(errno) : string());
+            clearerr(file);
+#ifndef _WIN32
+            torn = ftruncate(fileno(file), static_cast<off_t>(written)) != 0;
+#else
+            torn = true;
+#endif
+            return false;
+        }
+        written += pending.size();
+        pending.clear();
+        pending_records = 0;
+        if (options.fsync_every > 0 && ++writes_since_sync >= options.fsync_every && !syncFile()) {
+            error = "cannot sync " + path;
+            return false;
+        }
+        return true;
+    }
+
+    // Takes back every record appended after mark, an earlier size(),
+    // cutting the file back if some of them were already written. If the
+    // file cannot be cut the journal is left torn, so that nothing is
+    // appended after the records it still holds.
+    bool discardFrom(uint64_t mark, string& error) {
+        if (mark >= written) {
+            pending.resize(static_cast<size_t>(min<uint64_t>(mark - written, pending.size())));
+            pending_records = 0;
+            for (size_t at = 0; at < pending.size(); ++pending_records) {
+                uint32_t size;
+                memcpy(&size, pending.data() + at, sizeof(size));
+                at += 2 * sizeof(uint32_t) + size;
+            }
+            return true;
+        }
+        pending.clear();
+        pending_records = 0;
+        if (!file) return true;
+#ifndef _WIN32
+        torn = ftruncate(fileno(file), static_cast<off_t>(mark)) != 0;
+#else
+        torn = true;
+#endif
+        if (torn) {
+            error = "cannot cut back " + path;
+            return false;
+        }
+        written = mark;
+        return true;
+    }
+
+    // Flushes and forces everything to disk regardless of the batching.
+    bool sync(string& error) {
+        if (!flush(error)) return false;
+        if (file && writes_since_sync > 0 && !syncFile()) {
+            error = "cannot sync " + path;
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (!file) return;
+        string error;
+        sync(error);
+        fclose(file);
+        file = nullptr;
+    }
+
+    // Each log call returns false, with error set, if the journal could not
+    // take the record; the caller should not report the change as saved.
+    bool logAdd(const Event& event, string& error) {
+        ByteWriter out;
+        out.u8(static_cast<uint8_t>(JournalOp::ADD));
+        out.i32(event.id);
+        encodeEvent(out, event);
+        return append(out, error);
+    }
+
+    bool logDelete(int id, string& error) {
+        ByteWriter out;
+        out.u8(static_cast<uint8_t>(JournalOp::DELETE));
+        out.i32(id);
+        return append(out, error);
+    }
+
+    // One record for the whole edit: the mask of fields that differ between
+    // the two versions, then each of them in JournalField order.
+    bool logEdit(const Event& before, const Event& after, string& error) {
+        uint16_t fields = changedFields(before, after);
+        if (fields == 0) return true;
+        ByteWriter out;
+        out.u8(static_cast<uint8_t>(JournalOp::EDIT));
+        out.i32(after.id);
+        out.u16(fields);
+        for (int f = static_cast<int>(JournalField::TITLE); f <= static_cast<int>(JournalField::RECURRENCE); ++f) {
+            JournalField field = static_cast<JournalField>(f);
+            if (fields & fieldBit(field)) encodeField(out, field, after);
+        }
+        return append(out, error);
+    }
+};
+
+// ==================== Query Views ====================
+// Lazy ranges over the events stored in a Calendar. They hand out
+// references to the stored events and never copy them, so display code can
+// stream results straight from the indexes. A view is only valid until the
+// calendar is next modified.
+struct ViewEnd {};
+
+template <typename View, typename Predicate> class FilterView;
+
+// Adds .where(predicate) chaining to a view.
+template <typename View>
+class Filterable {
+public:
+    template <typename Predicate>
+    FilterView<View, Predicate> where(Predicate predicate) const {
+        return FilterView<View, Predicate>(static_cast<const View&>(*this), predicate);
+    }
+
+    bool empty() const {
+        const View& view = static_cast<const View&>(*this);
+        return !(view.begin() != view.end());
+    }
+};
+
+typedef LayeredCursor<IntervalTree::Cursor> RangeCursor;
+
+// Stored events from the interval index and snapshot base, in start order.
+class IntervalView : public Filterable<IntervalView> {
+private:
+    RangeCursor cursor;
+
+public:
+    class iterator {
+    private:
+        RangeCursor cursor;
+        const Event* current;
+
+    public:
+        explicit iterator(const RangeCursor& cursor) : cursor(cursor), current(nullptr) {
+            current = this->cursor.next();
+        }
+        const Event& operator*() const { return *current; }
+        const Event* operator->() const { return current; }
+        iterator& operator++() {
+            current = cursor.next();
+            return *this;
+        }
+        bool operator!=(ViewEnd) const { return current != nullptr; }
+    };
+
+    explicit IntervalView(const RangeCursor& cursor) : cursor(cursor) {}
+    iterator begin() const { return iterator(cursor); }
+    ViewEnd end() const { return ViewEnd(); }
+};
+
+// Live events of one day bucket, in start order.
+class DayCursor {
+private:
+    Event* const* current;
+    Event* const* last;
+
+public:
+    DayCursor(Event* const* first, Event* const* last) : current(first), last(last) {}
+
+    Event* next() {
+        while (current != last) {
+            Event* event = *current++;
+            if (!event->isDeleted()) return event;
+        }
+        return nullptr;
+    }
+};
+
+// Merges the one-off events from a cursor over an index with the
+// occurrences of every recurring series reaching [lo, hi], yielding
+// Occurrences in start order. The series are combined through a small
+// heap, which is only allocated when recurring events exist, and then from
+// the scratch arena.
+template <typename Source>
+class MergedView : public Filterable<MergedView<Source>> {
+private:
+    Source source;
+    const vector<RecurringSeries>* series;
+    time_t lo;
+    time_t hi;
+    bool day_touch;
+
+public:
+    class iterator {
+    private:
+        Source source;
+        const Event* next_one_off;
+        pmr::vector<OccurrenceCursor> heads;  // min-heap on each cursor's pending occurrence
+        Occurrence current;
+        bool valid;
+
+        static bool later(const OccurrenceCursor& a, const OccurrenceCursor& b) {
+            const Occurrence& x = a.peek();
+            const Occurrence& y = b.peek();
+            return x.start_time > y.start_time ||
+                   (x.start_time == y.start_time && x.event->id > y.event->id);
+        }
+
+        void advance() {
+            bool from_series = !heads.empty() &&
+                (!next_one_off || heads.front().peek().start_time < next_one_off->start_time);
+            if (from_series) {
+                pop_heap(heads.begin(), heads.end(), later);
+                current = heads.back().peek();
+                if (heads.back().advance()) {
+                    push_heap(heads.begin(), heads.end(), later);
+                } else {
+                    heads.pop_back();
+                }
+                valid = true;
+            } else if (next_one_off) {
+                current = Occurrence{next_one_off, next_one_off->start_time, next_one_off->end_time};
+                next_one_off = source.next();
+                valid = true;
+            } else {
+                valid = false;
+            }
+        }
+
+    public:
+        iterator(const Source& source, const vector<RecurringSeries>* series,
+                 time_t lo, time_t hi, bool day_touch)
+            : source(source), next_one_off(nullptr), heads(ScratchArena::resource()), current{nullptr, 0, 0},
+              valid(false) {
+            next_one_off = this->source.next();
+            for (const RecurringSeries& s : *series) {
+                if (s.event->isDeleted()) continue;
+                OccurrenceCursor cursor(s.event, &s.rule, lo, hi, day_touch);
+                if (cursor.valid()) heads.push_back(cursor);
+            }
+            make_heap(heads.begin(), heads.end(), later);
+            advance();
+        }
+        // Copies keep drawing from the same arena rather than the heap.
+        iterator(const iterator& other)
+            : source(other.source), next_one_off(other.next_one_off),
+              heads(other.heads, other.heads.get_allocator()), current(other.current), valid(other.valid) {}
+
+        const Occurrence& operator*() const { return current; }
+        const Occurrence* operator->() const { return &current; }
+        iterator& operator++() {
+            advance();
+            return *this;
+        }
+        bool operator!=(ViewEnd) const { return valid; }
+    };
+
+    MergedView(const Source& source, const vector<RecurringSeries>* series,
+               time_t lo, time_t hi, bool day_touch)
+        : source(source), series(series), lo(lo), hi(hi), day_touch(day_touch) {}
+    iterator begin() const { return iterator(source, series, lo, hi, day_touch); }
+    ViewEnd end() const { return ViewEnd(); }
+};
+
+typedef MergedView<RangeCursor> RangeView;
+typedef MergedView<LayeredCursor<DayCursor>> DayView;
+
+// Any view narrowed by a predicate, evaluated lazily while iterating.
+template <typename View, typename Predicate>
+class FilterView : public Filterable<FilterView<View, Predicate>> {
+private:
+    View view;
+    Predicate predicate;
+
+public:
+    class iterator {
+    private:
+        typename View::iterator current;
+        const Predicate* predicate;
+
+        void skipRejected() {
+            while (current != ViewEnd() && !(*predicate)(*current)) ++current;
+        }
+
+    public:
+        iterator(const typename View::iterator& current, const Predicate* predicate)
+            : current(current), predicate(predicate) {
+            skipRejected();
+        }
+        auto operator*() const -> decltype(*current) { return *current; }
+        auto operator->() const -> decltype(current.operator->()) { return current.operator->(); }
+        iterator& operator++() {
+            ++current;
+            skipRejected();
+            return *this;
+        }
+        bool operator!=(ViewEnd) const { return current != ViewEnd(); }
+    };
+
+    FilterView(const View& view, Predicate predicate) : view(view), predicate(predicate) {}
+    iterator begin() const { return iterator(view.begin(), &predicate); }
+    ViewEnd end() const { return ViewEnd(); }
+};
+
+// Lazy k-way merge of one view per calendar, yielding Occurrences in start
+// order (ties broken by event id). Only each view's next occurrence is
+// held, in a small heap keyed on it, so overlaying dozens of calendars
+// never concatenates or re-sorts their events.
+template <typename View>
+class OverlayView : public Filterable<OverlayView<View>> {
+private:
+    pmr::vector<View> views;
+
+public:
+    class iterator {
+    private:
+        // A view's next occurrence, keyed so the heap never has to touch
+        // the (much larger) view iterators.
+        struct Head {
+            time_t start;
+            int id;
+            uint32_t view;
+        };
+        static bool later(const Head& a, const Head& b) {
+            return a.start > b.start || (a.start == b.start && a.id > b.id);
+        }
+
+        pmr::vector<typename View::iterator> heads;
+        pmr::vector<Head> pending;  // min-heap of the views not yet exhausted
+        Occurrence current;
+        bool valid;
+
+        Head headOf(uint32_t view) const {
+            const Occurrence& next = *heads[view];
+            return Head{next.start_time, next.event->id, view};
+        }
+
+        // Takes the top view's occurrence and moves that view's next one
+        // down into place: one sift instead of a pop and a push.
+        void advance() {
+            valid = !pending.empty();
+            if (!valid) return;
+            uint32_t from = pending.front().view;
+            current = *heads[from];
+            Head moving = pending.back();
+            if (++heads[from] != ViewEnd()) {
+                moving = headOf(from);
+            } else {
+                pending.pop_back();
+                if (pending.empty()) return;
+            }
+            size_t i = 0, n = pending.size();
+            while (2 * i + 1 < n) {
+                size_t child = 2 * i + 1;
+                if (child + 1 < n && later(pending[child], pending[child + 1])) ++child;
+                if (!later(moving, pending[child])) break;
+                pending[i] = pending[child];
+                i = child;
+            }
+            pending[i] = moving;
+        }
+
+    public:
+        explicit iterator(const pmr::vector<View>& views)
+            : heads(ScratchArena::resource()), pending(ScratchArena::resource()), current{nullptr, 0, 0},
+              valid(false) {
+            heads.reserve(views.size());
+            pending.reserve(views.size());
+            for (const View& view : views) {
+                heads.push_back(view.begin());
+                if (heads.back() != ViewEnd()) pending.push_back(headOf(static_cast<uint32_t>(heads.size() - 1)));
+            }
+            make_heap(pending.begin(), pending.end(), later);
+            advance();
+        }
+        iterator(const iterator& other)
+            : heads(other.heads, other.heads.get_allocator()), pending(other.pending, other.pending.get_allocator()),
+              current(other.current), valid(other.valid) {}
+
+        const Occurrence& operator*() const { return current; }
+        const Occurrence* operator->() const { return &current; }
+        iterator& operator++() {
+            advance();
+            return *this;
+        }
+        bool operator!=(ViewEnd) const { return valid; }
+    };
+
+    explicit OverlayView(pmr::vector<View> views) : views(move(views)) {}
+    OverlayView(const OverlayView& other) : views(other.views, other.views.get_allocator()) {}
+    iterator begin() const { return iterator(views); }
+    ViewEnd end() const { return ViewEnd(); }
+};
+
+// ==================== Week Grid ====================
+// Layout of the week view: rows are time slots between first_hour and
+// last_hour, columns are days, and each day is split into lanes so that
+// overlapping events sit side by side.
+struct WeekGridOptions {
+    int slot_minutes;  // 15, 30 or 60
+    int first_hour;    // first row starts here
+    int last_hour;     // rows stop here, exclusive (up to 24)
+
+    WeekGridOptions() : slot_minutes(60), first_hour(8), last_hour(21) {}
+
+    int slotsPerDay() const { return (last_hour - first_hour) * 60 / slot_minutes; }
+};
+
+// Slot matrix for one week, filled by a single sweep over the week's
+// occurrences in start order. Each occurrence is mapped to its slot range
+// by binary search and given the first lane free at its start (greedy
+// interval partitioning, which never uses more lanes than the deepest
+// overlap). Building and rendering cost depends only on the events of that
+// week, and all of the grid lives in the scratch arena.
+class WeekGrid {
+public:
+    static const int DAYS = 7;
+
+private:
+    WeekGridOptions options;
+    long first_day;
+    int slots;
+    // All indexed by day first.
+    pmr::vector<pmr::vector<time_t>> bounds;                    // slot boundaries, slots + 1 per day
+    pmr::vector<pmr::vector<pmr::vector<const Event*>>> lanes;  // lane -> slot -> event
+    pmr::vector<pmr::vector<int>> lane_free;                    // slot where each lane frees up
+    pmr::vector<pmr::vector<int>> run_lanes;  // per slot: lanes used by its run of busy slots
+    pmr::vector<pmr::vector<const Event*>> all_day;
+
+    // Slots [first, last) covered by [start, end) on a day; false when the
+    // event misses the visible hours.
+    bool slotRange(int day, time_t start, time_t end, int& first, int& last) const {
+        const pmr::vector<time_t>& b = bounds[day];
+        if (end <= start) end = start + 1;
+        if (end <= b.front() || start >= b.back()) return false;
+        first = max(0, static_cast<int>(upper_bound(b.begin(), b.end(), start) - b.begin()) - 1);
+        last = min(slots, static_cast<int>(lower_bound(b.begin(), b.end(), end) - b.begin()));
+        return first < last;
+    }
+
+    void place(int day, const Event* event, int first, int last) {
+        pmr::vector<int>& free = lane_free[day];
+        size_t lane = 0;
+        while (lane < free.size() && free[lane] > first) ++lane;
+        if (lane == free.size()) {
+            free.push_back(0);
+            lanes[day].emplace_back(slots, nullptr);
+        }
+        free[lane] = last;
+        fill(lanes[day][lane].begin() + first, lanes[day][lane].begin() + last, event);
+    }
+
+public:
+    template <typename Occurrences>
+    WeekGrid(long first_day, const WeekGridOptions& options, const Occurrences& occurrences)
+        : options(options), first_day(first_day), slots(options.slotsPerDay()),
+          bounds(DAYS, ScratchArena::resource()), lanes(DAYS, ScratchArena::resource()),
+          lane_free(DAYS, ScratchArena::resource()), run_lanes(DAYS, ScratchArena::resource()),
+          all_day(DAYS, ScratchArena::resource()) {
+        for (int day = 0; day < DAYS; ++day) {
+            int year, month, mday;
+            civilFromDays(first_day + day, year, month, mday);
+            bounds[day].resize(slots + 1);
+            for (int slot = 0; slot <= slots; ++slot) {
+                bounds[day][slot] = localTimeFromCivil(year, month, mday, options.first_hour,
+                                                       slot * options.slot_minutes);
+            }
+            // Slots skipped by a forward DST change collapse onto the change.
+            for (int slot = slots - 1; slot >= 0; --slot) {
+                bounds[day][slot] = min(bounds[day][slot], bounds[day][slot + 1]);
+            }
+        }
+
+        for (const Occurrence& o : occurrences) {
+            long from = max(first_day, localDayNumber(o.start_time));
+            long to = min(first_day + DAYS - 1, localDayNumber(max(o.start_time, o.end_time - 1)));
+            for (long d = from; d <= to; ++d) {
+                int day = static_cast<int>(d - first_day);
+                if (o.event->is_all_day) {
+                    all_day[day].push_back(o.event);
+                    continue;
+                }
+                int first, last;
+                if (slotRange(day, o.start_time, o.end_time, first, last)) place(day, o.event, first, last);
+            }
+        }
+
+        // Lanes restart from the first one after every gap, so each run of
+        // busy slots only needs as many columns as it actually uses.
+        for (int day = 0; day < DAYS; ++day) {
+            run_lanes[day].assign(slots, 0);
+            int run_start = 0, used = 0;
+            for (int slot = 0; slot <= slots; ++slot) {
+                int busy = 0;
+                for (int lane = 0; slot < slots && lane < laneCount(day); ++lane) {
+                    if (lanes[day][lane][slot]) busy = lane + 1;
+                }
+                if (busy > 0) {
+                    used = max(used, busy);
+                    continue;
+                }
+                fill(run_lanes[day].begin() + run_start, run_lanes[day].begin() + slot, used);
+                run_start = slot + 1;
+                used = 0;
+            }
+        }
+    }
+
+    int slotCount() const { return slots; }
+    int laneCount(int day) const { return static_cast<int>(lanes[day].size()); }
+    int lanesAt(int day, int slot) const { return run_lanes[day][slot]; }
+    time_t dayStart(int day) const { return localDayStart(first_day + day); }
+    const pmr::vector<const Event*>& allDay(int day) const { return all_day[day]; }
+
+    const Event* at(int day, int lane, int slot) const { return lanes[day][lane][slot]; }
+
+    // Minutes after midnight at which a row starts, for its label.
+    int slotMinutes(int slot) const { return options.first_hour * 60 + slot * options.slot_minutes; }
+};
+
+// ==================== Day Load ====================
+// How full each day of a span is: the number of occurrences touching it
+// and the minutes covered by at least one timed event (overlaps are not
+// double counted; all-day events count as events but not as busy time).
+struct DayLoad {
+    int events;
+    int busy_minutes;
+
+    DayLoad() : events(0), busy_minutes(0) {}
+
+    // Heat level 0-4 on fixed thresholds, so month and year views agree.
+    int level() const {
+        if (events == 0) return 0;
+        if (busy_minutes < 120) return 1;
+        if (busy_minutes < 240) return 2;
+        if (busy_minutes < 360) return 3;
+        return 4;
+    }
+
+    static const char* glyph(int level) {
+        static const char* const GLYPHS[] = {" ", ".", ":", "*", "#"};
+        return GLYPHS[level];
+    }
+
+    static const string& color(int level) {
+        static const string* const COLORS[] = {
+            &TermColor::WHITE, &TermColor::CYAN, &TermColor::GREEN, &TermColor::YELLOW, &TermColor::RED
+        };
+        return *COLORS[level];
+    }
+};
+
+// Per-day loads of [first_day, last_day], gathered in one sweep over the
+// span's occurrences. Occurrences arrive in start order, so the busy time
+// of each day is a running union: only the part past the day's furthest
+// end so far is new.
+class DayLoadMap {
+private:
+    long first_day;
+    pmr::vector<DayLoad> loads;  // in the scratch arena, like the temporaries below
+    pmr::vector<time_t> bounds;  // day starts, one more than days
+
+public:
+    template <typename Occurrences>
+    DayLoadMap(long first_day, long last_day, const Occurrences& occurrences)
+        : first_day(first_day), loads(last_day - first_day + 1, ScratchArena::resource()),
+          bounds(last_day - first_day + 2, ScratchArena::resource()) {
+        for (size_t i = 0; i < bounds.size(); ++i) bounds[i] = localDayStart(first_day + static_cast<long>(i));
+        pmr::vector<time_t> busy_until(bounds.begin(), bounds.end() - 1, ScratchArena::resource());
+        pmr::vector<long long> busy_seconds(loads.size(), 0, ScratchArena::resource());
+
+        for (const Occurrence& o : occurrences) {
+            long from = max(first_day, localDayNumber(o.start_time));
+            long to = min(last_day, localDayNumber(max(o.start_time, o.end_time - 1)));
+            for (long d = from; d <= to; ++d) {
+                size_t day = static_cast<size_t>(d - first_day);
+                ++loads[day].events;
+                if (o.event->is_all_day) continue;
+                time_t start = max(o.start_time, busy_until[day]);
+                time_t end = min(o.end_time, bounds[day + 1]);
+                if (end <= start) continue;
+                busy_seconds[day] += end - start;
+                busy_until[day] = end;
+            }
+        }
+        for (size_t day = 0; day < loads.size(); ++day) {
+            loads[day].busy_minutes = static_cast<int>(busy_seconds[day] / 60);
+        }
+    }
+
+    long firstDay() const { return first_day; }
+    long lastDay() const { return first_day + static_cast<long>(loads.size()) - 1; }
+    const DayLoad& at(long day) const { return loads[static_cast<size_t>(day - first_day)]; }
+    time_t dayStart(long day) const { return bounds[static_cast<size_t>(day - first_day)]; }
+};
+
+// ==================== Calendar Class ====================
+// A half-open span of time: busy blocks, free slots.
+struct TimeBlock {
+    time_t start;
+    time_t end;  // exclusive
+};
+
+// What findMeetingSlots() looks for. Working hours are local times of day
+// and apply to every day searched. Events below `blocking` priority may be
+// overridden, and all-day events never block, as in free/busy.
+struct MeetingSearch {
+    time_t duration;         // seconds, more than 0
+    int work_start_minutes;  // minutes after local midnight
+    int work_end_minutes;    // up to 24 * 60, after work_start_minutes
+    bool weekdays_only;
+    Priority blocking;
+    size_t max_slots;
+
+    MeetingSearch()
+        : duration(30 * 60), work_start_minutes(9 * 60), work_end_minutes(17 * 60),
+          weekdays_only(true), blocking(Priority::MEDIUM), max_slots(5) {}
+
+    // Parses "HH:MM-HH:MM" (24:00 allowed as an end); false leaves the
+    // hours unchanged.
+    bool setWorkingHours(const string& text) {
+        int start_hour, start_minute, end_hour, end_minute;
+        char tail;
+        if (sscanf(text.c_str(), "%d:%d-%d:%d%c", &start_hour, &start_minute, &end_hour, &end_minute, &tail) != 4) {
+            return false;
+        }
+        int start = start_hour * 60 + start_minute;
+        int end = end_hour * 60 + end_minute;
+        if (start_hour < 0 || start_minute < 0 || start_minute > 59 || end_minute < 0 || end_minute > 59 ||
+            start >= end || end > 24 * 60) {
+            return false;
+        }
+        work_start_minutes = start;
+        work_end_minutes = end;
+        return true;
+    }
+};
+
+// One occurrence as reports read it: fields in place in an Event or a
+// snapshot record, so scanning neither faults records in nor interns.
+struct OccurrenceFacts {
+    time_t start_time;
+    time_t end_time;
+    bool all_day;
+    Priority priority;
+    Color color;
+    string_view location;
+    const NameList* attendees;   // in-memory events
+    const MappedSnapshot* file;  // snapshot records keep their attendee list there
+    uint32_t attendee_list;
+
+    template <typename Visit>
+    void forEachAttendee(Visit visit) const {
+        if (attendees) {
+            for (const InternedString& name : *attendees) visit(string_view(name.str()));
+        } else if (file) {
+            file->forEachListItem(attendee_list, visit);
+        }
+    }
+};
+
+// Const members may run on several threads at once as long as nothing
+// modifies the calendar meanwhile: what they build or fault in on first
+// use is built under lazy_lock and SnapshotLayer's fault_lock.
+class Calendar {
+private:
+    // Owns the events in insertion order; time_index provides the
+    // chronological order, so nothing is ever re-sorted on insert.
+    // Events live behind unique_ptr, so an Event* stays valid while other
+    // events are added or the slots are compacted; only deleting that
+    // event (followed by a compaction) invalidates it.
+    vector<unique_ptr<Event>> events;
+    pmr::unsynchronized_pool_resource index_memory;  // nodes and buckets of the two maps below
+    pmr::unordered_map<int, size_t> id_index;        // id -> slot in events
+    IntervalTree time_index;
+    pmr::unordered_map<long, pmr::vector<Event*>> day_index;  // local day number -> events touching it
+    vector<RecurringSeries> recurring;    // expanded lazily, never placed in the indexes above
+    size_t tombstones;                    // deleted events not yet compacted away
+    unique_ptr<SnapshotLayer> base;       // mapped snapshot underneath the events above
+    Journal* journal;                     // receives every mutation when attached
+    string journal_error;                 // first mutation the journal failed to record
+    // What undoChanges() needs to put back: one entry per mutation since
+    // recordChanges(), holding the event as it was before, if it existed.
+    struct Change {
+        int id;
+        bool existed;
+        Event before;
+    };
+    vector<Change> changes;
+    bool recording_changes;
+    mutable EventColumns columns;         // hot fields of the one-offs, built on first scan
+    mutable TextIndex text;               // words of every event, built on first search
+    mutable AttendeeIndex schedules;      // per-person events, built on the first attendee query
+    mutable mutex lazy_lock;              // builds the three above for concurrent readers
+    string name;
+    string owner;
+
+    // Called before each mutation takes effect; before is nullptr for a new id.
+    void noteChange(int id, const Event* before) {
+        if (recording_changes) changes.push_back(Change{id, before != nullptr, before ? *before : Event::withId(id)});
+    }
+
+    SnapshotCursor baseCursor(time_t lo, time_t hi, bool day_touch) const {
+        return base ? SnapshotCursor(base.get(), lo, hi, day_touch) : SnapshotCursor();
+    }
+
+    // Moves a faulted snapshot event into the in-memory layer, which from
+    // then on indexes it. Returns false for events that are not in the base.
+    bool adoptFromBase(const Event* event) {
+        if (!base) return false;
+        unique_ptr<Event> owned = base->promote(event);
+        if (!owned) return false;
+        storeEvent(move(owned));
+        return true;
+    }
+
+    // Appends the parts of the free window [from, to) that fall within
+    // working hours and fit the meeting, up to options.max_slots.
+    static void addWorkingSlots(time_t from, time_t to, const MeetingSearch& options,
+                                pmr::vector<TimeBlock>& slots) {
+        for (long day = localDayNumber(from); day <= localDayNumber(to - 1); ++day) {
+            if (slots.size() >= options.max_slots) return;
+            int weekday = weekdayFromDays(day);
+            if (options.weekdays_only && (weekday == 0 || weekday == 6)) continue;
+            int year, month, date;
+            civilFromDays(day, year, month, date);
+            time_t work_start = localTimeFromCivil(year, month, date, options.work_start_minutes / 60,
+                                                   options.work_start_minutes % 60);
+            time_t work_end = options.work_end_minutes >= 24 * 60
+                ? localDayStart(day + 1)
+                : localTimeFromCivil(year, month, date, options.work_end_minutes / 60, options.work_end_minutes % 60);
+            time_t start = max(from, work_start);
+            time_t end = min(to, work_end);
+            if (end - start >= options.duration) slots.push_back(TimeBlock{start, end});
+        }
+    }
+
+    RangeView scheduleView(const AttendeeIndex::Schedule& schedule, time_t start, time_t end) const {
+        SnapshotCursor listed = base && !schedule.base_records.empty()
+            ? SnapshotCursor(base.get(), schedule.base_records, start, end)
+            : SnapshotCursor();
+        return RangeView(RangeCursor(schedule.one_offs.overlapping(start, end), listed),
+                         &schedule.series, start, end, false);
+    }
+
+    // Sweep over start-ordered occurrences: those still running sit in a
+    // min-heap on end time, and each new occurrence overlaps exactly the
+    // ones left after the finished are popped. O(n log n + pairs).
+    template <typename Occurrences, typename Visit>
+    static void sweepOverlaps(const Occurrences& occurrences, Visit visit) {
+        pmr::vector<Occurrence> running(ScratchArena::resource());
+        auto ends_later = [](const Occurrence& a, const Occurrence& b) { return a.end_time > b.end_time; };
+        for (const Occurrence& o : occurrences) {
+            if (o.event->is_all_day || o.end_time <= o.start_time) continue;
+            while (!running.empty() && running.front().end_time <= o.start_time) {
+                pop_heap(running.begin(), running.end(), ends_later);
+                running.pop_back();
+            }
+            for (const Occurrence& other : running) {
+                if (other.event != o.event) visit(other, o);
+            }
+            running.push_back(o);
+            push_heap(running.begin(), running.end(), ends_later);
+        }
+    }
+
+    // Smallest folded attendee id the two events share, or 0.
+    static uint32_t firstSharedAttendee(const Event& a, const Event& b) {
+        uint32_t first = 0;
+        for (const InternedString& x : a.attendees) {
+            uint32_t person = x.folded();
+            if (person == 0 || (first != 0 && person >= first)) continue;
+            for (const InternedString& y : b.attendees) {
+                if (y.folded() == person) {
+                    first = person;
+                    break;
+                }
+            }
+        }
+        return first;
+    }
+
+    // An event ending exactly at midnight does not touch the following day.
+    static long lastDayOf(const Event* event) {
+        return localDayNumber(max(event->start_time, event->end_time - 1));
+    }
+
+    // Files the event under every day it covers, keeping each bucket in
+    // (start_time, id) order.
+    void indexDays(Event* event) {
+        long last = lastDayOf(event);
+        for (long day = localDayNumber(event->start_time); day <= last; ++day) {
+            pmr::vector<Event*>& bucket = day_index[day];
+            bucket.insert(upper_bound(bucket.begin(), bucket.end(), event,
+                [](const Event* a, const Event* b) { return IntervalTree::keyLess(a, b); }), event);
+        }
+    }
+
+    void unindexDays(const Event* event) {
+        long last = lastDayOf(event);
+        for (long day = localDayNumber(event->start_time); day <= last; ++day) {
+            auto it = day_index.find(day);
+            if (it == day_index.end()) continue;
+            pmr::vector<Event*>& bucket = it->second;
+            bucket.erase(remove(bucket.begin(), bucket.end(), event), bucket.end());
+            if (bucket.empty()) day_index.erase(it);
+        }
+    }
+
+    // Recurring events are kept aside as series; everything else goes into
+    // the time and day indexes.
+    bool indexSeries(Event* event) {
+        if (!event->is_recurring) return false;
+        RecurrenceRule rule = RecurrenceRule::parse(event->recurrence_pattern);
+        if (!rule.valid()) return false;
+        recurring.push_back(RecurringSeries{event, rule});
+        return true;
+    }
+
+    void indexEvent(Event* event) {
+        text.put(*event);
+        schedules.put(event);
+        if (indexSeries(event)) return;
+        time_index.insert(event);
+        indexDays(event);
+        columns.put(*event);
+    }
+
+    void unindexEvent(Event* event) {
+        columns.remove(event->id);
+        text.remove(*event);
+        schedules.remove(event);
+        auto it = find_if(recurring.begin(), recurring.end(),
+            [event](const RecurringSeries& series) { return series.event == event; });
+        if (it != recurring.end()) {
+            recurring.erase(it);
+            return;
+        }
+        time_index.erase(event);
+        unindexDays(event);
+    }
+
+    void storeEvent(unique_ptr<Event> event) {
+        id_index[event->id] = events.size();
+        events.push_back(move(event));
+    }
+
+public:
+    Calendar(const string& name = "My Calendar", const string& owner = "User")
+        : id_index(&index_memory), day_index(&index_memory), tombstones(0), journal(nullptr),
+          recording_changes(false), name(name), owner(owner) {}
+
+    size_t size() const { return id_index.size() + (base ? base->liveCount() : 0); }
+    const string& getName() const { return name; }
+
+    void clear() {
+        events.clear();
+        id_index.clear();
+        time_index.clear();
+        day_index.clear();
+        recurring.clear();
+        tombstones = 0;
+        base.reset();
+        columns.reset();
+        text.reset();
+        schedules.reset();
+    }
+
+    // Takes the event by value, so callers done with theirs can move it in.
+    void addEvent(Event event) {
+        if (findEvent(event.id)) {
+            updateEvent(event);
+            return;
+        }
+        storeEvent(unique_ptr<Event>(new Event(move(event))));
+        noteChange(events.back()->id, nullptr);
+        indexEvent(events.back().get());
+        if (journal) journal->logAdd(*events.back(), journal_error);
+    }
+
+    // Bulk load: appends the whole batch, then either inserts it one by one
+    // (small batches) or sorts it once and merges it with the existing order
+    // to rebuild the index in a single O(n + m log m) pass.
+    template <typename Iterator>
+    void addEvents(Iterator first, Iterator last) {
+        compactIfNeeded();
+        size_t old_size = events.size();
+        for (; first != last; ++first) {
+            unique_ptr<Event> event(new Event(*first));
+            auto repeated = id_index.find(event->id);
+            if (repeated != id_index.end() && repeated->second >= old_size) {
+                // Earlier in this batch and not indexed yet: the later copy wins.
+                if (journal) journal->logAdd(*event, journal_error);
+                *events[repeated->second] = move(*event);
+                continue;
+            }
+            if (findEvent(event->id)) {
+                updateEvent(*event);
+                continue;
+            }
+            if (journal) journal->logAdd(*event, journal_error);
+            noteChange(event->id, nullptr);
+            storeEvent(move(event));
+        }
+        size_t added = events.size() - old_size;
+        if (added == 0) return;
+
+        if (added < old_size / 16) {
+            for (size_t i = old_size; i < events.size(); ++i) indexEvent(events[i].get());
+            return;
+        }
+
+        vector<Event*> existing;
+        existing.reserve(old_size);
+        IntervalTree::Cursor cursor = time_index.inOrder();
+        while (Event* e = cursor.next()) existing.push_back(e);
+
+        vector<Event*> fresh;
+        fresh.reserve(added);
+        for (size_t i = old_size; i < events.size(); ++i) {
+            Event* event = events[i].get();
+            text.put(*event);
+            schedules.put(event);
+            if (indexSeries(event)) continue;
+            indexDays(event);
+            columns.put(*event);
+            fresh.push_back(event);
+        }
+        sort(fresh.begin(), fresh.end(), [](const Event* a, const Event* b) { return IntervalTree::keyLess(a, b); });
+
+        vector<Event*> merged(existing.size() + fresh.size());
+        merge(existing.begin(), existing.end(), fresh.begin(), fresh.end(), merged.begin(),
+              [](const Event* a, const Event* b) { return IntervalTree::keyLess(a, b); });
+        time_index.build(merged);
+    }
+
+    template <typename Range>
+    void addEvents(const Range& batch) {
+        addEvents(begin(batch), end(batch));
+    }
+
+    void addEvents(vector<Event>&& batch) {
+        addEvents(make_move_iterator(batch.begin()), make_move_iterator(batch.end()));
+        batch.clear();
+    }
+
+    // O(1): the event is only marked as a tombstone here. Queries skip it and
+    // compact() later drops it from the slots and the time index together.
+    bool deleteEvent(int id) {
+        auto it = id_index.find(id);
+        if (it == id_index.end()) {
+            Event* event = base ? base->findById(id) : nullptr;
+            if (!event || !adoptFromBase(event)) return false;
+            it = id_index.find(id);
+        }
+        noteChange(id, events[it->second].get());
+        text.remove(*events[it->second]);
+        schedules.remove(events[it->second].get());
+        events[it->second]->tombstone = true;
+        id_index.erase(it);
+        columns.remove(id);
+        ++tombstones;
+        if (journal) journal->logDelete(id, journal_error);
+        return true;
+    }
+
+    Event* findEvent(int id) {
+        auto it = id_index.find(id);
+        if (it != id_index.end()) return events[it->second].get();
+        return base ? base->findById(id) : nullptr;
+    }
+
+    const Event* findEvent(int id) const {
+        auto it = id_index.find(id);
+        if (it != id_index.end()) return events[it->second].get();
+        return base ? base->findById(id) : nullptr;
+    }
+
+    // Replaces the calendar's contents with a mapped snapshot. Only the
+    // recurring series are loaded up front; everything else is read from
+    // the mapped pages when a query reaches it, so opening is O(series).
+    bool openSnapshot(const string& path, string& error) {
+        unique_ptr<MappedSnapshot> file = MappedSnapshot::open(path, error);
+        if (!file) return false;
+        clear();
+        Event::reserveId(file->maxId());
+        base.reset(new SnapshotLayer(move(file)));
+        for (uint32_t record = base->file->oneOffCount(); record < base->file->size(); ++record) {
+            indexSeries(base->fault(record));
+        }
+        return true;
+    }
+
+    // Writes every live event to a new snapshot that atomically replaces
+    // the file at path. Snapshot records that were never faulted in are
+    // copied through temporaries rather than loaded into the calendar.
+    bool saveSnapshot(const string& path, string& error) const {
+        return snapshotImage().write(path, error);
+    }
+
+    // Everything saveSnapshot would write, copied out so that another
+    // thread can write it while this calendar carries on. Copies only the
+    // in-memory events; snapshot records stay in the shared mapping.
+    SnapshotImage snapshotImage() const {
+        SnapshotImage image;
+        image.one_offs.reserve(time_index.size());
+        IntervalTree::Cursor memory = time_index.inOrder();
+        while (const Event* event = memory.next()) image.one_offs.push_back(*event);
+        for (const RecurringSeries& series : recurring) {
+            if (!series.event->isDeleted()) image.series.push_back(*series.event);
+        }
+        if (base) {
+            image.base = base->file;
+            image.shadowed = base->shadowedRecords();
+        }
+        return image;
+    }
+
+    // Records every later mutation in the journal; nullptr stops it.
+    void attachJournal(Journal* target) { journal = target; }
+
+    // Mutations go ahead in memory even when the journal cannot take them;
+    // callers check here afterwards and fail the command rather than report
+    // it as saved.
+    bool takeJournalError(string& error) {
+        if (journal_error.empty()) return false;
+        error = move(journal_error);
+        journal_error.clear();
+        return true;
+    }
+
+    // Starts remembering mutations so that undoChanges() can revert them,
+    // for callers that must not leave a change in place that they could
+    // not save. stopRecording() forgets them.
+    void recordChanges() {
+        changes.clear();
+        recording_changes = true;
+    }
+
+    void stopRecording() {
+        changes.clear();
+        recording_changes = false;
+    }
+
+    // Ids changed since recordChanges(), oldest first; an id changed
+    // twice is visited twice.
+    template <typename Visit>
+    void forEachChange(Visit visit) const {
+        for (const Change& change : changes) visit(change.id);
+    }
+
+    // Reverts everything since recordChanges(), newest first, without
+    // journaling the reversal, and stops recording.
+    void undoChanges() {
+        recording_changes = false;
+        Journal* attached = journal;
+        journal = nullptr;
+        for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+            if (!it->existed) deleteEvent(it->id);
+            else if (findEvent(it->id)) updateEvent(it->before);
+            else addEvent(move(it->before));
+        }
+        journal = attached;
+        journal_error.clear();
+        changes.clear();
+    }
+
+    // Re-applies the intact records of a journal, normally right after
+    // openSnapshot(). Replayed mutations are not journaled again.
+    bool replayJournal(const string& path, uint64_t& valid_length, size_t& replayed, string& error) {
+        Journal* attached = journal;
+        journal = nullptr;
+        replayed = 0;
+        bool ok = Journal::read(path, [this, &replayed](const JournalEntry& entry) {
+            switch (entry.op) {
+                case JournalOp::ADD: addEvent(entry.event); break;
+                case JournalOp::DELETE: deleteEvent(entry.id); break;
+                case JournalOp::EDIT:
+                    if (const Event* current = findEvent(entry.id)) {
+                        Event edited = *current;
+                        entry.applyEdit(edited);
+                        updateEvent(edited);
+                    }
+                    break;
+            }
+            ++replayed;
+        }, valid_length, error);
+        journal = attached;
+        return ok;
+    }
+
+    // Compaction pays off once tombstones make up a third of the slots.
+    bool needsCompaction() const {
+        return tombstones > 64 && tombstones * 3 > events.size();
+    }
+
+    // Drops tombstoned events: the time index is rebuilt from its live
+    // in-order walk and the surviving slots are packed, both in O(n).
+    void compact() {
+        if (tombstones == 0) return;
+        vector<Event*> live;
+        live.reserve(id_index.size());
+        IntervalTree::Cursor cursor = time_index.inOrder();
+        while (Event* e = cursor.next()) live.push_back(e);
+        time_index.build(live);
+        recurring.erase(remove_if(recurring.begin(), recurring.end(),
+            [](const RecurringSeries& series) { return series.event->isDeleted(); }), recurring.end());
+
+        size_t kept = 0;
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i]->tombstone) {
+                unindexDays(events[i].get());
+                continue;
+            }
+            if (kept != i) {
+                events[kept] = move(events[i]);
+                id_index[events[kept]->id] = kept;
+            }
+            ++kept;
+        }
+        events.resize(kept);
+        tombstones = 0;
+    }
+
+    // Called from idle points (between UI commands) so deletes never pay
+    // for the sweep themselves.
+    void compactIfNeeded() {
+        if (needsCompaction()) compact();
+    }
+
+    // Replaces the stored event with the same id, keeping the time index in
+    // sync. Edits must come through here rather than through findEvent().
+    bool updateEvent(const Event& updated) {
+        Event* event = findEvent(updated.id);
+        if (!event) return false;
+        noteChange(updated.id, event);
+        if (journal) journal->logEdit(*event, updated, journal_error);
+        bool reindex = adoptFromBase(event) ||
+                       event->start_time != updated.start_time || event->end_time != updated.end_time ||
+                       event->is_recurring != updated.is_recurring ||
+                       event->recurrence_pattern != updated.recurrence_pattern;
+        bool retext = !reindex && (event->title != updated.title || event->location != updated.location ||
+                                   event->description != updated.description);
+        bool reattend = !reindex && event->attendees != updated.attendees;
+        if (reindex) unindexEvent(event);
+        if (retext) text.remove(*event);
+        if (reattend) schedules.remove(event);
+        *event = updated;
+        if (reindex) indexEvent(event);
+        else columns.refresh(*event);
+        if (retext) text.put(*event);
+        if (reattend) schedules.put(event);
+        return true;
+    }
+
+    // Zero-copy view of everything touching the given local day, including
+    // multi-day events and occurrences of recurring ones.
+    DayView eventsOnDay(time_t day) const {
+        long number = localDayNumber(day);
+        time_t day_start = localDayStart(number);
+        time_t day_end = localDayStart(number + 1) - 1;
+        auto it = day_index.find(number);
+        DayCursor cursor = it == day_index.end()
+            ? DayCursor(nullptr, nullptr)
+            : DayCursor(it->second.data(), it->second.data() + it->second.size());
+        return DayView(LayeredCursor<DayCursor>(cursor, baseCursor(day_start, day_end, true)),
+                       &recurring, day_start, day_end, true);
+    }
+
+    // Zero-copy view of the occurrences overlapping [start, end], in start order.
+    RangeView eventsBetween(time_t start, time_t end) const {
+        return RangeView(RangeCursor(time_index.overlapping(start, end), baseCursor(start, end, false)),
+                         &recurring, start, end, false);
+    }
+
+    // Stored one-off events overlapping [start, end], in start order.
+    IntervalView oneOffsBetween(time_t start, time_t end) const {
+        return IntervalView(RangeCursor(time_index.overlapping(start, end), baseCursor(start, end, false)));
+    }
+
+    const vector<RecurringSeries>& recurringSeries() const { return recurring; }
+
+    // Hot columns of the stored one-off events. The first call fills them
+    // from the time index and the snapshot records (without faulting any
+    // in); later mutations keep them current.
+    const EventColumns& hotColumns() const {
+        lock_guard<mutex> guard(lazy_lock);
+        if (columns.isBuilt()) return columns;
+        uint32_t base_end = base ? base->file->oneOffCount() : 0;
+        columns.reserve(time_index.size() + base_end);
+        IntervalTree::Cursor cursor = time_index.inOrder();
+        while (const Event* e = cursor.next()) {
+            columns.append(e->id, e->start_time, e->end_time, static_cast<uint8_t>(e->priority),
+                           static_cast<uint8_t>(e->color), e->is_all_day ? EventColumns::ALL_DAY : 0);
+        }
+        for (uint32_t record = 0; record < base_end; ++record) {
+            if (base->isShadowed(record)) continue;
+            const SnapshotRecord& r = base->file->record(record);
+            columns.append(r.id, r.start_time, r.end_time, r.priority, r.color,
+                           (r.flags & SNAPSHOT_ALL_DAY) ? EventColumns::ALL_DAY : 0);
+        }
+        columns.markBuilt();
+        return columns;
+    }
+
+    // Ids of the stored one-off events overlapping [start, end] with at
+    // least min_priority, in no particular order. A linear scan of the hot
+    // columns, which beats the tree walk once a range covers much of the
+    // calendar. Inside a ScratchArena::Scope the ids are allocated from the
+    // arena and must not be used after that Scope ends.
+    pmr::vector<int> scanOneOffs(time_t start, time_t end, Priority min_priority = Priority::LOW) const {
+        const EventColumns& hot = hotColumns();
+        pmr::vector<uint32_t> rows(ScratchArena::resource());
+        hot.filter(start, end, min_priority, rows);
+        pmr::vector<int> ids(rows.size(), ScratchArena::resource());
+        for (size_t i = 0; i < rows.size(); ++i) ids[i] = hot.id(rows[i]);
+        return ids;
+    }
+
+    // Text index over every stored event. The first call fills it from the
+    // in-memory events and the snapshot's string table, again without
+    // faulting anything in.
+    const TextIndex& textIndex() const {
+        lock_guard<mutex> guard(lazy_lock);
+        if (text.isBuilt()) {
+            text.sortNewTerms();
+            return text;
+        }
+        for (const auto& event : events) {
+            if (!event->tombstone) text.append(event->id, event->title.str(), event->location.str(), event->description);
+        }
+        uint32_t base_end = base ? base->file->size() : 0;
+        for (uint32_t record = 0; record < base_end; ++record) {
+            if (base->isShadowed(record)) continue;
+            const SnapshotRecord& r = base->file->record(record);
+            text.append(r.id, base->file->textView(r.title), base->file->textView(r.location),
+                        base->file->textView(r.description));
+        }
+        text.markBuilt();
+        return text;
+    }
+
+    // Events matching every word of the query, best first; see TextIndex.
+    // Like TextIndex::search, the hits do not outlive an enclosing
+    // ScratchArena::Scope.
+    pmr::vector<SearchHit> search(string_view query, size_t limit = 20) const {
+        return textIndex().search(query, limit);
+    }
+
+    // Per-person schedules. The first call walks the in-memory events and
+    // the already loaded series, then lists the snapshot's one-off records
+    // by reading their attendees from the string table, like textIndex(),
+    // so nothing more is faulted in. Each distinct name is interned once.
+    const AttendeeIndex& attendeeIndex() const {
+        lock_guard<mutex> guard(lazy_lock);
+        if (schedules.isBuilt()) return schedules;
+        vector<Event*> invited;
+        for (const auto& event : events) {
+            if (!event->tombstone && !event->attendees.empty()) invited.push_back(event.get());
+        }
+        uint32_t one_off_end = base ? base->file->oneOffCount() : 0;
+        uint32_t base_end = base ? base->file->size() : 0;
+        for (uint32_t record = one_off_end; record < base_end; ++record) {
+            if (base->file->record(record).attendees == 0 || base->isShadowed(record)) continue;
+            invited.push_back(base->fault(record));
+        }
+        schedules.build(invited);
+
+        unordered_map<uint32_t, InternedString> people;  // string offset -> folded name
+        vector<uint32_t> listed;
+        for (uint32_t record = 0; record < one_off_end; ++record) {
+            const SnapshotRecord& r = base->file->record(record);
+            if (r.attendees == 0 || base->isShadowed(record)) continue;
+            listed.clear();
+            base->file->forEachListOffset(r.attendees, [&](uint32_t item) {
+                auto it = people.find(item);
+                if (it == people.end()) {
+                    it = people.emplace(item, InternedString(toLower(base->file->text(item)))).first;
+                }
+                const InternedString& person = it->second;
+                if (person.empty() || find(listed.begin(), listed.end(), person.id()) != listed.end()) return;
+                listed.push_back(person.id());
+                schedules.listBase(person, record, r.end_time);
+            });
+        }
+        return schedules;
+    }
+
+    // Occurrences overlapping [start, end] that list the attendee (in any
+    // letter case), in start order.
+    RangeView attendeeEventsBetween(const InternedString& attendee, time_t start, time_t end) const {
+        return scheduleView(attendeeIndex().find(attendee), start, end);
+    }
+
+    // Busy blocks in [from, to): the union of the timed occurrences there,
+    // clipped to it, in order. All-day events do not make anyone busy, as
+    // in the month heatmap. Inside a ScratchArena::Scope the blocks are
+    // allocated from the arena and must not be used after it ends.
+    template <typename Occurrences>
+    static pmr::vector<TimeBlock> mergeBusy(const Occurrences& occurrences, time_t from, time_t to) {
+        pmr::vector<TimeBlock> busy(ScratchArena::resource());
+        for (const Occurrence& o : occurrences) {
+            if (o.event->is_all_day) continue;
+            time_t start = max(o.start_time, from);
+            time_t end = min(o.end_time, to);
+            if (end <= start) continue;
+            if (!busy.empty() && start <= busy.back().end) busy.back().end = max(busy.back().end, end);
+            else busy.push_back(TimeBlock{start, end});
+        }
+        return busy;
+    }
+
+    // Busy blocks of the whole calendar; see mergeBusy for their lifetime.
+    pmr::vector<TimeBlock> busyBlocks(time_t from, time_t to) const {
+        return mergeBusy(eventsBetween(from, to - 1), from, to);
+    }
+
+    // One person's busy blocks, from their schedule alone. Same lifetime
+    // as above.
+    pmr::vector<TimeBlock> busyBlocks(const InternedString& attendee, time_t from, time_t to) const {
+        return mergeBusy(attendeeEventsBetween(attendee, from, to - 1), from, to);
+    }
+
+    // Earliest windows in [from, to) during working hours in which every
+    // attendee is free for at least options.duration, each given in full.
+    // Each person's schedule is a start-ordered stream; a heap merges the
+    // streams and the sweep moves past each busy occurrence in turn, so only
+    // the events before the last slot found are ever read. Inside a
+    // ScratchArena::Scope the slots are allocated from the arena and must
+    // not be used after that Scope ends.
+    pmr::vector<TimeBlock> findMeetingSlots(const NameList& attendees, time_t from, time_t to,
+                                            const MeetingSearch& options) const {
+        pmr::memory_resource* scratch = ScratchArena::resource();
+        pmr::vector<TimeBlock> slots(scratch);
+        if (options.max_slots == 0) return slots;
+
+        // The heap holds (next start, stream) pairs; the streams themselves
+        // are large and stay put.
+        pmr::vector<RangeView::iterator> streams(scratch);
+        pmr::vector<pair<time_t, uint32_t>> heads(scratch);
+        streams.reserve(attendees.size());
+        for (size_t i = 0; i < attendees.size(); ++i) {
+            bool repeated = false;
+            for (size_t j = 0; j < i && !repeated; ++j) repeated = attendees[j].equalsIgnoreCase(attendees[i]);
+            if (repeated) continue;
+            RangeView::iterator it = attendeeEventsBetween(attendees[i], from, to - 1).begin();
+            if (!(it != ViewEnd())) continue;
+            heads.emplace_back(it->start_time, static_cast<uint32_t>(streams.size()));
+            streams.push_back(it);
+        }
+        auto later = greater<pair<time_t, uint32_t>>();
+        make_heap(heads.begin(), heads.end(), later);
+
+        time_t free_from = from;
+        while (free_from < to && slots.size() < options.max_slots) {
+            time_t free_until = to;
+            time_t busy_until = to;
+            while (!heads.empty()) {
+                pop_heap(heads.begin(), heads.end(), later);
+                RangeView::iterator& stream = streams[heads.back().second];
+                Occurrence o = *stream;
+                if (++stream != ViewEnd()) {
+                    heads.back().first = stream->start_time;
+                    push_heap(heads.begin(), heads.end(), later);
+                } else {
+                    heads.pop_back();
+                }
+                if (o.event->is_all_day || o.event->priority < options.blocking ||
+                    o.end_time <= max(o.start_time, free_from)) {
+                    continue;
+                }
+                free_until = max(o.start_time, free_from);
+                busy_until = o.end_time;
+                break;
+            }
+            if (free_until > free_from) addWorkingSlots(free_from, min(free_until, to), options, slots);
+            free_from = max(free_from, busy_until);
+        }
+        return slots;
+    }
+
+    // Occurrences of other events overlapping the given one at its own
+    // times, in start order. A series is checked at each occurrence in
+    // its first year. All-day events conflict with nothing. With
+    // shared_attendees_only, only events listing one of its attendees
+    // count. Each check is one index query, O(log n + k). Inside a
+    // ScratchArena::Scope the result is allocated from the arena and must
+    // not be used after that Scope ends.
+    pmr::vector<Occurrence> conflictsWith(const Event& event, bool shared_attendees_only = false) const {
+        const time_t HORIZON = 366 * 86400;
+        const size_t MAX_CHECKED = 512;  // occurrences of a series
+
+        pmr::vector<Occurrence> conflicts(ScratchArena::resource());
+        if (event.is_all_day) return conflicts;
+        auto collect = [&](const RangeView& view, time_t start) {
+            for (const Occurrence& o : view) {
+                if (o.event->id == event.id || o.event->is_all_day || o.end_time <= max(o.start_time, start)) continue;
+                conflicts.push_back(o);
+            }
+        };
+        auto check = [&](time_t start, time_t end) {
+            if (end <= start) return;
+            if (!shared_attendees_only) {
+                collect(eventsBetween(start, end - 1), start);
+                return;
+            }
+            for (size_t i = 0; i < event.attendees.size(); ++i) {
+                bool repeated = false;
+                for (size_t j = 0; j < i && !repeated; ++j) repeated = event.attendees[j].equalsIgnoreCase(event.attendees[i]);
+                if (!repeated) collect(attendeeEventsBetween(event.attendees[i], start, end - 1), start);
+            }
+        };
+
+        RecurrenceRule rule;
+        if (event.is_recurring) rule = RecurrenceRule::parse(event.recurrence_pattern);
+        if (event.is_recurring && rule.valid()) {
+            OccurrenceCursor cursor(&event, &rule, event.start_time, event.start_time + HORIZON, false);
+            size_t checked = 0;
+            for (bool more = cursor.valid(); more && checked < MAX_CHECKED; more = cursor.advance(), ++checked) {
+                check(cursor.peek().start_time, cursor.peek().end_time);
+            }
+        } else {
+            check(event.start_time, event.end_time);
+        }
+
+        auto key_less = [](const Occurrence& a, const Occurrence& b) {
+            return a.start_time != b.start_time ? a.start_time < b.start_time : a.event->id < b.event->id;
+        };
+        sort(conflicts.begin(), conflicts.end(), key_less);
+        conflicts.erase(unique(conflicts.begin(), conflicts.end(), [](const Occurrence& a, const Occurrence& b) {
+            return a.event == b.event && a.start_time == b.start_time;
+        }), conflicts.end());
+        return conflicts;
+    }
+
+    // Calls visit(a, b) for every pair of overlapping timed occurrences
+    // within [from, to], where a starts no later than b. With
+    // shared_attendees_only the sweep runs over each person's schedule
+    // instead, and a pair whose events share several attendees is still
+    // reported once. The schedules are visited in hash order, so those
+    // pairs are gathered and handed out by start time, then by person.
+    template <typename Visit>
+    void forEachOverlap(time_t from, time_t to, bool shared_attendees_only, Visit visit) const {
+        if (!shared_attendees_only) {
+            sweepOverlaps(eventsBetween(from, to), visit);
+            return;
+        }
+        struct SharedPair {
+            Occurrence a, b;
+            uint32_t person;
+        };
+        ScratchArena::Scope scope;
+        pmr::vector<SharedPair> pairs(ScratchArena::resource());
+        attendeeIndex().forEachSchedule([&](uint32_t person, const AttendeeIndex::Schedule& schedule) {
+            sweepOverlaps(scheduleView(schedule, from, to), [&](const Occurrence& a, const Occurrence& b) {
+                if (firstSharedAttendee(*a.event, *b.event) == person) pairs.push_back(SharedPair{a, b, person});
+            });
+        });
+        sort(pairs.begin(), pairs.end(), [](const SharedPair& x, const SharedPair& y) {
+            if (x.a.start_time != y.a.start_time) return x.a.start_time < y.a.start_time;
+            if (x.person != y.person) return x.person < y.person;
+            if (x.b.start_time != y.b.start_time) return x.b.start_time < y.b.start_time;
+            if (x.a.event->id != y.a.event->id) return x.a.event->id < y.a.event->id;
+            return x.b.event->id < y.b.event->id;
+        });
+        for (const SharedPair& pair : pairs) visit(pair.a, pair.b);
+    }
+
+    // Calls visit(facts) for every occurrence overlapping [lo, hi], in no
+    // particular order. Nothing is faulted in, cached or interned, so
+    // several threads may scan at once as long as none modifies the calendar.
+    template <typename Visit>
+    void scanOccurrences(time_t lo, time_t hi, Visit visit) const {
+        auto facts = [](const Event& event, time_t start, time_t end) {
+            return OccurrenceFacts{start, end, event.is_all_day, event.priority, event.color,
+                                   string_view(event.location.str()), &event.attendees, nullptr, 0};
+        };
+        IntervalTree::Cursor memory = time_index.overlapping(lo, hi);
+        while (const Event* event = memory.next()) visit(facts(*event, event->start_time, event->end_time));
+
+        if (base) {
+            const MappedSnapshot& file = *base->file;
+            MappedSnapshot::Cursor cursor(&file, lo, hi, false);
+            long record;
+            while ((record = cursor.next()) >= 0) {
+                if (base->isShadowed(static_cast<uint32_t>(record))) continue;
+                const SnapshotRecord& r = file.record(static_cast<uint32_t>(record));
+                visit(OccurrenceFacts{static_cast<time_t>(r.start_time), static_cast<time_t>(r.end_time),
+                                      (r.flags & SNAPSHOT_ALL_DAY) != 0, static_cast<Priority>(r.priority),
+                                      static_cast<Color>(r.color), file.textView(r.location), nullptr, &file,
+                                      r.attendees});
+            }
+        }
+
+        for (const RecurringSeries& series : recurring) {
+            if (series.event->isDeleted()) continue;
+            OccurrenceCursor cursor(series.event, &series.rule, lo, hi, false);
+            for (bool more = cursor.valid(); more; more = cursor.advance()) {
+                visit(facts(*series.event, cursor.peek().start_time, cursor.peek().end_time));
+            }
+        }
+    }
+
+    // Overlapping pairs within [from, to] that involve an event with an id
+    // of at least min_id, such as the ones a bulk load just created.
+    size_t countOverlaps(time_t from, time_t to, bool shared_attendees_only, int min_id = 0) const {
+        size_t count = 0;
+        forEachOverlap(from, to, shared_attendees_only, [&count, min_id](const Occurrence& a, const Occurrence& b) {
+            if (a.event->id >= min_id || b.event->id >= min_id) ++count;
+        });
+        return count;
+    }
+
+    // Stored one-off events in start order (recurring series excluded).
+    IntervalView allEvents() const {
+        time_t first = numeric_limits<time_t>::min();
+        time_t last = numeric_limits<time_t>::max();
+        return IntervalView(RangeCursor(time_index.inOrder(), baseCursor(first, last, false)));
+    }
+
+    bool hasEventsOnDay(time_t day) const {
+        return !eventsOnDay(day).empty();
+    }
+
+    vector<Event> getEventsForDay(time_t day) const {
+        vector<Event> result;
+        for (const Occurrence& o : eventsOnDay(day)) result.push_back(o.toEvent());
+        return result;
+    }
+
+    vector<Event> getEventsBetween(time_t start, time_t end) const {
+        vector<Event> result;
+        for (const Occurrence& o : eventsBetween(start, end)) result.push_back(o.toEvent());
+        return result;
+    }
+
+    // Earliest-starting occurrence running at the given instant; its event
+    // is nullptr when nothing is scheduled.
+    Occurrence getEventAt(time_t time) const {
+        auto view = eventsBetween(time, time);
+        auto it = view.begin();
+        if (it != view.end()) return *it;
+        return Occurrence{nullptr, 0, 0};
+    }
+
+    // The views draw their events from anything with eventsOnDay and
+    // eventsBetween: this calendar, or a CalendarSet overlaying several.
+// Fix the displayDay function - remove the UNDERLINE usage or replace with BOLD
+template <typename Events>
+static void displayDay(const Events& events, time_t day) {
+    clearScreen();
+    auto day_events = events.eventsOnDay(day);
+    
+    cout << TermColor::BOLD << "\n=== " << getDayName(day) << " " << dateToString(day) 
+         << " ===" << TermColor::RESET << "\n\n";
+    
+    if (day_events.empty()) {
+        cout << "No events scheduled for this day.\n";
+    } else {
+        for (const auto& e : day_events) {
+            e.printSummary(true);
+            cout << string(60, '-') << "\n";
+        }
+    }
+    waitForEnter();
+}
+
+// Fix the displayWeek function - remove BG_BLUE or replace with BLUE
+template <typename Events>
+static void displayWeek(const Events& events, time_t reference_day, const WeekGridOptions& options = WeekGridOptions()) {
+    clearScreen();
+    const int DAY_WIDTH = 20;
+    const int MAX_LANES = 4;  // narrower lanes would not fit a title
+
+    long today = localDayNumber(reference_day);
+    long sunday = today - weekdayFromDays(today); // Start from Sunday
+    WeekGrid grid(sunday, options, events.eventsBetween(localDayStart(sunday), localDayStart(sunday + 7) - 1));
+
+    cout << TermColor::BOLD << "\n=== Week View (" 
+         << dateToString(grid.dayStart(0))
+         << " to "
+         << dateToString(grid.dayStart(6))
+         << ") ===" << TermColor::RESET << "\n\n";
+
+    // Print day headers
+    cout << setw(10) << "Time";
+    for (int day = 0; day < WeekGrid::DAYS; ++day) {
+        char buffer[20];
+        formatTime(buffer, sizeof(buffer), grid.dayStart(day), "%a %m/%d");
+        cout << setw(DAY_WIDTH) << buffer;
+    }
+    cout << '\n' << string(10 + WeekGrid::DAYS * DAY_WIDTH, '-') << '\n';
+
+    // Print the slot grid. An event's title goes in its first slot and a
+    // bar marks the slots it continues through.
+    for (int slot = 0; slot < grid.slotCount(); ++slot) {
+        int minutes = grid.slotMinutes(slot);
+        int hour = minutes / 60;
+        char label[12];
+        snprintf(label, sizeof(label), "%d:%02d %s", hour % 12 == 0 ? 12 : hour % 12, minutes % 60,
+                 hour < 12 ? "AM" : "PM");
+        cout << setw(10) << label;
+
+        for (int day = 0; day < WeekGrid::DAYS; ++day) {
+            int lanes = grid.lanesAt(day, slot);
+            int shown = min(lanes, MAX_LANES);
+            if (shown == 0) {
+                cout << setw(DAY_WIDTH) << "";
+                continue;
+            }
+            int width = DAY_WIDTH / shown;
+            for (int lane = 0; lane < shown; ++lane) {
+                int cell = lane + 1 == shown ? DAY_WIDTH - width * (shown - 1) : width;
+                const Event* event = grid.at(day, lane, slot);
+                int source = lane;
+
+                // The last lane stands in for any that do not fit.
+                int hidden = 0;
+                if (lane + 1 == shown && lanes > shown) {
+                    for (int extra = lane; extra < lanes; ++extra) hidden += grid.at(day, extra, slot) != nullptr;
+                }
+                string text;
+                if (hidden > 1) {
+                    text = "+" + to_string(hidden);
+                    event = nullptr;
+                } else if (hidden == 1 && !event) {
+                    while (!event) event = grid.at(day, ++source, slot);
+                }
+                if (event) {
+                    bool starts = slot == 0 || grid.at(day, source, slot - 1) != event;
+                    text = starts ? event->title.str() : "|";
+                }
+                text = text.substr(0, cell - 1);
+                if (event) cout << getColorCode(event->color);
+                cout << left << setw(cell) << text << right;
+                if (event) cout << TermColor::RESET;
+            }
+        }
+        cout << '\n';
+    }
+
+    // Print all-day events
+    cout << "\n" << TermColor::BOLD << "All-Day Events:" << TermColor::RESET << "\n";
+    for (int day = 0; day < WeekGrid::DAYS; ++day) {
+        if (grid.allDay(day).empty()) continue;
+        cout << setw(10) << dateToString(grid.dayStart(day)) << ": ";
+        for (const Event* e : grid.allDay(day)) {
+            cout << getColorCode(e->color) << "[" << e->title << "] " << TermColor::RESET;
+        }
+        cout << '\n';
+    }
+    waitForEnter();
+}
+    // Month grid as a heatmap: each day shows its heat glyph and event
+    // count, from one sweep over the month's occurrences.
+    template <typename Events>
+    static void displayMonth(const Events& events, time_t current_date) {
+        clearScreen();
+        CivilTime t = localCivil(current_date);
+        long first = daysFromCivil(t.year, t.month, 1);
+        int first_day = weekdayFromDays(first);
+        int days_in_month = daysInMonth(t.year, t.month);
+        long last = first + days_in_month - 1;
+        DayLoadMap loads(first, last, events.eventsBetween(localDayStart(first), localDayStart(last + 1) - 1));
+
+        char title[32];
+        formatTime(title, sizeof(title), current_date, "%B %Y");
+        cout << TermColor::BOLD << "\n=== Calendar for " << title
+             << " ===" << TermColor::RESET << "\n\n";
+        cout << "   Sun   Mon   Tue   Wed   Thu   Fri   Sat\n";
+
+        long busiest = first;
+        int total_minutes = 0;
+        for (int i = 0; i < first_day; ++i) cout << "      ";
+        for (int day = 1; day <= days_in_month; ++day) {
+            const DayLoad& load = loads.at(first + day - 1);
+            int level = load.level();
+            string count = load.events == 0 ? "" : load.events > 99 ? "++" : to_string(load.events);
+            cout << DayLoad::color(level) << setw(3) << day << DayLoad::glyph(level)
+                 << left << setw(2) << count << right << TermColor::RESET;
+
+            total_minutes += load.busy_minutes;
+            const DayLoad& top = loads.at(busiest);
+            if (load.busy_minutes > top.busy_minutes ||
+                (load.busy_minutes == top.busy_minutes && load.events > top.events)) {
+                busiest = first + day - 1;
+            }
+            if ((day + first_day) % 7 == 0) cout << '\n';
+        }
+
+        cout << "\n\n" << TermColor::BOLD << "Legend: " << TermColor::RESET << "day, heat, events   ";
+        for (int level = 1; level <= 4; ++level) {
+            static const char* const RANGES[] = {"", "<2h", "2-4h", "4-6h", "6h+"};
+            cout << DayLoad::color(level) << DayLoad::glyph(level) << " " << RANGES[level]
+                 << TermColor::RESET << "  ";
+        }
+        cout << "busy\n";
+        cout << "Busy this month: " << total_minutes / 60 << "h " << total_minutes % 60 << "m";
+        if (loads.at(busiest).events > 0) {
+            const DayLoad& top = loads.at(busiest);
+            cout << "; busiest day " << dateToString(loads.dayStart(busiest)) << " (" << top.events
+                 << " events, " << top.busy_minutes / 60 << "h " << top.busy_minutes % 60 << "m)";
+        }
+        cout << "\n";
+        waitForEnter();
+    }
+
+    // Whole year as a weekday-by-week heatmap followed by monthly totals,
+    // all from one sweep over the year's occurrences.
+    template <typename Events>
+    static void displayYear(const Events& events, time_t current_date) {
+        clearScreen();
+        int year = localCivil(current_date).year;
+        long first = daysFromCivil(year, 1, 1);
+        long last = daysFromCivil(year, 12, 31);
+        DayLoadMap loads(first, last, events.eventsBetween(localDayStart(first), localDayStart(last + 1) - 1));
+
+        long grid_start = first - weekdayFromDays(first);
+        int weeks = static_cast<int>((last - grid_start) / 7 + 1);
+
+        cout << TermColor::BOLD << "\n=== Year " << year << " ===" << TermColor::RESET << "\n\n";
+
+        // Month names above the week in which each month begins.
+        string labels(5 + weeks * 2 + 3, ' ');
+        for (int month = 1; month <= 12; ++month) {
+            long week = (daysFromCivil(year, month, 1) - grid_start) / 7;
+            string name = string(MONTH_NAMES[month - 1]).substr(0, 3);
+            labels.replace(5 + static_cast<size_t>(week) * 2, name.size(), name);
+        }
+        cout << labels << "\n";
+
+        static const char* const WEEKDAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        for (int weekday = 0; weekday < 7; ++weekday) {
+            cout << left << setw(5) << WEEKDAYS[weekday] << right;
+            for (int week = 0; week < weeks; ++week) {
+                long day = grid_start + week * 7 + weekday;
+                if (day < first || day > last) {
+                    cout << "  ";
+                    continue;
+                }
+                int level = loads.at(day).level();
+                cout << DayLoad::color(level) << (level == 0 ? "-" : DayLoad::glyph(level)) << TermColor::RESET << ' ';
+            }
+            cout << '\n';
+        }
+
+        cout << "\n" << TermColor::BOLD << "Month   Event-days   Busy" << TermColor::RESET << "\n";
+        for (int month = 1; month <= 12; ++month) {
+            int events = 0, minutes = 0;
+            long month_first = daysFromCivil(year, month, 1);
+            for (long day = month_first; day < month_first + daysInMonth(year, month); ++day) {
+                events += loads.at(day).events;
+                minutes += loads.at(day).busy_minutes;
+            }
+            cout << left << setw(8) << string(MONTH_NAMES[month - 1]).substr(0, 3) << right << setw(10) << events
+                 << setw(6) << minutes / 60 << "h " << setw(2) << minutes % 60 << "m\n";
+        }
+        waitForEnter();
+    }
+
+    template <typename Events>
+    static void displayAgenda(const Events& events, time_t start, time_t end) {
+        clearScreen();
+        auto agenda_events = events.eventsBetween(start, end);
+        
+        cout << TermColor::BOLD << "\n=== Agenda View (" 
+             << dateToString(start) << " to " << dateToString(end) 
+             << ") ===" << TermColor::RESET << "\n\n";
+        
+        if (agenda_events.empty()) {
+            cout << "No events found in this period.\n";
+        } else {
+            string current_date;
+            for (const auto& e : agenda_events) {
+                string event_date = dateToString(e.start_time);
+                if (event_date != current_date) {
+                    current_date = event_date;
+                    cout << "\n" << TermColor::BOLD << current_date << " (" 
+                         << getDayName(e.start_time) << ")" << TermColor::RESET << "\n";
+                    cout << string(60, '=') << "\n";
+                }
+                e.printSummary(true);
+                cout << string(60, '-') << "\n";
+            }
+        }
+        waitForEnter();
+    }
+
+    void displayDay(time_t day) const { displayDay(*this, day); }
+    void displayWeek(time_t reference_day, const WeekGridOptions& options = WeekGridOptions()) const {
+        displayWeek(*this, reference_day, options);
+    }
+    void displayMonth(time_t current_date) const { displayMonth(*this, current_date); }
+    void displayYear(time_t current_date) const { displayYear(*this, current_date); }
+    void displayAgenda(time_t start, time_t end) const { displayAgenda(*this, start, end); }
+
+    void displaySearch(const string& query) const {
+        clearScreen();
+        cout << TermColor::BOLD << "\n=== Search: " << query << " ===" << TermColor::RESET << "\n\n";
+
+        auto hits = search(query);
+        if (hits.empty()) {
+            cout << "No matching events.\n";
+        } else {
+            for (const SearchHit& hit : hits) {
+                const Event* event = findEvent(hit.id);
+                if (!event) continue;
+                event->printSummary(true);
+                cout << string(60, '-') << "\n";
+            }
+        }
+        waitForEnter();
+    }
+
+    void displayOverlaps(time_t start, time_t end, bool shared_attendees_only) const {
+        const size_t MAX_SHOWN = 50;
+        clearScreen();
+        cout << TermColor::BOLD << "\n=== Overlapping Events (" << dateToString(start) << " to "
+             << dateToString(end) << ") ===" << TermColor::RESET << "\n\n";
+
+        size_t count = 0;
+        forEachOverlap(start, end, shared_attendees_only, [&count](const Occurrence& a, const Occurrence& b) {
+            if (count++ >= MAX_SHOWN) return;
+            cout << timeToString(a.start_time) << "-" << timeToString(a.end_time, "%H:%M") << "  [" << a.event->id
+                 << "] " << a.event->title << "\n  overlaps " << timeToString(b.start_time) << "-"
+                 << timeToString(b.end_time, "%H:%M") << "  [" << b.event->id << "] " << b.event->title << "\n";
+            cout << string(60, '-') << "\n";
+        });
+        if (count == 0) {
+            cout << "No overlapping events in this period.\n";
+        } else if (count > MAX_SHOWN) {
+            cout << "... and " << (count - MAX_SHOWN) << " more.\n";
+        }
+        waitForEnter();
+    }
+
+    void listAllEvents() const {
+        clearScreen();
+        cout << TermColor::BOLD << "\n=== All Events ===" << TermColor::RESET << "\n\n";
+        
+        if (size() == 0) {
+            cout << "No events in calendar.\n";
+        } else {
+            for (const auto& e : allEvents()) {
+                e.printSummary(true);
+                cout << string(60, '=') << "\n";
+            }
+            // Deleted series stay in recurring until the next compaction.
+            bool header = false;
+            for (const auto& series : recurring) {
+                if (series.event->isDeleted()) continue;
+                if (!header) {
+                    cout << "\n" << TermColor::BOLD << "Recurring Events:" << TermColor::RESET << "\n\n";
+                    header = true;
+                }
+                series.event->printSummary(true);
+                cout << string(60, '=') << "\n";
+            }
+        }
+        waitForEnter();
+    }
+};
+
+// ==================== Concurrent Calendar ====================
+// Calendar above serves one writer at a time (the UI, a batch run or the
+// server's writers). This is the engine for many threads at once. A writer builds the next immutable
+// Version beside the current one, sharing every chunk of events it did not
+// touch, and publishes it with one atomic pointer swap. Readers pin the
+// version they started from and never wait for writers. A replaced version
+// is freed once every reader that might still hold it has finished.
+
+// Epoch-based reclamation. While a Guard lives, its reader's slot holds
+// the global epoch it started in. An object retired in epoch e is freed
+// once no slot holds an epoch at or before e.
+class EpochDomain {
+public:
+    static const size_t SLOTS = 128;  // readers active at once; more wait for a slot
+
+private:
+    static const uint64_t IDLE = numeric_limits<uint64_t>::max();
+
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{IDLE};
+        atomic<bool> taken{false};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    Slot slots[SLOTS];
+    atomic<uint64_t> global{1};
+    mutex retired_lock;
+    vector<Retired> retired;
+    uint64_t freed = 0;
+
+    // Each thread starts looking where its last slot was, so claims rarely
+    // touch another reader's cache line.
+    Slot* claim() {
+        thread_local size_t hint = hash<thread::id>()(this_thread::get_id());
+        for (size_t i = 0;; ++i) {
+            Slot& slot = slots[(hint + i) % SLOTS];
+            bool expected = false;
+            if (!slot.taken.load(memory_order_relaxed) &&
+                slot.taken.compare_exchange_strong(expected, true, memory_order_acquire)) {
+                hint = (hint + i) % SLOTS;
+                return &slot;
+            }
+            if (i % SLOTS == SLOTS - 1) this_thread::yield();
+        }
+    }
+
+    // Frees what no reader can still see. Called with retired_lock held.
+    void collect() {
+        uint64_t oldest = IDLE;
+        for (Slot& slot : slots) oldest = min(oldest, slot.epoch.load());
+        size_t kept = 0;
+        for (const Retired& r : retired) {
+            if (r.epoch < oldest) {
+                r.destroy(r.object);
+                ++freed;
+            } else {
+                retired[kept++] = r;
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    class Guard {
+    private:
+        Slot* slot;
+
+    public:
+        // The announcement is sequentially consistent with the writer's
+        // pointer swap and epoch bump, so a reader either announced early
+        // enough to be waited for or loads the new pointer.
+        explicit Guard(EpochDomain& domain) : slot(domain.claim()) {
+            slot->epoch.store(domain.global.load());
+        }
+        ~Guard() {
+            slot->epoch.store(IDLE, memory_order_release);
+            slot->taken.store(false, memory_order_release);
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    EpochDomain() = default;
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    ~EpochDomain() {
+        for (const Retired& r : retired) r.destroy(r.object);
+    }
+
+    // Hands over an object that has just been unpublished; it is deleted
+    // once the readers that could have loaded it are gone.
+    template <typename T>
+    void retire(T* object) {
+        lock_guard<mutex> guard(retired_lock);
+        retired.push_back(Retired{global.fetch_add(1), object, [](void* p) { delete static_cast<T*>(p); }});
+        collect();
+    }
+
+    // Frees what it can, then reports the retired objects freed so far
+    // and those still waiting for readers.
+    void counts(uint64_t& freed_count, size_t& waiting) {
+        lock_guard<mutex> guard(retired_lock);
+        collect();
+        freed_count = freed;
+        waiting = retired.size();
+    }
+};
+
+// Thread-safe calendar of one-off and recurring events. Reads go through
+// a Snapshot and writes through add/update/remove, from any thread. The
+// one-off events of a version sit in chunks of a few hundred, sorted by
+// start. A write copies the one chunk it changes and the small array of
+// chunk references, so it costs O(n / CHUNK + CHUNK) rather than a full
+// copy. Like Calendar::addEvent, adding an id that is already stored
+// replaces that event. The server keeps one as a copy of its Calendar,
+// so that range queries read a version instead of waiting for writers.
+class ConcurrentCalendar {
+private:
+    static const size_t CHUNK = 256;     // events per chunk after a split; chunks split past twice this
+    static const size_t MIN_FILL = 64;   // a chunk emptied below this merges into a neighbour
+
+    // Events sorted by (start_time, id). Never modified once published.
+    struct Chunk {
+        vector<Event> events;
+        time_t max_end = numeric_limits<time_t>::min();
+
+        void measure() {
+            max_end = numeric_limits<time_t>::min();
+            for (const Event& event : events) max_end = max(max_end, event.end_time);
+        }
+    };
+
+    struct ChunkRef {
+        shared_ptr<const Chunk> chunk;
+        time_t first_start;
+        time_t reach;  // latest end in this chunk or any before it
+    };
+
+    struct Version {
+        uint64_t number = 0;
+        size_t size = 0;
+        vector<ChunkRef> chunks;
+        vector<shared_ptr<Event>> series_events;  // owned here, pointed to by series
+        vector<RecurringSeries> series;
+    };
+
+    // Writer-side lookup from id to where the event lives.
+    struct Location {
+        time_t start;
+        bool series;
+    };
+
+    mutable EpochDomain epochs;
+    atomic<Version*> current;
+    mutex write_lock;  // serializes writers; readers never take it
+    unordered_map<int, Location> locations;
+
+    static bool before(const Event& a, time_t start, int id) {
+        return a.start_time < start || (a.start_time == start && a.id < id);
+    }
+
+    // first_start and reach of the chunks from index on.
+    static void refresh(Version& version, size_t index) {
+        for (size_t i = index; i < version.chunks.size(); ++i) {
+            ChunkRef& ref = version.chunks[i];
+            ref.first_start = ref.chunk->events.front().start_time;
+            ref.reach = i == 0 ? ref.chunk->max_end : max(version.chunks[i - 1].reach, ref.chunk->max_end);
+        }
+    }
+
+    // Chunk that holds, or would hold, an event at (start, id).
+    static size_t chunkFor(const Version& version, time_t start, int id) {
+        auto it = partition_point(version.chunks.begin(), version.chunks.end(), [&](const ChunkRef& ref) {
+            const Event& first = ref.chunk->events.front();
+            return before(first, start, id) || (first.start_time == start && first.id == id);
+        });
+        return it == version.chunks.begin() ? 0 : static_cast<size_t>(it - version.chunks.begin()) - 1;
+    }
+
+    static void insertOneOff(Version& version, Event event) {
+        if (version.chunks.empty()) {
+            auto chunk = make_shared<Chunk>();
+            chunk->events.push_back(move(event));
+            chunk->measure();
+            version.chunks.push_back(ChunkRef{move(chunk), 0, 0});
+            refresh(version, 0);
+            return;
+        }
+        size_t index = chunkFor(version, event.start_time, event.id);
+        auto chunk = make_shared<Chunk>(*version.chunks[index].chunk);
+        vector<Event>& events = chunk->events;
+        auto at = lower_bound(events.begin(), events.end(), event,
+                              [](const Event& a, const Event& b) { return before(a, b.start_time, b.id); });
+        chunk->max_end = max(chunk->max_end, event.end_time);
+        events.insert(at, move(event));
+        if (events.size() > 2 * CHUNK) {
+            auto upper = make_shared<Chunk>();
+            upper->events.assign(make_move_iterator(events.begin() + CHUNK), make_move_iterator(events.end()));
+            events.erase(events.begin() + CHUNK, events.end());
+            chunk->measure();
+            upper->measure();
+            version.chunks.insert(version.chunks.begin() + index + 1, ChunkRef{move(upper), 0, 0});
+        }
+        version.chunks[index].chunk = move(chunk);
+        refresh(version, index);
+    }
+
+    // Folds the chunk at index into its left neighbour (or the right one
+    // for the first chunk) once it is underfull, splitting the result in
+    // two if that makes it too large. Returns the first chunk whose
+    // references need a refresh.
+    static size_t mergeUnderfull(Version& version, size_t index) {
+        if (version.chunks.size() < 2 || version.chunks[index].chunk->events.size() >= MIN_FILL) return index;
+        size_t left = index == 0 ? 0 : index - 1;
+        auto merged = make_shared<Chunk>(*version.chunks[left].chunk);
+        const vector<Event>& right = version.chunks[left + 1].chunk->events;
+        merged->events.insert(merged->events.end(), right.begin(), right.end());
+        version.chunks.erase(version.chunks.begin() + left + 1);
+        if (merged->events.size() > 2 * CHUNK) {
+            size_t half = merged->events.size() / 2;
+            auto upper = make_shared<Chunk>();
+            upper->events.assign(make_move_iterator(merged->events.begin() + half),
+                                 make_move_iterator(merged->events.end()));
+            merged->events.erase(merged->events.begin() + half, merged->events.end());
+            upper->measure();
+            version.chunks.insert(version.chunks.begin() + left + 1, ChunkRef{move(upper), 0, 0});
+        }
+        merged->measure();
+        version.chunks[left].chunk = move(merged);
+        return left;
+    }
+
+    static bool removeOneOff(Version& version, int id, time_t start) {
+        for (size_t index = chunkFor(version, start, id); index < version.chunks.size(); ++index) {
+            const vector<Event>& events = version.chunks[index].chunk->events;
+            if (events.front().start_time > start) break;
+            auto it = find_if(events.begin(), events.end(), [id](const Event& e) { return e.id == id; });
+            if (it == events.end()) continue;
+            if (events.size() == 1) {
+                version.chunks.erase(version.chunks.begin() + index);
+            } else {
+                auto chunk = make_shared<Chunk>(*version.chunks[index].chunk);
+                chunk->events.erase(chunk->events.begin() + (it - events.begin()));
+                chunk->measure();
+                version.chunks[index].chunk = move(chunk);
+                index = mergeUnderfull(version, index);
+            }
+            refresh(version, index);
+            return true;
+        }
+        return false;
+    }
+
+    static void removeSeries(Version& version, int id) {
+        for (size_t i = 0; i < version.series.size(); ++i) {
+            if (version.series[i].event->id != id) continue;
+            version.series.erase(version.series.begin() + i);
+            version.series_events.erase(version.series_events.begin() + i);
+            return;
+        }
+    }
+
+    static bool seriesRule(const Event& event, RecurrenceRule& rule) {
+        if (!event.is_recurring) return false;
+        rule = RecurrenceRule::parse(event.recurrence_pattern);
+        return rule.valid();
+    }
+
+    // Adds to a version being built; the caller holds write_lock.
+    void place(Version& version, Event event) {
+        RecurrenceRule rule;
+        bool series = seriesRule(event, rule);
+        locations[event.id] = Location{event.start_time, series};
+        ++version.size;
+        if (!series) {
+            insertOneOff(version, move(event));
+            return;
+        }
+        version.series_events.push_back(make_shared<Event>(move(event)));
+        version.series.push_back(RecurringSeries{version.series_events.back().get(), rule});
+    }
+
+    bool unplace(Version& version, int id) {
+        auto it = locations.find(id);
+        if (it == locations.end()) return false;
+        if (it->second.series) {
+            removeSeries(version, id);
+        } else {
+            removeOneOff(version, id, it->second.start);
+        }
+        locations.erase(it);
+        --version.size;
+        return true;
+    }
+
+    // Swaps in the next version and retires the one it replaces. The
+    // caller holds write_lock.
+    void publish(Version* next) {
+        next->number = current.load(memory_order_relaxed)->number + 1;
+        epochs.retire(current.exchange(next));
+    }
+
+public:
+    // One-off events of a version overlapping [lo, hi], in start order:
+    // the Source of the MergedView a snapshot hands out.
+    class ChunkCursor {
+    private:
+        const ChunkRef* chunk;
+        const ChunkRef* last;
+        size_t index;
+        time_t lo;
+        time_t hi;
+
+    public:
+        ChunkCursor(const ChunkRef* first, const ChunkRef* last, time_t lo, time_t hi)
+            : chunk(first), last(last), index(0), lo(lo), hi(hi) {}
+
+        const Event* next() {
+            for (; chunk != last && chunk->first_start <= hi; ++chunk, index = 0) {
+                if (chunk->chunk->max_end < lo) continue;
+                const vector<Event>& events = chunk->chunk->events;
+                while (index < events.size()) {
+                    const Event& event = events[index++];
+                    if (event.start_time > hi) break;
+                    if (event.end_time >= lo) return &event;
+                }
+            }
+            chunk = last;
+            return nullptr;
+        }
+    };
+
+    typedef MergedView<ChunkCursor> View;
+
+    // Occurrences whose event lists a person, in any letter case.
+    struct Lists {
+        InternedString person;
+        bool operator()(const Occurrence& o) const {
+            for (const InternedString& name : o.event->attendees) {
+                if (name.equalsIgnoreCase(person)) return true;
+            }
+            return false;
+        }
+    };
+
+    typedef FilterView<View, Lists> AttendeeView;
+
+    // A consistent, read-only calendar as of the moment it was taken.
+    // Holding one never blocks a writer, and what it hands out stays valid
+    // until it is destroyed. Meant for one thread and a short query.
+    class Snapshot {
+    private:
+        EpochDomain::Guard guard;
+        const Version* version;
+
+    public:
+        Snapshot(EpochDomain& epochs, const atomic<Version*>& current) : guard(epochs), version(current.load()) {}
+
+        uint64_t versionNumber() const { return version->number; }
+        size_t size() const { return version->size; }
+
+        // Occurrences overlapping [start, end], in start order.
+        View eventsBetween(time_t start, time_t end) const {
+            const vector<ChunkRef>& chunks = version->chunks;
+            auto first = partition_point(chunks.begin(), chunks.end(),
+                                         [start](const ChunkRef& ref) { return ref.reach < start; });
+            return View(ChunkCursor(chunks.data() + (first - chunks.begin()), chunks.data() + chunks.size(), start, end),
+                        &version->series, start, end, false);
+        }
+
+        // Like Calendar::attendeeEventsBetween, but found by filtering the
+        // range, since a version keeps no per-person index.
+        AttendeeView attendeeEventsBetween(const InternedString& attendee, time_t start, time_t end) const {
+            return eventsBetween(start, end).where(Lists{attendee});
+        }
+
+        // Valid only inside the ScratchArena::Scope it was made in, if any.
+        pmr::vector<TimeBlock> busyBlocks(time_t from, time_t to) const {
+            return Calendar::mergeBusy(eventsBetween(from, to - 1), from, to);
+        }
+
+        // One person's busy blocks; the same lifetime as above.
+        pmr::vector<TimeBlock> busyBlocks(const InternedString& attendee, time_t from, time_t to) const {
+            return Calendar::mergeBusy(attendeeEventsBetween(attendee, from, to - 1), from, to);
+        }
+    };
+
+    ConcurrentCalendar() : current(new Version()) {}
+    ConcurrentCalendar(const ConcurrentCalendar&) = delete;
+    ConcurrentCalendar& operator=(const ConcurrentCalendar&) = delete;
+    ~ConcurrentCalendar() { delete current.load(); }
+
+    Snapshot snapshot() const { return Snapshot(epochs, current); }
+
+    // Returns the id the event is stored under.
+    int add(Event event) {
+        lock_guard<mutex> lock(write_lock);
+        int id = event.id;
+        Version* next = new Version(*current.load(memory_order_relaxed));
+        unplace(*next, id);
+        place(*next, move(event));
+        publish(next);
+        return id;
+    }
+
+    // Many events in one version: the chunks are rebuilt once, in
+    // O(n log n), instead of copied per event. Where an id repeats, in the
+    // batch or against what is stored, the last copy wins.
+    void addAll(vector<Event> batch) {
+        lock_guard<mutex> lock(write_lock);
+        const Version& base = *current.load(memory_order_relaxed);
+        Version* next = new Version();
+        next->series_events = base.series_events;
+        next->series = base.series;
+        next->size = base.size;
+
+        unordered_map<int, size_t> last;  // id -> index of its final copy in the batch
+        for (size_t i = 0; i < batch.size(); ++i) last[batch[i].id] = i;
+        unordered_set<int> replaced;      // stored one-offs the batch supersedes
+        for (const auto& entry : last) {
+            auto it = locations.find(entry.first);
+            if (it == locations.end()) continue;
+            if (it->second.series) removeSeries(*next, entry.first);
+            else replaced.insert(entry.first);
+            locations.erase(it);
+            --next->size;
+        }
+
+        vector<Event> one_offs;
+        for (const ChunkRef& ref : base.chunks) {
+            for (const Event& event : ref.chunk->events) {
+                if (replaced.empty() || !replaced.count(event.id)) one_offs.push_back(event);
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Event& event = batch[i];
+            if (last[event.id] != i) continue;
+            RecurrenceRule rule;
+            if (seriesRule(event, rule)) {
+                place(*next, move(event));
+                continue;
+            }
+            locations[event.id] = Location{event.start_time, false};
+            ++next->size;
+            one_offs.push_back(move(event));
+        }
+        sort(one_offs.begin(), one_offs.end(),
+             [](const Event& a, const Event& b) { return before(a, b.start_time, b.id); });
+        for (size_t i = 0; i < one_offs.size(); i += CHUNK) {
+            auto chunk = make_shared<Chunk>();
+            size_t end = min(one_offs.size(), i + CHUNK);
+            chunk->events.assign(make_move_iterator(one_offs.begin() + i), make_move_iterator(one_offs.begin() + end));
+            chunk->measure();
+            next->chunks.push_back(ChunkRef{move(chunk), 0, 0});
+        }
+        refresh(*next, 0);
+        publish(next);
+    }
+
+    // Adds every event stored in calendar, snapshot records included.
+    void addAll(const Calendar& calendar) {
+        vector<Event> batch;
+        batch.reserve(calendar.size());
+        for (const Event& event : calendar.allEvents()) batch.push_back(event);
+        for (const RecurringSeries& series : calendar.recurringSeries()) {
+            if (!series.event->isDeleted()) batch.push_back(*series.event);
+        }
+        addAll(move(batch));
+    }
+
+    // Replaces the event with the same id; false if there is none.
+    bool update(const Event& event) {
+        lock_guard<mutex> lock(write_lock);
+        if (!locations.count(event.id)) return false;
+        Version* next = new Version(*current.load(memory_order_relaxed));
+        unplace(*next, event.id);
+        place(*next, event);
+        publish(next);
+        return true;
+    }
+
+    bool remove(int id) {
+        lock_guard<mutex> lock(write_lock);
+        if (!locations.count(id)) return false;
+        Version* next = new Version(*current.load(memory_order_relaxed));
+        unplace(*next, id);
+        publish(next);
+        return true;
+    }
+
+    // Replaced versions freed so far, and those a reader may still hold.
+    void reclamation(uint64_t& freed, size_t& waiting) { epochs.counts(freed, waiting); }
+};
+
+// ==================== Thread Pool ====================
+// Fixed set of worker threads draining one shared FIFO of tasks.
+class ThreadPool {
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex lock;
+    condition_variable available;
+    bool stopping;
+
+    void work() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> guard(lock);
+                available.wait(guard, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t count = thread::hardware_concurrency()) : stopping(false) {
+        count = max<size_t>(1, count);
+        for (size_t i = 0; i < count; ++i) workers.emplace_back([this] { work(); });
+    }
+
+    // Finishes the queued tasks, then joins the workers.
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        available.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    template <typename Task>
+    auto submit(Task task) -> future<decltype(task())> {
+        typedef decltype(task()) Result;
+        auto packaged = make_shared<packaged_task<Result()>>(move(task));
+        future<Result> result = packaged->get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            tasks.emplace_back([packaged] { (*packaged)(); });
+        }
+        available.notify_one();
+        return result;
+    }
+};
+
+// Runs batches of numbered tasks. Each thread owns a deque of task
+// numbers: it takes from the back of its own and, once that is empty,
+// steals from the front of the others', so a few heavy tasks do not leave
+// the rest of the threads idle. The thread calling run() works too.
+class WorkStealingPool {
+private:
+    struct alignas(64) Queue {
+        mutex lock;
+        deque<size_t> tasks;
+    };
+
+    vector<thread> workers;
+    unique_ptr<Queue[]> queues;  // one per worker, then one for the caller of run()
+    mutex run_lock;              // one batch at a time
+    mutex state_lock;
+    condition_variable wake;
+    condition_variable finished;
+    function<void(size_t, size_t)> body;
+    atomic<size_t> remaining;
+    uint64_t generation;
+    bool stopping;
+
+    bool take(size_t self, size_t& task) {
+        {
+            lock_guard<mutex> guard(queues[self].lock);
+            if (!queues[self].tasks.empty()) {
+                task = queues[self].tasks.back();
+                queues[self].tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < threads(); ++i) {
+            Queue& victim = queues[(self + i) % threads()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(size_t self) {
+        size_t task;
+        while (take(self, task)) {
+            body(task, self);
+            if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+                lock_guard<mutex> guard(state_lock);
+                finished.notify_all();
+            }
+        }
+    }
+
+    void work(size_t self) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(state_lock);
+                wake.wait(guard, [this, seen] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            drain(self);
+        }
+    }
+
+public:
+    // count extra threads; 0 runs every batch on the calling thread.
+    explicit WorkStealingPool(size_t count = max(1u, thread::hardware_concurrency()) - 1)
+        : queues(new Queue[count + 1]), remaining(0), generation(0), stopping(false) {
+        for (size_t i = 0; i < count; ++i) workers.emplace_back([this, i] { work(i); });
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(state_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Threads that run tasks, the caller included.
+    size_t threads() const { return workers.size() + 1; }
+
+    // Calls body(task, thread) for every task in [0, count) and returns once
+    // all have finished. thread is below threads() and no two calls with
+    // the same thread overlap, so it can pick per-thread state. Neighbouring
+    // tasks start out on the same thread.
+    void run(size_t count, const function<void(size_t, size_t)>& task_body) {
+        if (count == 0) return;
+        lock_guard<mutex> batch(run_lock);
+        body = task_body;
+        remaining.store(count, memory_order_relaxed);
+        for (size_t q = 0; q < threads(); ++q) {
+            lock_guard<mutex> guard(queues[q].lock);
+            for (size_t task = count * q / threads(); task < count * (q + 1) / threads(); ++task) {
+                queues[q].tasks.push_back(task);
+            }
+        }
+        {
+            lock_guard<mutex> guard(state_lock);
+            ++generation;
+        }
+        wake.notify_all();
+        drain(workers.size());
+        unique_lock<mutex> guard(state_lock);
+        finished.wait(guard, [this] { return remaining.load(memory_order_acquire) == 0; });
+    }
+};
+
+// ==================== Analytics ====================
+// Totals over a period for capacity reports. Event counts include an
+// occurrence once, in the period's first day it touches; hours only count
+// the part inside the period, and all-day events add none.
+struct ReportTotals {
+    size_t events = 0;
+    long long seconds = 0;
+
+    ReportTotals& operator+=(const ReportTotals& other) {
+        events += other.events;
+        seconds += other.seconds;
+        return *this;
+    }
+};
+
+struct CalendarReport {
+    struct AttendeeWeek {
+        string attendee;
+        time_t week;           // local midnight starting the week (Sunday)
+        ReportTotals busy;     // overlapping meetings counted once
+    };
+    struct LocationUse {
+        string location;
+        ReportTotals booked;   // overlapping bookings counted once
+        double utilization;    // booked share of the whole period
+    };
+
+    time_t from = 0;
+    time_t to = 0;  // exclusive
+    size_t occurrences = 0;
+    ReportTotals load[3][8];             // by Priority, then Color
+    vector<AttendeeWeek> attendee_weeks;  // by attendee, then week
+    vector<LocationUse> locations;        // most booked first
+    size_t tasks = 0;
+    size_t threads = 0;
+};
+
+// Builds a CalendarReport by cutting the period into local days, scanning
+// each day as one task on a WorkStealingPool into its thread's partial
+// totals, and merging the partials at the end. Names are compared
+// ignoring ASCII case, and one of their spellings is reported.
+class CalendarAnalytics {
+private:
+    struct FoldedHash {
+        size_t operator()(string_view text) const {
+            size_t hash = 1469598103934665603ULL;
+            for (unsigned char c : text) hash = (hash ^ static_cast<size_t>(tolower(c))) * 1099511628211ULL;
+            return hash;
+        }
+    };
+
+    struct FoldedEqual {
+        bool operator()(string_view a, string_view b) const {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); ++i) {
+                if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) return false;
+            }
+            return true;
+        }
+    };
+
+    struct WeekTextHash {
+        size_t operator()(const pair<string_view, long>& key) const {
+            return FoldedHash()(key.first) ^ (static_cast<size_t>(key.second) * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    struct WeekTextEqual {
+        bool operator()(const pair<string_view, long>& a, const pair<string_view, long>& b) const {
+            return a.second == b.second && FoldedEqual()(a.first, b.first);
+        }
+    };
+
+    static int foldedCompare(string_view a, string_view b) {
+        size_t n = min(a.size(), b.size());
+        for (size_t i = 0; i < n; ++i) {
+            int ca = tolower(static_cast<unsigned char>(a[i]));
+            int cb = tolower(static_cast<unsigned char>(b[i]));
+            if (ca != cb) return ca < cb ? -1 : 1;
+        }
+        return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+    }
+
+    // Time someone or something is booked within one day; key is a name
+    // id of the thread's Partial.
+    struct Span {
+        uint32_t key;
+        bool counted;
+        time_t start;
+        time_t end;
+    };
+
+    struct WeekKey {
+        uint32_t attendee;
+        long week;
+
+        bool operator==(const WeekKey& other) const { return attendee == other.attendee && week == other.week; }
+    };
+
+    struct WeekHash {
+        size_t operator()(const WeekKey& key) const {
+            return (static_cast<size_t>(key.attendee) << 32) ^ static_cast<size_t>(key.week);
+        }
+    };
+
+    // One thread's totals. Names are numbered as the thread meets them, so
+    // the day scans sort and count by integer; they point into the
+    // calendar's strings, which outlive the run.
+    struct alignas(64) Partial {
+        size_t occurrences = 0;
+        ReportTotals load[3][8];
+        unordered_map<string_view, uint32_t, FoldedHash, FoldedEqual> ids;
+        vector<string_view> names;
+        unordered_map<WeekKey, ReportTotals, WeekHash> weeks;
+        vector<ReportTotals> locations;  // by name id
+        vector<Span> people;             // scratch for the day being scanned
+        vector<Span> places;
+
+        uint32_t idOf(string_view name) {
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+            ids.emplace(name, static_cast<uint32_t>(names.size()));
+            names.push_back(name);
+            return static_cast<uint32_t>(names.size() - 1);
+        }
+    };
+
+    // Sorts spans by key and time, then hands add() each key's union.
+    template <typename Add>
+    static void addUnions(vector<Span>& spans, Add add) {
+        sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+            return a.key != b.key ? a.key < b.key : a.start < b.start;
+        });
+        for (size_t i = 0; i < spans.size();) {
+            ReportTotals totals;
+            time_t covered_until = numeric_limits<time_t>::min();
+            size_t j = i;
+            for (; j < spans.size() && spans[j].key == spans[i].key; ++j) {
+                totals.events += spans[j].counted;
+                time_t start = max(spans[j].start, covered_until);
+                if (spans[j].end > start) totals.seconds += spans[j].end - start;
+                covered_until = max(covered_until, spans[j].end);
+            }
+            add(spans[i].key, totals);
+            i = j;
+        }
+        spans.clear();
+    }
+
+    static void scanDay(const Calendar& calendar, long day, time_t from, time_t to, Partial& partial) {
+        time_t lo = max(from, localDayStart(day));
+        time_t hi = min(to, localDayStart(day + 1));
+        if (hi <= lo) return;
+        calendar.scanOccurrences(lo, hi - 1, [&](const OccurrenceFacts& o) {
+            bool counted = o.start_time >= lo || (lo == from && o.end_time > lo);
+            time_t start = max(o.start_time, lo);
+            time_t end = o.all_day ? start : max(start, min(o.end_time, hi));
+            if (!counted && end == start) return;  // only touches the day's edge
+            ReportTotals& load = partial.load[min(static_cast<int>(o.priority), 2)][min(static_cast<int>(o.color), 7)];
+            load.events += counted;
+            load.seconds += end - start;
+            partial.occurrences += counted;
+            if (!o.location.empty()) partial.places.push_back(Span{partial.idOf(o.location), counted, start, end});
+            size_t first = partial.people.size();
+            o.forEachAttendee([&](string_view name) {
+                if (name.empty()) return;
+                uint32_t id = partial.idOf(name);
+                for (size_t i = first; i < partial.people.size(); ++i) {
+                    if (partial.people[i].key == id) return;
+                }
+                partial.people.push_back(Span{id, counted, start, end});
+            });
+        });
+        long week = day - weekdayFromDays(day);
+        addUnions(partial.people, [&](uint32_t name, const ReportTotals& totals) {
+            partial.weeks[WeekKey{name, week}] += totals;
+        });
+        addUnions(partial.places, [&](uint32_t place, const ReportTotals& totals) {
+            if (partial.locations.size() <= place) partial.locations.resize(partial.names.size());
+            partial.locations[place] += totals;
+        });
+    }
+
+public:
+    // Scans [from, to) with the pool's threads. The calendar must not be
+    // modified until this returns.
+    static CalendarReport run(const Calendar& calendar, time_t from, time_t to, WorkStealingPool& pool) {
+        CalendarReport report;
+        report.from = from;
+        report.to = to;
+        report.threads = pool.threads();
+        if (to <= from) return report;
+        long first_day = localDayNumber(from);
+        report.tasks = static_cast<size_t>(localDayNumber(to - 1) - first_day + 1);
+
+        vector<Partial> partials(pool.threads());
+        pool.run(report.tasks, [&](size_t task, size_t thread) {
+            scanDay(calendar, first_day + static_cast<long>(task), from, to, partials[thread]);
+        });
+
+        // The partials number names differently; key the totals by text.
+        unordered_map<pair<string_view, long>, ReportTotals, WeekTextHash, WeekTextEqual> weeks;
+        unordered_map<string_view, ReportTotals, FoldedHash, FoldedEqual> locations;
+        for (const Partial& partial : partials) {
+            report.occurrences += partial.occurrences;
+            for (int p = 0; p < 3; ++p) {
+                for (int c = 0; c < 8; ++c) report.load[p][c] += partial.load[p][c];
+            }
+            for (const auto& entry : partial.weeks) {
+                weeks[make_pair(partial.names[entry.first.attendee], entry.first.week)] += entry.second;
+            }
+            for (size_t id = 0; id < partial.locations.size(); ++id) {
+                const ReportTotals& totals = partial.locations[id];
+                if (totals.events > 0 || totals.seconds > 0) locations[partial.names[id]] += totals;
+            }
+        }
+
+        for (const auto& entry : weeks) {
+            report.attendee_weeks.push_back(CalendarReport::AttendeeWeek{
+                string(entry.first.first), localDayStart(entry.first.second), entry.second});
+        }
+        sort(report.attendee_weeks.begin(), report.attendee_weeks.end(),
+             [](const CalendarReport::AttendeeWeek& a, const CalendarReport::AttendeeWeek& b) {
+                 int order = foldedCompare(a.attendee, b.attendee);
+                 return order != 0 ? order < 0 : a.week < b.week;
+             });
+        double period = static_cast<double>(to - from);
+        for (const auto& entry : locations) {
+            report.locations.push_back(CalendarReport::LocationUse{
+                string(entry.first), entry.second, entry.second.seconds / period});
+        }
+        sort(report.locations.begin(), report.locations.end(),
+             [](const CalendarReport::LocationUse& a, const CalendarReport::LocationUse& b) {
+                 if (a.booked.seconds != b.booked.seconds) return a.booked.seconds > b.booked.seconds;
+                 return foldedCompare(a.location, b.location) < 0;
+             });
+        return report;
+    }
+
+    static CalendarReport run(const Calendar& calendar, time_t from, time_t to) {
+        WorkStealingPool pool;
+        return run(calendar, from, to, pool);
+    }
+};
+
+// ==================== iCalendar Import/Export ====================
+// RFC 5545 .ics files. The reader streams the file in large chunks, cuts
+// each chunk before its last BEGIN:VEVENT so no event straddles two, parses
+// the chunks on a thread pool and feeds the results to the bulk insert path
+// in file order. The writer streams one VEVENT at a time.
+
+// An event as parsed by a worker thread. Workers never construct Events
+// themselves, since the constructor hands out ids from a shared counter.
+struct IcsEvent {
+    string title;
+    string description;
+    string location;
+    vector<string> attendees;
+    time_t start_time;
+    time_t end_time;
+    long start_day;   // local day number of an all-day start
+    long duration;    // seconds from DURATION, or -1
+    bool has_start;
+    bool has_end;
+    bool is_all_day;
+    Color color;
+    Priority priority;
+    string recurrence_pattern;  // without until/except, which need local days
+    time_t until;               // RRULE UNTIL, or 0
+    vector<time_t> exceptions;  // EXDATE instants
+
+    IcsEvent()
+        : start_time(0), end_time(0), start_day(0), duration(-1), has_start(false), has_end(false),
+          is_all_day(false), color(Color::DEFAULT), priority(Priority::MEDIUM), until(0) {}
+
+
+    Event toEvent() const {
+        time_t end = end_time;
+        if (!has_end) {
+            if (duration >= 0) end = start_time + duration;
+            else end = is_all_day ? localDayStart(start_day + 1) : start_time;
+        }
+        string pattern = recurrence_pattern;
+        if (!pattern.empty() && until != 0) pattern += ";until=" + dateToString(until);
+        if (!pattern.empty() && !exceptions.empty()) {
+            pattern += ";except=";
+            for (size_t i = 0; i < exceptions.size(); ++i) pattern += (i ? "," : "") + dateToString(exceptions[i]);
+        }
+        return Event(title, start_time, max(start_time, end), color, priority, description, location,
+                     internAll(attendees), is_all_day, !pattern.empty(), pattern);
+    }
+};
+
+class IcsReader {
+private:
+    static const size_t CHUNK_SIZE = 4 << 20;
+
+    static string unescape(const string& text) {
+        string result;
+        result.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] != '\\' || i + 1 == text.size()) {
+                result += text[i];
+                continue;
+            }
+            char next = text[++i];
+            result += (next == 'n' || next == 'N') ? '\n' : next;
+        }
+        return result;
+    }
+
+    static bool digits(const string& text, size_t at, size_t count, int& value) {
+        if (text.size() < at + count) return false;
+        value = 0;
+        for (size_t i = at; i < at + count; ++i) {
+            if (!isdigit(static_cast<unsigned char>(text[i]))) return false;
+            value = value * 10 + (text[i] - '0');
+        }
+        return true;
+    }
+
+    // DATE or DATE-TIME value. Times ending in Z are UTC; floating times and
+    // times with a TZID are taken as local time. is_date reports a DATE
+    // value, whose local day number lands in day.
+    static bool parseTime(const string& text, bool date_only, time_t& result, bool& is_date, long& day) {
+        int year, month, mday, hour = 0, minute = 0, second = 0;
+        if (!digits(text, 0, 4, year) || !digits(text, 4, 2, month) || !digits(text, 6, 2, mday)) return false;
+        if (month < 1 || month > 12 || mday < 1 || mday > 31) return false;
+        is_date = date_only || text.size() < 15;
+        if (is_date) {
+            day = daysFromCivil(year, month, mday);
+            result = localDayStart(day);
+            return true;
+        }
+        if (!digits(text, 9, 2, hour) || !digits(text, 11, 2, minute) || !digits(text, 13, 2, second)) return false;
+        if (text.size() > 15 && text[15] == 'Z') {
+            result = static_cast<time_t>(daysFromCivil(year, month, mday)) * 86400 + hour * 3600 + minute * 60 + second;
+        } else {
+            result = localTimeFromCivil(year, month, mday, hour, minute, second);
+        }
+        return true;
+    }
+
+    // [+/-]P[nW][nD][T[nH][nM][nS]]
+    static long parseDuration(const string& text) {
+        long total = 0, value = 0;
+        bool negative = !text.empty() && text[0] == '-';
+        for (char c : text) {
+            if (isdigit(static_cast<unsigned char>(c))) {
+                value = value * 10 + (c - '0');
+                continue;
+            }
+            switch (c) {
+                case 'W': total += value * 604800; break;
+                case 'D': total += value * 86400; break;
+                case 'H': total += value * 3600; break;
+                case 'M': total += value * 60; break;
+                case 'S': total += value; break;
+                default: break;
+            }
+            value = 0;
+        }
+        return negative ? -total : total;
+    }
+
+    // Maps an RRULE onto the calendar's own pattern syntax. YEARLY becomes
+    // a 12-month interval; BY* parts have no counterpart and are dropped.
+    static string recurrencePattern(const string& rule, time_t& until) {
+        string frequency;
+        int interval = 1;
+        string extra;
+        stringstream ss(rule);
+        string part;
+        while (getline(ss, part, ';')) {
+            size_t eq = part.find('=');
+            if (eq == string::npos) continue;
+            string key = part.substr(0, eq);
+            string value = part.substr(eq + 1);
+            if (key == "FREQ") {
+                frequency = value;
+            } else if (key == "INTERVAL") {
+                interval = max(1, safeStoi(value, 1));
+            } else if (key == "COUNT") {
+                extra += ";count=" + value;
+            } else if (key == "UNTIL") {
+                bool is_date;
+                long day;
+                if (!parseTime(value, false, until, is_date, day)) until = 0;
+            }
+        }
+        string name;
+        if (frequency == "DAILY") name = "Daily";
+        else if (frequency == "WEEKLY") name = "Weekly";
+        else if (frequency == "MONTHLY") name = "Monthly";
+        else if (frequency == "YEARLY") {
+            name = "Monthly";
+            interval *= 12;
+        } else {
+            return "";
+        }
+        if (interval > 1) name += ";interval=" + to_string(interval);
+        return name + extra;
+    }
+
+    static Color parseColor(const string& value) {
+        string name = toLower(value);
+        for (Color color : {Color::RED, Color::BLUE, Color::GREEN, Color::YELLOW,
+                            Color::PURPLE, Color::ORANGE, Color::GRAY}) {
+            if (name == toLower(toString(color))) return color;
+        }
+        return Color::DEFAULT;
+    }
+
+    // Applies one unfolded content line, NAME;PARAM=VALUE;...:VALUE.
+    static void property(const string& line, IcsEvent& event) {
+        size_t colon = string::npos;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '"') quoted = !quoted;
+            else if (line[i] == ':' && !quoted) {
+                colon = i;
+                break;
+            }
+        }
+        if (colon == string::npos) return;
+        size_t name_end = min(colon, line.find(';'));
+        string name = line.substr(0, name_end);
+        for (char& c : name) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        string params = line.substr(name_end, colon - name_end);
+        string value = line.substr(colon + 1);
+
+        if (name == "SUMMARY") {
+            event.title = unescape(value);
+        } else if (name == "DESCRIPTION") {
+            event.description = unescape(value);
+        } else if (name == "LOCATION") {
+            event.location = unescape(value);
+        } else if (name == "DTSTART") {
+            bool date_only = params.find("VALUE=DATE") != string::npos && params.find("VALUE=DATE-TIME") == string::npos;
+            event.has_start = parseTime(value, date_only, event.start_time, event.is_all_day, event.start_day);
+        } else if (name == "DTEND") {
+            bool is_date;
+            long day;
+            event.has_end = parseTime(value, false, event.end_time, is_date, day);
+        } else if (name == "DURATION") {
+            event.duration = parseDuration(value);
+        } else if (name == "ATTENDEE") {
+            // Prefer the display name; fall back to the address.
+            size_t cn = params.find("CN=");
+            string attendee;
+            if (cn != string::npos) {
+                size_t start = cn + 3, stop;
+                if (start < params.size() && params[start] == '"') {
+                    stop = params.find('"', ++start);
+                } else {
+                    stop = params.find(';', start);
+                }
+                attendee = params.substr(start, stop == string::npos ? string::npos : stop - start);
+            } else {
+                attendee = value.compare(0, 7, "mailto:") == 0 || value.compare(0, 7, "MAILTO:") == 0
+                    ? value.substr(7) : value;
+            }
+            if (!attendee.empty()) event.attendees.push_back(attendee);
+        } else if (name == "RRULE") {
+            event.recurrence_pattern = recurrencePattern(value, event.until);
+        } else if (name == "EXDATE") {
+            stringstream dates(value);
+            string date;
+            bool is_date;
+            long day;
+            time_t skipped;
+            while (getline(dates, date, ',')) {
+                if (parseTime(date, false, skipped, is_date, day)) event.exceptions.push_back(skipped);
+            }
+        } else if (name == "PRIORITY") {
+            int level = safeStoi(value, 0);
+            if (level >= 1 && level <= 4) event.priority = Priority::HIGH;
+            else if (level >= 6) event.priority = Priority::LOW;
+        } else if (name == "COLOR") {
+            event.color = parseColor(value);
+        }
+    }
+
+public:
+    // Parses every VEVENT in a block of text; anything outside them, and
+    // nested components such as VALARM, is skipped.
+    static vector<IcsEvent> parse(const string& text) {
+        vector<IcsEvent> result;
+        IcsEvent current;
+        bool in_event = false;
+        int nested = 0;
+        string line;
+
+        auto finish = [&](const string& logical) {
+            if (logical.compare(0, 6, "BEGIN:") == 0) {
+                if (logical == "BEGIN:VEVENT") {
+                    current = IcsEvent();
+                    in_event = true;
+                    nested = 0;
+                } else if (in_event) {
+                    ++nested;
+                }
+            } else if (logical.compare(0, 4, "END:") == 0) {
+                if (logical == "END:VEVENT" && in_event) {
+                    if (current.has_start) result.push_back(move(current));
+                    in_event = false;
+                } else if (nested > 0) {
+                    --nested;
+                }
+            } else if (in_event && nested == 0) {
+                property(logical, current);
+            }
+        };
+
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t eol = text.find('\n', pos);
+            if (eol == string::npos) eol = text.size();
+            size_t stop = (eol > pos && text[eol - 1] == '\r') ? eol - 1 : eol;
+            if (stop > pos && (text[pos] == ' ' || text[pos] == '\t')) {
+                line.append(text, pos + 1, stop - pos - 1);  // folded continuation
+            } else {
+                if (!line.empty()) finish(line);
+                line.assign(text, pos, stop - pos);
+            }
+            pos = eol + 1;
+        }
+        if (!line.empty()) finish(line);
+        return result;
+    }
+
+    // Imports every VEVENT of the file at path into the calendar. span, if
+    // given, receives the times the imported events cover (first
+    // occurrences only, for series).
+    static bool import(const string& path, Calendar& calendar, size_t& imported, string& error,
+                       TimeBlock* span = nullptr) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        imported = 0;
+        if (span) *span = TimeBlock{numeric_limits<time_t>::max(), numeric_limits<time_t>::min()};
+        ThreadPool pool;
+        deque<future<vector<IcsEvent>>> pending;
+        size_t max_pending = pool.size() * 2;  // bounds the memory held by parsed chunks
+
+        auto drain = [&]() {
+            vector<IcsEvent> parsed = pending.front().get();
+            pending.pop_front();
+            vector<Event> batch;
+            batch.reserve(parsed.size());
+            for (const IcsEvent& event : parsed) batch.push_back(event.toEvent());
+            if (span) {
+                for (const Event& event : batch) {
+                    span->start = min(span->start, event.start_time);
+                    span->end = max(span->end, event.end_time);
+                }
+            }
+            imported += batch.size();
+            calendar.addEvents(move(batch));
+        };
+        auto dispatch = [&](string text) {
+            pending.push_back(pool.submit([text]() { return parse(text); }));
+            if (pending.size() >= max_pending) drain();
+        };
+
+        vector<char> chunk(CHUNK_SIZE);
+        string carry;
+        while (in) {
+            in.read(chunk.data(), static_cast<streamsize>(chunk.size()));
+            size_t got = static_cast<size_t>(in.gcount());
+            if (got == 0) break;
+            carry.append(chunk.data(), got);
+            // Everything before the last BEGIN:VEVENT holds whole events only.
+            size_t cut = carry.rfind("\nBEGIN:VEVENT");
+            if (cut == string::npos || cut == 0) continue;
+            string rest = carry.substr(cut + 1);
+            carry.resize(cut + 1);
+            dispatch(move(carry));
+            carry = move(rest);
+        }
+        if (!carry.empty()) dispatch(move(carry));
+        while (!pending.empty()) drain();
+        return true;
+    }
+};
+
+class IcsWriter {
+private:
+    static string escape(const string& text) {
+        string result;
+        result.reserve(text.size());
+        for (char c : text) {
+            if (c == '\n') {
+                result += "\\n";
+                continue;
+            }
+            if (c == '\\' || c == ';' || c == ',') result += '\\';
+            result += c;
+        }
+        return result;
+    }
+
+    // Appends a content line folded at 75 octets, never inside a UTF-8
+    // sequence.
+    static void line(string& out, const string& content) {
+        size_t pos = 0, limit = 75;
+        while (content.size() - pos > limit) {
+            size_t cut = pos + limit;
+            while (cut > pos + 1 && (static_cast<unsigned char>(content[cut]) & 0xC0) == 0x80) --cut;
+            out.append(content, pos, cut - pos);
+            out += "\r\n ";
+            pos = cut;
+            limit = 74;
+        }
+        out.append(content, pos, string::npos);
+        out += "\r\n";
+    }
+
+    static string utcStamp(time_t t) {
+        long days = static_cast<long>(t / 86400);
+        long seconds = static_cast<long>(t % 86400);
+        if (seconds < 0) {
+            seconds += 86400;
+            --days;
+        }
+        int year, month, day;
+        civilFromDays(days, year, month, day);
+        char buffer[20];
+        snprintf(buffer, sizeof(buffer), "%04d%02d%02dT%02ld%02ld%02ldZ", year, month, day,
+                 seconds / 3600, seconds / 60 % 60, seconds % 60);
+        return buffer;
+    }
+
+    static string dayStamp(long day_number) {
+        int year, month, day;
+        civilFromDays(day_number, year, month, day);
+        char buffer[12];
+        snprintf(buffer, sizeof(buffer), "%04d%02d%02d", year, month, day);
+        return buffer;
+    }
+
+    static void recurrence(string& out, const Event& event, const RecurrenceRule& rule) {
+        static const char* FREQUENCIES[] = {"", "DAILY", "WEEKLY", "MONTHLY"};
+        string rrule = string("RRULE:FREQ=") + FREQUENCIES[static_cast<int>(rule.frequency)];
+        if (rule.interval > 1) rrule += ";INTERVAL=" + to_string(rule.interval);
+        if (rule.count > 0) rrule += ";COUNT=" + to_string(rule.count);
+        if (rule.until_day != numeric_limits<long>::max()) {
+            rrule += ";UNTIL=" + (event.is_all_day ? dayStamp(rule.until_day)
+                                                   : utcStamp(localDayStart(rule.until_day + 1) - 1));
+        }
+        line(out, rrule);
+        if (rule.exceptions.empty()) return;
+
+        CivilTime first = localCivil(event.start_time);
+        string exdate = event.is_all_day ? "EXDATE;VALUE=DATE:" : "EXDATE:";
+        for (size_t i = 0; i < rule.exceptions.size(); ++i) {
+            if (i) exdate += ',';
+            if (event.is_all_day) {
+                exdate += dayStamp(rule.exceptions[i]);
+            } else {
+                int year, month, day;
+                civilFromDays(rule.exceptions[i], year, month, day);
+                exdate += utcStamp(localTimeFromCivil(year, month, day, first.hour, first.minute, first.second));
+            }
+        }
+        line(out, exdate);
+    }
+
+    static void vevent(string& out, const Event& event, const RecurrenceRule* rule, const string& stamp) {
+        line(out, "BEGIN:VEVENT");
+        line(out, "UID:" + to_string(event.id) + "@dsa-calendar");
+        line(out, "DTSTAMP:" + stamp);
+        if (event.is_all_day) {
+            long first = localDayNumber(event.start_time);
+            long last = localDayNumber(max(event.start_time, event.end_time - 1));
+            line(out, "DTSTART;VALUE=DATE:" + dayStamp(first));
+            line(out, "DTEND;VALUE=DATE:" + dayStamp(last + 1));
+        } else {
+            line(out, "DTSTART:" + utcStamp(event.start_time));
+            line(out, "DTEND:" + utcStamp(event.end_time));
+        }
+        line(out, "SUMMARY:" + escape(event.title));
+        if (!event.description.empty()) line(out, "DESCRIPTION:" + escape(event.description));
+        if (!event.location.empty()) line(out, "LOCATION:" + escape(event.location));
+        for (const string& attendee : event.attendees) {
+            // Attendees without an address use the conventional "invalid:nomail".
+            if (attendee.find('@') != string::npos && attendee.find_first_of("\";:,") == string::npos) {
+                line(out, "ATTENDEE:mailto:" + attendee);
+            } else {
+                string name = attendee;
+                name.erase(remove(name.begin(), name.end(), '"'), name.end());
+                line(out, "ATTENDEE;CN=\"" + name + "\":invalid:nomail");
+            }
+        }
+        line(out, "PRIORITY:" + string(event.priority == Priority::HIGH ? "1" :
+                                       event.priority == Priority::LOW ? "9" : "5"));
+        if (event.color != Color::DEFAULT) line(out, "COLOR:" + toLower(toString(event.color)));
+        if (rule) recurrence(out, event, *rule);
+        line(out, "END:VEVENT");
+    }
+
+    // Streams one-off events from the view, then the series the predicate
+    // accepts. Each VEVENT is formatted into a reused buffer and written
+    // on its own, so memory stays flat however large the export is.
+    template <typename OneOffs, typename SeriesFilter>
+    static size_t write(ostream& out, const Calendar& calendar, const OneOffs& one_offs, SeriesFilter accept) {
+        string stamp = utcStamp(time(nullptr));
+        string buffer;
+        line(buffer, "BEGIN:VCALENDAR");
+        line(buffer, "VERSION:2.0");
+        line(buffer, "PRODID:-//DSA Project//Calendar//EN");
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+
+        size_t written = 0;
+        for (const Event& event : one_offs) {
+            buffer.clear();
+            vevent(buffer, event, nullptr, stamp);
+            out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+            ++written;
+        }
+        for (const RecurringSeries& series : calendar.recurringSeries()) {
+            if (series.event->isDeleted() || !accept(series)) continue;
+            buffer.clear();
+            vevent(buffer, *series.event, &series.rule, stamp);
+            out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+            ++written;
+        }
+
+        buffer.clear();
+        line(buffer, "END:VCALENDAR");
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        return written;
+    }
+
+public:
+    // Every event in the calendar.
+    static size_t writeAll(ostream& out, const Calendar& calendar) {
+        return write(out, calendar, calendar.allEvents(), [](const RecurringSeries&) { return true; });
+    }
+
+    // Events overlapping [lo, hi]; a recurring event is written whole, with
+    // its rule, when any occurrence falls in the range.
+    static size_t writeRange(ostream& out, const Calendar& calendar, time_t lo, time_t hi) {
+        return write(out, calendar, calendar.oneOffsBetween(lo, hi), [lo, hi](const RecurringSeries& series) {
+            return OccurrenceCursor(series.event, &series.rule, lo, hi, false).valid();
+        });
+    }
+
+    static bool exportFile(const string& path, const Calendar& calendar, time_t lo, time_t hi, bool everything,
+                           size_t& written, string& error) {
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) {
+            error = "cannot create " + path;
+            return false;
+        }
+        written = everything ? writeAll(out, calendar) : writeRange(out, calendar, lo, hi);
+        out.flush();
+        if (!out) {
+            error = "write to " + path + " failed";
+            return false;
+        }
+        return true;
+    }
+};
+
+// ==================== Persistence ====================
+// A snapshot plus the journal of everything changed since it was written.
+// Mutations reach disk through the journal as they happen; once it grows
+// past a threshold it is folded into a fresh snapshot, written by a
+// background thread from a SnapshotImage of the calendar, so the UI never
+// waits. Taking the image copies only the events held in memory.
+class CalendarStore {
+private:
+    string snapshot_path;
+    string journal_path;
+    Journal journal;
+    uint64_t compact_threshold;  // journal bytes that trigger a compaction
+    thread compactor;            // background snapshot writer, if joinable
+    atomic<bool> compactor_done;
+    bool compactor_ok;           // these two are only read after the join
+    string compactor_error;
+    uint64_t compact_covered;    // journal bytes its snapshot contains
+    uint64_t command_start;      // journal size when the current command began
+
+    bool hasRecords() const { return journal.size() > sizeof(JOURNAL_MAGIC); }
+
+    // Collects a background compaction that has finished, or waits for
+    // it, dropping the journal prefix it covered if it succeeded.
+    bool reapCompactor(bool wait, string& error) {
+        if (!compactor.joinable()) return true;
+        if (!wait && !compactor_done.load(memory_order_acquire)) return true;
+        compactor.join();
+        if (!compactor_ok) {
+            error = "background snapshot failed: " + compactor_error;
+            return false;
+        }
+        return journal.dropPrefix(compact_covered, error);
+    }
+
+public:
+    CalendarStore(const string& snapshot_path, const Journal::Options& options = Journal::Options{1, 1},
+                  uint64_t compact_threshold = 4u << 20)
+        : snapshot_path(snapshot_path), journal_path(snapshot_path + ".journal"),
+          compact_threshold(compact_threshold), compactor_done(false), compactor_ok(true), compact_covered(0),
+          command_start(0) {
+        journal.setOptions(options);
+    }
+
+    ~CalendarStore() {
+        string error;
+        reapCompactor(true, error);
+    }
+
+    bool isOpen() const { return journal.isOpen(); }
+    const string& path() const { return snapshot_path; }
+    void setJournalOptions(const Journal::Options& options) { journal.setOptions(options); }
+
+    // Loads the snapshot, replays the journal over it and starts journaling
+    // the calendar's mutations. On failure nothing is attached, so the
+    // files on disk are left alone.
+    bool open(Calendar& calendar, size_t& replayed, string& error) {
+        replayed = 0;
+        ifstream probe(snapshot_path);
+        if (probe && !calendar.openSnapshot(snapshot_path, error)) return false;
+        uint64_t valid_length = 0;
+        if (!calendar.replayJournal(journal_path, valid_length, replayed, error)) return false;
+        if (!journal.open(journal_path, valid_length, error)) return false;
+        calendar.attachJournal(&journal);
+        return true;
+    }
+
+    // Writes a snapshot in the foreground and empties the journal.
+    bool compact(const Calendar& calendar, string& error) {
+        if (!isOpen()) return false;
+        reapCompactor(true, error);
+        string unwritten;
+        journal.sync(unwritten);  // the snapshot covers anything that failed to write
+        uint64_t covered = journal.size();
+        if (!calendar.saveSnapshot(snapshot_path, error)) return false;
+        bool ok = journal.dropPrefix(covered, error);
+        command_start = journal.size();  // the snapshot now holds the command so far
+        return ok;
+    }
+
+    // Brackets one command whose records are written together: commit()
+    // writes whatever the command journaled, or, if that fails, takes all
+    // of it back off the journal, so that the caller can undo the command
+    // and report it as not done. Fsyncs still follow the journal options.
+    void beginCommand() { command_start = journal.size(); }
+
+    bool commit(string& error) {
+        if (!isOpen() || journal.flush(error)) return true;
+        string ignored;
+        journal.discardFrom(command_start, ignored);
+        return false;
+    }
+
+    // Called between commands: writes buffered records, finishes a
+    // background compaction that has ended and starts a new one once the
+    // journal has outgrown the threshold. False if buffered records could
+    // not be written or a compaction failed.
+    bool maintain(const Calendar& calendar, string& error) {
+        if (!isOpen()) return true;
+        if (!journal.flush(error)) return false;
+        if (!reapCompactor(false, error)) return false;
+        if (compactor.joinable() || journal.size() < compact_threshold) return true;
+        if (!journal.sync(error)) return false;
+        compact_covered = journal.size();
+        compactor_done.store(false, memory_order_relaxed);
+        try {
+            compactor = thread([this, image = calendar.snapshotImage()]() {
+                compactor_error.clear();
+                compactor_ok = image.write(snapshot_path, compactor_error);
+                compactor_done.store(true, memory_order_release);
+            });
+        } catch (const system_error&) {
+            return compact(calendar, error);  // no thread to spare: write it here
+        }
+        return true;
+    }
+
+    // Final compaction on exit so the next start has nothing to replay.
+    bool close(Calendar& calendar, string& error) {
+        if (!isOpen()) return false;
+        bool ok = !hasRecords() || compact(calendar, error);
+        calendar.attachJournal(nullptr);
+        journal.close();
+        return ok;
+    }
+};
+
+// ==================== Calendar Set ====================
+// The calendars open in one session, such as personal, team and rooms,
+// each with its own indexes and store. Views overlay the visible ones by
+// merging their per-calendar views lazily, so showing or hiding one only
+// flips a flag. Changes go to the active calendar.
+class CalendarSet {
+public:
+    struct Entry {
+        unique_ptr<Calendar> calendar;
+        unique_ptr<CalendarStore> store;
+        bool visible;
+    };
+
+private:
+    vector<Entry> entries;
+    size_t active_index;
+
+    template <typename View, typename MakeView>
+    OverlayView<View> overlay(MakeView make) const {
+        pmr::vector<View> views(ScratchArena::resource());
+        views.reserve(entries.size());
+        for (const Entry& entry : entries) {
+            if (entry.visible) views.push_back(make(*entry.calendar));
+        }
+        return OverlayView<View>(move(views));
+    }
+
+public:
+    CalendarSet() : active_index(0) {}
+
+    // Opens the calendar stored at snapshot_path, named after the file.
+    // message says what was loaded or what went wrong. A calendar that
+    // fails to load is still added, but its changes are not saved; one
+    // that is already open is not added again.
+    bool open(const string& snapshot_path, string& message) {
+        message.clear();
+        for (const Entry& entry : entries) {
+            if (entry.store->path() == snapshot_path) {
+                message = snapshot_path + " is already open";
+                return false;
+            }
+        }
+        string name = snapshot_path.substr(snapshot_path.find_last_of("/\\") + 1);  // npos + 1 == 0
+        size_t dot = name.find('.');
+        if (dot != string::npos && dot > 0) name.resize(dot);
+
+        Entry entry{make_unique<Calendar>(name), make_unique<CalendarStore>(snapshot_path), true};
+        size_t replayed = 0;
+        string error;
+        bool ok = entry.store->open(*entry.calendar, replayed, error);
+        if (!ok) {
+            message = "Could not load " + snapshot_path + ": " + error + " (changes will not be saved)";
+        } else if (entry.calendar->size() > 0) {
+            message = "Loaded " + to_string(entry.calendar->size()) + " events from " + snapshot_path;
+            if (replayed > 0) message += " (" + to_string(replayed) + " journaled changes recovered)";
+        }
+        entries.push_back(move(entry));
+        return ok;
+    }
+
+    size_t size() const { return entries.size(); }
+    Entry& entry(size_t index) { return entries[index]; }
+    const Entry& entry(size_t index) const { return entries[index]; }
+    size_t activeIndex() const { return active_index; }
+    Calendar& active() { return *entries[active_index].calendar; }
+    const Calendar& active() const { return *entries[active_index].calendar; }
+    CalendarStore& activeStore() { return *entries[active_index].store; }
+
+    void setActive(size_t index) {
+        if (index < entries.size()) active_index = index;
+    }
+    void setVisible(size_t index, bool visible) {
+        if (index < entries.size()) entries[index].visible = visible;
+    }
+
+    size_t visibleCount() const {
+        size_t count = 0;
+        for (const Entry& entry : entries) count += entry.visible;
+        return count;
+    }
+
+    // Indexes of the calendars holding an event with this id. Snapshots
+    // made apart from each other can reuse ids, so there may be several.
+    vector<size_t> owners(int id) const {
+        vector<size_t> found;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].calendar->findEvent(id)) found.push_back(i);
+        }
+        return found;
+    }
+
+    // Everything touching the local day, across the visible calendars.
+    OverlayView<DayView> eventsOnDay(time_t day) const {
+        return overlay<DayView>([day](const Calendar& calendar) { return calendar.eventsOnDay(day); });
+    }
+
+    // Occurrences overlapping [start, end], across the visible calendars.
+    OverlayView<RangeView> eventsBetween(time_t start, time_t end) const {
+        return overlay<RangeView>([start, end](const Calendar& calendar) {
+            return calendar.eventsBetween(start, end);
+        });
+    }
+
+    void displayDay(time_t day) const { Calendar::displayDay(*this, day); }
+    void displayWeek(time_t reference_day, const WeekGridOptions& options) const {
+        Calendar::displayWeek(*this, reference_day, options);
+    }
+    void displayMonth(time_t current_date) const { Calendar::displayMonth(*this, current_date); }
+    void displayYear(time_t current_date) const { Calendar::displayYear(*this, current_date); }
+    void displayAgenda(time_t start, time_t end) const { Calendar::displayAgenda(*this, start, end); }
+
+    // Between commands: compacts each calendar and maintains its store.
+    // Returns false with the first failure, naming its calendar, in error.
+    bool maintain(string& error) {
+        bool ok = true;
+        for (Entry& entry : entries) {
+            string failure;
+            entry.calendar->compactIfNeeded();
+            if (entry.calendar->takeJournalError(failure) || !entry.store->maintain(*entry.calendar, failure)) {
+                if (ok) error = entry.calendar->getName() + ": " + failure;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+};
+
+// ==================== Calendar UI Class ====================
+class CalendarUI {
+private:
+    CalendarSet calendars;
+    time_t current_date;
+    WeekGridOptions week_options;
+    string status;
+
+    time_t promptDate(const string& prompt, bool include_time = true) {
+        while (true) {
+            string format = include_time ? "YYYY-MM-DD HH:MM" : "YYYY-MM-DD";
+            string input = getInput(prompt + " (" + format + "): ");
+            time_t t = stringToTime(input, include_time ? "%Y-%m-%d %H:%M" : "%Y-%m-%d");
+            if (t != 0) return t;
+            cout << "Invalid format. Please try again.\n";
+        }
+    }
+
+    Color promptColor() {
+        map<string, Color> color_map = {
+            {"red", Color::RED}, {"blue", Color::BLUE}, {"green", Color::GREEN},
+            {"yellow", Color::YELLOW}, {"purple", Color::PURPLE}, {"orange", Color::ORANGE},
+            {"gray", Color::GRAY}, {"", Color::DEFAULT}
+        };
+
+        while (true) {
+            cout << "Available colors:\n";
+            for (const auto& pair : color_map) {
+                if (!pair.first.empty()) {
+                    cout << getColorCode(pair.second) << pair.first << TermColor::RESET << " ";
+                }
+            }
+            cout << "\nDefault color will be used if empty\n";
+
+            string input = toLower(getInput("Color: "));
+            if (color_map.count(input)) {
+                return color_map[input];
+            } else if (input.empty()) {
+                return Color::DEFAULT;
+            }
+            cout << "Invalid color. Please try again.\n";
+        }
+    }
+
+    Priority promptPriority() {
+        while (true) {
+            string input = toLower(getInput("Priority (Low/Medium/High) [Medium]: "));
+            if (input == "high") return Priority::HIGH;
+            if (input == "low") return Priority::LOW;
+            if (input.empty() || input == "medium") return Priority::MEDIUM;
+            cout << "Invalid priority. Please try again.\n";
+        }
+    }
+
+    NameList promptAttendees() {
+        NameList attendees;
+        cout << "Enter attendees (one per line, empty to finish):\n";
+        while (true) {
+            string name = getInput("> ");
+            if (name.empty()) break;
+            attendees.push_back(name);
+        }
+        return attendees;
+    }
+    std::string timeToString(time_t time) {
+        char buffer[80];
+        formatTime(buffer, sizeof(buffer), time, "%Y-%m-%d %H:%M:%S");
+        return std::string(buffer);
+    }
+
+
+    // The calendar holding the event with the given id, or nullptr. The
+    // views merge every shown calendar, so ids are looked up in all of
+    // them, and the user picks one when the id is in several.
+    Calendar* calendarOf(int id) {
+        vector<size_t> found = calendars.owners(id);
+        if (found.empty()) return nullptr;
+        if (found.size() == 1) return calendars.entry(found[0]).calendar.get();
+        cout << "Event " << id << " is in " << found.size() << " calendars:\n";
+        for (size_t i = 0; i < found.size(); ++i) {
+            Calendar& calendar = *calendars.entry(found[i]).calendar;
+            cout << setw(3) << i + 1 << "  " << left << setw(20) << calendar.getName() << right
+                 << calendar.findEvent(id)->title << "\n";
+        }
+        int number = safeStoi(getInput("Which one? "), 0);
+        if (number < 1 || static_cast<size_t>(number) > found.size()) return nullptr;
+        return calendars.entry(found[static_cast<size_t>(number - 1)]).calendar.get();
+    }
+
+    // Lists what the event would overlap in the given calendar and asks
+    // whether to go ahead; true straight away when nothing does.
+    bool confirmConflicts(const Calendar& calendar, const Event& event, const string& question) {
+        const size_t MAX_SHOWN = 10;
+        auto conflicts = calendar.conflictsWith(event);
+        if (conflicts.empty()) return true;
+        cout << TermColor::YELLOW << "\nThis overlaps " << conflicts.size()
+             << (conflicts.size() == 1 ? " event:" : " events:") << TermColor::RESET << "\n";
+        for (size_t i = 0; i < conflicts.size() && i < MAX_SHOWN; ++i) {
+            const Occurrence& o = conflicts[i];
+            cout << "  " << dateToString(o.start_time) << " " << getTimePart(o.start_time) << "-"
+                 << getTimePart(o.end_time) << "  [" << o.event->id << "] " << o.event->title << "\n";
+        }
+        if (conflicts.size() > MAX_SHOWN) cout << "  ... and " << (conflicts.size() - MAX_SHOWN) << " more\n";
+        return toLower(getInput(question + " (y/n) [n]: ")) == "y";
+    }
+
+    void addEvent() {
+    clearScreen();
+    cout << TermColor::BOLD << "=== Add New Event ===" << TermColor::RESET << "\n\n";
+
+    string title = getInput("Event Title: ");
+    while (title.empty()) {
+        cout << "Title cannot be empty!\n";
+        title = getInput("Event Title: ");
+    }
+
+    // Set default start time to current time
+    time_t start = time(nullptr);
+    
+    // Get priority first as it affects time handling
+    Priority priority = promptPriority();
+    
+    time_t end;
+    string start_date = dateToString(start);
+    string start_time = getTimePart(start);
+    
+    if (priority == Priority::LOW) {
+        // For LOW priority - use current date, ask for start time, duration fixed to 1 hour
+        string time_input = getInput("Start time (HH:MM) [" + start_time + "]: ");
+        if (!time_input.empty()) {
+            string full_datetime = start_date + " " + time_input;
+            time_t new_start = stringToTime(full_datetime, "%Y-%m-%d %H:%M");
+            if (new_start != 0) {
+                start = new_start;
+            } else {
+                cout << "Invalid time format, using current time.\n";
+            }
+        }
+        end = start + 3600; // Fixed 1 hour duration
+        cout << "Low priority - duration set to 1 hour\n";
+    } 
+    else if (priority == Priority::MEDIUM) {
+        // For MEDIUM priority - use current date, ask for start time, duration fixed to 2 hours
+        string time_input = getInput("Start time (HH:MM) [" + start_time + "]: ");
+        if (!time_input.empty()) {
+            string full_datetime = start_date + " " + time_input;
+            time_t new_start = stringToTime(full_datetime, "%Y-%m-%d %H:%M");
+            if (new_start != 0) {
+                start = new_start;
+            } else {
+                cout << "Invalid time format, using current time.\n";
+            }
+        }
+        end = start + 7200; // Fixed 2 hours duration
+        cout << "Medium priority - duration set to 2 hours\n";
+    }
+    else { // HIGH priority
+        // For HIGH priority - ask for full start and end datetime
+        string default_start = timeToString(start);
+        string start_input = getInput("Start date & time (YYYY-MM-DD HH:MM) [" + default_start + "]: ");
+        if (!start_input.empty()) {
+            time_t new_start = stringToTime(start_input, "%Y-%m-%d %H:%M");
+            if (new_start != 0) {
+                start = new_start;
+            } else {
+                cout << "Invalid format, using current time.\n";
             }
         }
         
         string default_end = timeToString(start + 3600);
         string end_input = getInput("End date & time (YYYY-MM-DD HH:MM) [" + default_end + "]: ");
         if (!end_input.empty()) {
-            end = stringToTime(end_input, "%Y-%m-%d %H:%M");
-            while (end == 0 || difftime(end, start) <= 0) {
-                if (end == 0) {
-                    cout << "Invalid format. ";
-                } else {
-                    cout << "End time must be after start time! ";
+            end = stringToTime(end_input, "%Y-%m-%d %H:%M");
+            while (end == 0 || difftime(end, start) <= 0) {
+                if (end == 0) {
+                    cout << "Invalid format. ";
+                } else {
+                    cout << "End time must be after start time! ";
+                }
+                end_input = getInput("Please enter end time (YYYY-MM-DD HH:MM): ");
+                end = stringToTime(end_input, "%Y-%m-%d %H:%M");
+            }
+        } else {
+            end = start + 3600; // Default 1 hour if not specified
+        }
+    }
+
+    string desc = getInput("Description (optional): ");
+    string loc = getInput("Location (optional): ");
+    
+    // Set color based on priority
+    Color color;
+    switch (priority) {
+        case Priority::LOW: color = Color::BLUE; break;
+        case Priority::MEDIUM: color = Color::GREEN; break;
+        case Priority::HIGH: color = Color::RED; break;
+    }
+    cout << "Auto-selected color: " << getColorCode(color) 
+         << toString(color) << TermColor::RESET << "\n";
+
+    NameList attendees = promptAttendees();
+
+    Event new_event(title, start, end, color, priority, desc,loc, attendees);
+    if (!confirmConflicts(calendars.active(), new_event, "Add anyway?")) {
+        cout << "\nEvent not added.\n";
+        waitForEnter();
+        return;
+    }
+    calendars.active().addEvent(new_event);
+
+    cout << TermColor::GREEN << "\nEvent added successfully with ID: " 
+         << new_event.id << "!" << TermColor::RESET << "\n";
+    waitForEnter();
+}
+void editEvent() {
+    clearScreen();
+    cout << TermColor::BOLD << "=== Edit Event ===" << TermColor::RESET << "\n\n";
+    
+    int id = safeStoi(getInput("Enter event ID to edit: "), -1);
+    Calendar* owner = calendarOf(id);
+    Event* event = owner ? owner->findEvent(id) : nullptr;
+    if (!event) {
+        cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
+        waitForEnter();
+        return;
+    }
+    Event edited = *event;
+    
+    // Show current details
+    cout << "Current details:\n";
+    edited.printDetails();
+    cout << "\nLeave blank to keep current value.\n";
+    
+    // Edit title
+    string new_title = getInput("New title [" + edited.title.str() + "]: ");
+    if (!new_title.empty()) edited.title = new_title;
+    
+    // Edit start time
+    string current_start = edited.is_all_day ? dateToString(edited.start_time) : timeToString(edited.start_time);
+    string start_input = getInput("New start time [" + current_start + "]: ");
+    if (!start_input.empty()) {
+        time_t new_start = stringToTime(start_input, edited.is_all_day ? "%Y-%m-%d" : "%Y-%m-%d %H:%M");
+        if (new_start != 0) {
+            time_t duration = edited.end_time - edited.start_time;
+            edited.start_time = new_start;
+            edited.end_time = new_start + duration;
+        } else {
+            cout << "Invalid time format, keeping original.\n";
+        }
+    }
+    
+    // Edit end time (if not all-day)
+    if (!edited.is_all_day) {
+        string end_input = getInput("New end time [" + timeToString(edited.end_time) + "]: ");
+        if (!end_input.empty()) {
+            time_t new_end = stringToTime(end_input, "%Y-%m-%d %H:%M");
+            if (new_end != 0 && new_end > edited.start_time) {
+                edited.end_time = new_end;
+            } else {
+                cout << "Invalid time or before start time, keeping original.\n";
+            }
+        }
+    }
+    
+    // Edit priority and color
+    cout << "Current priority: " << toString(edited.priority) << "\n";
+    string priority_input = getInput("Change priority? (y/n) [n]: ");
+    if (toLower(priority_input) == "y") {
+        Priority old_priority = edited.priority;
+        edited.priority = promptPriority();
+        
+        // Update color if priority changed
+        if (edited.priority != old_priority) {
+            switch (edited.priority) {
+                case Priority::LOW: edited.color = Color::BLUE; break;
+                case Priority::MEDIUM: edited.color = Color::GREEN; break;
+                case Priority::HIGH: edited.color = Color::RED; break;
+            }
+            cout << "Color updated to: " << getColorCode(edited.color) 
+                 << toString(edited.color) << TermColor::RESET << "\n";
+        }
+    }
+    
+    // Edit description
+    string new_desc = getInput("New description [" + edited.description + "]: ");
+    if (!new_desc.empty()) edited.description = new_desc;
+    
+    // Edit location
+    string new_loc = getInput("New location [" + edited.location.str() + "]: ");
+    if (!new_loc.empty()) edited.location = new_loc;
+    
+    // Edit attendees
+    cout << "Current attendees: ";
+    if (edited.attendees.empty()) {
+        cout << "None\n";
+    } else {
+        for (const auto& name : edited.attendees) cout << name << ", ";
+        cout << "\n";
+    }
+    string att_input = getInput("Edit attendees? (y/n) [n]: ");
+    if (toLower(att_input) == "y") {
+        edited.attendees = promptAttendees();
+    }
+    
+    // Edit all-day status
+    string all_day_input = getInput("All-day event? (current: " + string(edited.is_all_day ? "Yes" : "No") + ") (y/n) [" + (edited.is_all_day ? "y" : "n") + "]: ");
+    if (!all_day_input.empty()) {
+        edited.is_all_day = (toLower(all_day_input) == "y");
+    }
+    
+    // Edit recurrence
+    if (edited.is_recurring) {
+        string recur_input = getInput("Current recurrence: " + edited.recurrence_pattern + "\nChange recurrence pattern? (y/n) [n]: ");
+        if (toLower(recur_input) == "y") {
+            edited.recurrence_pattern = getInput("New recurrence pattern " + RecurrenceRule::HELP + ": ");
+        }
+    } else {
+        string recur_input = getInput("Make this a recurring event? (y/n) [n]: ");
+        if (toLower(recur_input) == "y") {
+            edited.is_recurring = true;
+            edited.recurrence_pattern = getInput("Recurrence pattern " + RecurrenceRule::HELP + ": ");
+        }
+    }
+    
+    if (!confirmConflicts(*owner, edited, "Save anyway?")) {
+        cout << "\nChanges not saved.\n";
+        waitForEnter();
+        return;
+    }
+    owner->updateEvent(edited);
+    cout << TermColor::GREEN << "\nEvent updated successfully!" << TermColor::RESET << "\n";
+    waitForEnter();
+}
+    
+
+    void deleteEvent() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Delete Event ===" << TermColor::RESET << "\n\n";
+
+        int id = safeStoi(getInput("Enter event ID to delete: "), -1);
+        Calendar* owner = calendarOf(id);
+        if (owner && owner->deleteEvent(id)) {
+            cout << TermColor::GREEN << "Event deleted successfully!" << TermColor::RESET << "\n";
+        } else {
+            cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
+        }
+        waitForEnter();
+    }
+
+    
+void viewEventDetails() {
+    clearScreen();
+    cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << "\n\n";
+
+    int id = safeStoi(getInput("Enter event ID to view: "), -1);
+    Calendar* owner = calendarOf(id);
+    const Event* event = owner ? owner->findEvent(id) : nullptr;
+    if (event) {
+        string color_code = getColorCode(event->color);
+        cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << '\n';
+        cout << color_code << "Title: " << event->title << TermColor::RESET << '\n';
+        cout << "Time: ";
+        if (event->is_all_day) {
+            cout << dateToString(event->start_time) << " (All Day)";
+        } else {
+            cout << timeToString(event->start_time) << " to " << timeToString(event->end_time);
+        }
+        cout << "\nPriority: " << toString(event->priority);
+        cout << "\nColor: " << color_code << toString(event->color) << TermColor::RESET;
+        if (!event->location.empty()) cout << "\nLocation: " << event->location;
+        if (!event->description.empty()) cout << "\nDescription: " << event->description;
+        if (!event->attendees.empty()) {
+            cout << "\nAttendees: ";
+            for (const auto& name : event->attendees) cout << name << ", ";
+        }
+        cout << "\nAll-day event: " << (event->is_all_day ? "Yes" : "No");
+        if (event->is_recurring) cout << "\nRecurrence: " << event->recurrence_pattern;
+        cout << '\n';
+    } else {
+        cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
+    }
+    waitForEnter();
+}
+
+    void findTime() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Find a Time ===" << TermColor::RESET << "\n\n";
+        NameList attendees = promptAttendees();
+        if (attendees.empty()) return;
+
+        MeetingSearch search;
+        int minutes = safeStoi(getInput("Duration in minutes [30]: "), 30);
+        if (minutes > 0) search.duration = static_cast<time_t>(minutes) * 60;
+        time_t from = promptDate("Search from", false);
+        time_t to = promptDate("Search until", false);
+        to = localDayStart(localDayNumber(to) + 1);
+        string hours = getInput("Working hours [09:00-17:00]: ");
+        if (!hours.empty() && !search.setWorkingHours(hours)) cout << "Invalid hours, using 09:00-17:00.\n";
+        string overridable = toLower(getInput("May low-priority events be moved? (Y/n): "));
+        if (overridable == "n" || overridable == "no") search.blocking = Priority::LOW;
+
+        pmr::vector<TimeBlock> slots = calendars.active().findMeetingSlots(attendees, from, to, search);
+        cout << "\n";
+        if (slots.empty()) {
+            cout << "No common free time in that period.\n";
+        } else {
+            cout << TermColor::BOLD << "Earliest free slots:" << TermColor::RESET << "\n";
+            for (const TimeBlock& slot : slots) {
+                cout << "  " << getDayName(slot.start) << " " << dateToString(slot.start) << " "
+                     << getTimePart(slot.start) << " - " << getTimePart(slot.end) << "\n";
+            }
+        }
+        waitForEnter();
+    }
+
+    // Capacity report for the active calendar over whole days.
+    void showReport() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Reports ===" << TermColor::RESET << "\n\n";
+        time_t from = promptDate("Report from", false);
+        time_t to = localDayStart(localDayNumber(promptDate("Report until", false)) + 1);
+        if (to <= from) {
+            cout << TermColor::RED << "The period is empty." << TermColor::RESET << "\n";
+            waitForEnter();
+            return;
+        }
+        CalendarReport report = CalendarAnalytics::run(calendars.active(), from, to);
+        auto oneDecimal = [](double value) {
+            char text[32];
+            snprintf(text, sizeof(text), "%.1f", value);
+            return string(text);
+        };
+        auto hours = [&oneDecimal](long long seconds) { return oneDecimal(seconds / 3600.0); };
+
+        cout << "\n" << report.occurrences << " events, scanned as " << report.tasks << " days on "
+             << report.threads << " threads\n\n";
+        cout << TermColor::BOLD << "Load by priority and color" << TermColor::RESET << "\n";
+        if (report.occurrences == 0) cout << "  No events.\n";
+        for (int p = 2; p >= 0; --p) {
+            for (int c = 0; c < 8; ++c) {
+                const ReportTotals& load = report.load[p][c];
+                if (load.events == 0 && load.seconds == 0) continue;
+                cout << "  " << left << setw(8) << toString(static_cast<Priority>(p)) << setw(9)
+                     << toString(static_cast<Color>(c)) << right << setw(7) << load.events << " events "
+                     << setw(9) << hours(load.seconds) << " h\n";
+            }
+        }
+
+        // The busiest weeks rather than every attendee.
+        vector<const CalendarReport::AttendeeWeek*> busiest;
+        for (const CalendarReport::AttendeeWeek& week : report.attendee_weeks) busiest.push_back(&week);
+        size_t shown = min<size_t>(busiest.size(), 15);
+        partial_sort(busiest.begin(), busiest.begin() + shown, busiest.end(),
+                     [](const CalendarReport::AttendeeWeek* a, const CalendarReport::AttendeeWeek* b) {
+                         return a->busy.seconds > b->busy.seconds;
+                     });
+        cout << "\n" << TermColor::BOLD << "Busiest attendee weeks" << TermColor::RESET << "\n";
+        if (shown == 0) cout << "  No events with attendees.\n";
+        for (size_t i = 0; i < shown; ++i) {
+            cout << "  " << left << setw(24) << busiest[i]->attendee.substr(0, 23) << right << "week of "
+                 << dateToString(busiest[i]->week) << setw(9) << hours(busiest[i]->busy.seconds) << " h in "
+                 << busiest[i]->busy.events << " events\n";
+        }
+
+        cout << "\n" << TermColor::BOLD << "Location utilization" << TermColor::RESET << "\n";
+        if (report.locations.empty()) cout << "  No events with locations.\n";
+        for (size_t i = 0; i < report.locations.size() && i < 15; ++i) {
+            const CalendarReport::LocationUse& use = report.locations[i];
+            cout << "  " << left << setw(24) << use.location.substr(0, 23) << right << setw(9)
+                 << hours(use.booked.seconds) << " h" << setw(7) << oneDecimal(use.utilization * 100) << "%\n";
+        }
+        waitForEnter();
+    }
+
+    void navigateToDate() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Navigate to Date ===" << TermColor::RESET << "\n\n";
+        current_date = promptDate("Enter date", false);
+        cout << "\nNow viewing: " << TermColor::BOLD << dateToString(current_date) 
+             << TermColor::RESET << "\n";
+        waitForEnter();
+    }
+
+    // Opens another calendar and adds its load message to the status line.
+    bool openCalendar(const string& path) {
+        string message;
+        bool ok = calendars.open(path, message);
+        if (!ok) message = TermColor::RED + message + TermColor::RESET;
+        if (!message.empty()) status += (status.empty() ? "" : "\n") + message;
+        return ok;
+    }
+
+    // Visibility only changes which calendars the views merge; nothing is
+    // reloaded or re-indexed.
+    void manageCalendars() {
+        while (true) {
+            clearScreen();
+            cout << TermColor::BOLD << "=== Calendars ===" << TermColor::RESET << "\n\n";
+            for (size_t i = 0; i < calendars.size(); ++i) {
+                const CalendarSet::Entry& entry = calendars.entry(i);
+                cout << setw(3) << i + 1 << "  [" << (entry.visible ? 'x' : ' ') << "] "
+                     << (i == calendars.activeIndex() ? '*' : ' ') << " " << left << setw(20)
+                     << entry.calendar->getName() << right << entry.calendar->size() << " events  ("
+                     << entry.store->path() << ")\n";
+            }
+            cout << "\n[x] shown in views, * receives new events\n";
+            string choice = toLower(getInput("[T]oggle shown  [U]se for new events  [O]pen another  [B]ack: "));
+            if (choice.empty() || choice == "b") return;
+            if (choice == "o") {
+                string path = getInput("Snapshot file (created if missing): ");
+                if (!path.empty() && openCalendar(path)) calendars.setActive(calendars.size() - 1);
+                continue;
+            }
+            if (choice != "t" && choice != "u") continue;
+            int number = safeStoi(getInput("Calendar number: "), 0);
+            if (number < 1 || static_cast<size_t>(number) > calendars.size()) continue;
+            size_t index = static_cast<size_t>(number - 1);
+            if (choice == "t") calendars.setVisible(index, !calendars.entry(index).visible);
+            else calendars.setActive(index);
+        }
+    }
+
+    void importCalendar() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Import iCalendar ===" << TermColor::RESET << "\n\n";
+        string path = getInput("File to import (.ics): ");
+        if (path.empty()) return;
+
+        // Batch the journal while millions of records stream in; the
+        // background compaction folds them into the snapshot afterwards.
+        calendars.activeStore().setJournalOptions(Journal::Options{4096, 16});
+        size_t imported = 0;
+        string error;
+        time_t started = time(nullptr);
+        int first_id = Event::nextId();
+        TimeBlock span{};
+        bool ok = IcsReader::import(path, calendars.active(), imported, error, &span);
+        calendars.activeStore().setJournalOptions(Journal::Options{1, 1});
+
+        if (ok) {
+            cout << "\nImported " << imported << " events in " << (time(nullptr) - started) << "s.\n";
+            if (imported > 0) {
+                // One sweep over the imported span instead of a check per event.
+                size_t overlaps = calendars.active().countOverlaps(span.start, span.end, false, first_id);
+                if (overlaps > 0) cout << overlaps << " overlaps involve the imported events.\n";
+            }
+        } else {
+            cout << TermColor::RED << "\nImport failed: " << error << TermColor::RESET << "\n";
+        }
+        waitForEnter();
+    }
+
+    void exportCalendar() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Export iCalendar ===" << TermColor::RESET << "\n\n";
+        string path = getInput("Export to (.ics): ");
+        if (path.empty()) return;
+        bool everything = toLower(getInput("Export every event? (y/n) [y]: ")) != "n";
+        time_t start = 0, end = 0;
+        if (!everything) {
+            start = promptDate("Start of range", false);
+            end = promptDate("End of range", false) + 86399;
+        }
+
+        size_t written = 0;
+        string error;
+        if (IcsWriter::exportFile(path, calendars.active(), start, end, everything, written, error)) {
+            cout << "\nExported " << written << " events to " << path << ".\n";
+        } else {
+            cout << TermColor::RED << "\nExport failed: " << error << TermColor::RESET << "\n";
+        }
+        waitForEnter();
+    }
+
+    void weekViewOptions() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Week View Options ===" << TermColor::RESET << "\n\n";
+        WeekGridOptions options = week_options;
+
+        string input = getInput("Slot length in minutes (15/30/60) [" + to_string(options.slot_minutes) + "]: ");
+        if (!input.empty()) {
+            int minutes = safeStoi(input, options.slot_minutes);
+            if (minutes == 15 || minutes == 30 || minutes == 60) options.slot_minutes = minutes;
+            else cout << "Unsupported slot length, keeping " << options.slot_minutes << ".\n";
+        }
+        input = getInput("First hour (0-23) [" + to_string(options.first_hour) + "]: ");
+        if (!input.empty()) options.first_hour = safeStoi(input, options.first_hour);
+        input = getInput("Last hour (1-24) [" + to_string(options.last_hour) + "]: ");
+        if (!input.empty()) options.last_hour = safeStoi(input, options.last_hour);
+
+        if (options.first_hour < 0 || options.last_hour > 24 || options.first_hour >= options.last_hour) {
+            cout << TermColor::RED << "Invalid hour range, options unchanged." << TermColor::RESET << "\n";
+        } else {
+            week_options = options;
+            cout << "\nWeek view now shows " << week_options.first_hour << ":00-" << week_options.last_hour
+                 << ":00 in " << week_options.slot_minutes << "-minute slots.\n";
+        }
+        waitForEnter();
+    }
+
+    void showMainMenu() {
+        clearScreen();
+        cout << TermColor::BOLD << "=== Google Calendar Clone ===" << TermColor::RESET << "\n";
+        cout << "Today is " << TermColor::BOLD << dateToString(time(nullptr)) 
+             << TermColor::RESET << "\n";
+        if (!status.empty()) cout << status << "\n";
+        if (calendars.size() > 1) {
+            cout << "Showing " << calendars.visibleCount() << " of " << calendars.size()
+                 << " calendars; new events go to " << TermColor::BOLD << calendars.active().getName()
+                 << TermColor::RESET << "\n";
+        }
+        cout << "\n";
+        
+        cout << "[D]ay View    [W]eek View    [M]onth View  [Y]ear View\n";
+        cout << "[A]genda View [L]ist All Events [S]earch [F]ind a Time\n";
+        cout << "[N]ew Event   [E]dit Event   [X] Delete Event [C]onflicts\n";
+        cout << "[V]iew Event  [G]o to Date   [I]mport .ics [K] Calendars\n";
+        cout << "Ex[p]ort .ics Week [O]ptions [R]eports [Q]uit\n\n";
+    }
+
+public:
+    // The first calendar is the active one to begin with.
+    explicit CalendarUI(const vector<string>& snapshot_paths = {"calendar.snap"})
+        : current_date(time(nullptr)) {
+        for (const string& path : snapshot_paths) openCalendar(path);
+    }
+
+    // Every change is already journaled; this folds each journal into its
+    // snapshot so the next run starts without replaying it.
+    void save() {
+        for (size_t i = 0; i < calendars.size(); ++i) {
+            CalendarSet::Entry& entry = calendars.entry(i);
+            if (!entry.store->isOpen()) continue;
+            string error;
+            if (entry.store->close(*entry.calendar, error)) {
+                cout << "Saved " << entry.calendar->size() << " events to " << entry.store->path() << "\n";
+            } else {
+                cout << TermColor::RED << "Could not compact " << entry.store->path() << ": " << error
+                     << " (the journal still holds every change)" << TermColor::RESET << "\n";
+            }
+        }
+    }
+
+    void run() {
+        FrameRenderer::instance().begin();
+        char choice;
+        do {
+            showMainMenu();
+            cout << "Enter choice: ";
+            FrameRenderer::instance().present();
+            if (!(cin >> choice)) choice = 'q';  // end of input quits (and saves)
+            cin.ignore();
+            FrameRenderer::instance().noteInput(string(1, choice));
+            choice = tolower(choice);
+
+            // Views build their grids and cursors in the scratch arena,
+            // which is released once the command is done.
+            ScratchArena::Scope scratch;
+            switch (choice) {
+                case 'd': calendars.displayDay(current_date); break;
+                case 'w': calendars.displayWeek(current_date, week_options); break;
+                case 'm': calendars.displayMonth(current_date); break;
+                case 'y': calendars.displayYear(current_date); break;
+                case 'a': {
+                    time_t start = promptDate("Start of Agenda View");
+                    time_t end = promptDate("End of Agenda View");
+                    calendars.displayAgenda(start, end);
+                    break;
+                }
+                case 'l': calendars.active().listAllEvents(); break;
+                case 's': {
+                    string query = getInput("Search for: ");
+                    if (!query.empty()) calendars.active().displaySearch(query);
+                    break;
+                }
+                case 'f': findTime(); break;
+                case 'c': {
+                    time_t start = promptDate("Start of period");
+                    time_t end = promptDate("End of period");
+                    bool shared = toLower(getInput("Only events sharing an attendee? (y/n) [n]: ")) == "y";
+                    calendars.active().displayOverlaps(start, end, shared);
+                    break;
+                }
+                case 'n': addEvent(); break;
+                case 'e': editEvent(); break;
+                case 'x': deleteEvent(); break;
+                case 'v': viewEventDetails(); break;
+                case 'g': navigateToDate(); break;
+                case 'i': importCalendar(); break;
+                case 'k': manageCalendars(); break;
+                case 'r': showReport(); break;
+                case 'p': exportCalendar(); break;
+                case 'o': weekViewOptions(); break;
+                case 'q':
+                    save();
+                    cout << "Exiting...\n";
+                    break;
+                default: 
+                    cout << TermColor::RED << "Invalid choice!" << TermColor::RESET << "\n";
+                    waitForEnter("Press Enter to try again...");
+                    break;
+            }
+            string unsaved;
+            if (!calendars.maintain(unsaved)) {
+                cout << TermColor::RED << "Last change not saved: " << unsaved << TermColor::RESET << "\n";
+                waitForEnter("Press Enter to continue...");
+            }
+        } while (choice != 'q');
+        FrameRenderer::instance().end();
+    }
+};
+
+// ==================== Batch Mode ====================
+// Non-interactive front end for scripted jobs: one command per input line,
+// one JSON object per output line, and no prompts or screen handling.
+//
+//   add title="Standup" start="2026-10-16 09:00" end="2026-10-16 09:15" priority=low
+//   edit id=12 location="Room 4"        delete id=12        get id=12
+//   (add and edit take check=1 or check=attendees to list the ids they overlap)
+//   query from=2026-10-01 to=2026-10-31 [attendee=Alice]   day date=2026-10-16
+//   freebusy from=2026-10-16 to=2026-10-17 [attendee=Alice]
+//   scan from=2026-01-01 to=2026-12-31 [priority=high] [ids=1]
+//   search q="design review" [limit=20]
+//   findtime attendees="Alice,Bob" from=2026-10-19 to=2026-10-31 [duration=30]
+//            [hours=09:00-17:00] [weekends=1] [blocking=medium] [limit=5]
+//   overlaps from=2026-10-01 to=2026-10-31 [attendees=1] [limit=100]
+//   report from=2026-07-01 to=2026-09-30 [limit=100]
+//   count   compact   import path=in.ics [check=1]   export path=out.ics [from=... to=...]
+//
+// Times are local "YYYY-MM-DD" or "YYYY-MM-DD HH:MM[:SS]", or epoch
+// seconds within years 1 to 9999. Output times are always epoch seconds.
+// Values with spaces are double-quoted, with \" and \\ escapes. Blank
+// lines and lines starting with # are skipped. A failing command reports
+// "ok":false with its line number, and the run carries on with the next
+// command.
+class BatchRunner {
+private:
+    // Reused for every line: only the first count args are live, and the
+    // rest keep their string capacity for the next command.
+    struct Command {
+        string name;
+        vector<pair<string, string>> args;
+        size_t count = 0;
+
+        const string* get(const char* key) const {
+            for (size_t i = 0; i < count; ++i) {
+                if (args[i].first == key) return &args[i].second;
+            }
+            return nullptr;
+        }
+
+        pair<string, string>& next() {
+            if (count == args.size()) args.emplace_back();
+            pair<string, string>& arg = args[count++];
+            arg.first.clear();
+            arg.second.clear();
+            return arg;
+        }
+    };
+
+    static const size_t OUTPUT_FLUSH = 1 << 20;
+    static const size_t MAINTAIN_EVERY = 4096;  // commands between compaction checks
+    static const size_t MIRROR_BATCH = 64;      // changes that rebuild the mirror's chunks at once
+
+    // Reused by every line a thread runs, so that parsing and replies
+    // keep their capacity; the server runs queries on several threads.
+    struct Workspace {
+        Command command;
+        string result;
+        string error;
+    };
+
+    Calendar& calendar;
+    CalendarStore* store;  // nullptr when nothing is persisted
+    ConcurrentCalendar* mirror;  // copy of calendar that queries may read instead, if any
+    ostream& out;
+    bool alloc_stats;      // report heap allocations per command
+    mutex report_lock;     // one report at a time runs on the pool
+    unique_ptr<WorkStealingPool> pool;  // started by the first report
+    string buffer;         // pending output, written in large blocks
+    size_t line_number;
+    size_t executed;       // commands that can write, which run one at a time
+
+    static Workspace& workspace() {
+        thread_local Workspace work;
+        return work;
+    }
+
+    static string commandName(const string& line) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first == string::npos) return string();
+        size_t last = line.find_first_of(" \t\r=", first);
+        return toLower(line.substr(first, last == string::npos ? string::npos : last - first));
+    }
+
+    static void assignLower(string& out, const string& line, size_t start, size_t end) {
+        out.assign(line, start, end - start);
+        for (char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+
+    static bool tokenize(const string& line, Command& command, string& error) {
+        command.name.clear();
+        command.count = 0;
+        size_t i = 0;
+        while (true) {
+            while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) ++i;
+            if (i == line.size()) break;
+            size_t start = i;
+            while (i < line.size() && line[i] != '=' && !isspace(static_cast<unsigned char>(line[i]))) ++i;
+            if (command.name.empty()) {
+                if (i < line.size() && line[i] == '=') {
+                    error = "expected a command before " + line.substr(start, i - start) + "=";
+                    return false;
                 }
-                end_input = getInput("Please enter end time (YYYY-MM-DD HH:MM): ");
-                end = stringToTime(end_input, "%Y-%m-%d %H:%M");
+                assignLower(command.name, line, start, i);
+                continue;
+            }
+            if (i == line.size() || line[i] != '=') {
+                error = "expected key=value, got " + line.substr(start, i - start);
+                return false;
+            }
+            pair<string, string>& arg = command.next();
+            assignLower(arg.first, line, start, i);
+            string& value = arg.second;
+            if (++i < line.size() && line[i] == '"') {
+                bool closed = false;
+                for (++i; i < line.size(); ++i) {
+                    if (line[i] == '"') {
+                        closed = true;
+                        ++i;
+                        break;
+                    }
+                    if (line[i] == '\\' && i + 1 < line.size()) ++i;
+                    value += line[i];
+                }
+                if (!closed) {
+                    error = "unterminated quote after " + arg.first + "=";
+                    return false;
+                }
+            } else {
+                while (i < line.size() && !isspace(static_cast<unsigned char>(line[i]))) value += line[i++];
+            }
+        }
+        return true;
+    }
+
+    static bool number(const string& text, size_t at, size_t count, int& value) {
+        if (text.size() < at + count) return false;
+        value = 0;
+        for (size_t i = at; i < at + count; ++i) {
+            if (!isdigit(static_cast<unsigned char>(text[i]))) return false;
+            value = value * 10 + (text[i] - '0');
+        }
+        return true;
+    }
+
+    // Parsed by hand rather than through stringToTime: at millions of
+    // commands the istringstream per call dominates the run.
+    static bool parseTime(const string& text, time_t& result, bool& date_only) {
+        if (!text.empty() && text.find_first_not_of("0123456789", text[0] == '-' ? 1 : 0) == string::npos) {
+            char* end = nullptr;
+            errno = 0;
+            long long seconds = strtoll(text.c_str(), &end, 10);
+            if (*end != '\0' || errno == ERANGE || seconds < EARLIEST_TIME || seconds > LATEST_TIME) return false;
+            result = static_cast<time_t>(seconds);
+            date_only = false;
+            return true;
+        }
+        int year, month, day, hour = 0, minute = 0, second = 0;
+        if (!number(text, 0, 4, year) || text.size() < 10 || text[4] != '-' || !number(text, 5, 2, month) ||
+            text[7] != '-' || !number(text, 8, 2, day) || month < 1 || month > 12 || day < 1 || day > 31) {
+            return false;
+        }
+        date_only = text.size() == 10;
+        if (!date_only) {
+            if ((text[10] != ' ' && text[10] != 'T') || !number(text, 11, 2, hour) || text.size() < 16 ||
+                text[13] != ':' || !number(text, 14, 2, minute)) {
+                return false;
+            }
+            if (text.size() > 16 && (text.size() != 19 || text[16] != ':' || !number(text, 17, 2, second))) {
+                return false;
+            }
+            if (hour > 23 || minute > 59 || second > 59) return false;
+        }
+        result = localTimeFromCivil(year, month, day, hour, minute, second);
+        return true;
+    }
+
+    static bool timeArg(const Command& command, const char* key, time_t& result, bool& date_only,
+                        string& error) {
+        const string* value = command.get(key);
+        if (!value) {
+            error = string("missing ") + key + "=";
+            return false;
+        }
+        if (!parseTime(*value, result, date_only)) {
+            error = string("bad time in ") + key + "=" + *value;
+            return false;
+        }
+        return true;
+    }
+
+    // Range from=/to=, inclusive unless half_open; a date-only "to" covers
+    // that whole day either way.
+    static bool rangeArgs(const Command& command, time_t& from, time_t& to, string& error,
+                          bool half_open = false) {
+        bool date_only;
+        if (!timeArg(command, "from", from, date_only, error)) return false;
+        if (!timeArg(command, "to", to, date_only, error)) return false;
+        if (date_only) to = localDayStart(localDayNumber(to) + 1) - (half_open ? 0 : 1);
+        if (to < from || (half_open && to == from)) {
+            error = "empty range";
+            return false;
+        }
+        return true;
+    }
+
+    static bool idArg(const Command& command, int& id, string& error) {
+        const string* value = command.get("id");
+        id = value ? safeStoi(*value, -1) : -1;
+        if (id < 0) error = value ? "bad id=" + *value : "missing id=";
+        return id >= 0;
+    }
+
+    static void appendNumber(string& out, long long value) {
+        char digits[24];
+        out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+    }
+
+    static void appendString(string& out, const string& text) {
+        out += '"';
+        for (char c : text) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    // One event, at the times of the given occurrence. The detailed form
+    // carries every field; the short one is what range queries return.
+    static void appendEvent(string& out, const Event& event, time_t start, time_t end, bool detailed) {
+        out += "{\"id\":";
+        appendNumber(out, event.id);
+        out += ",\"title\":";
+        appendString(out, event.title);
+        out += ",\"start\":";
+        appendNumber(out, start);
+        out += ",\"end\":";
+        appendNumber(out, end);
+        out += ",\"all_day\":";
+        out += event.is_all_day ? "true" : "false";
+        out += ",\"priority\":\"";
+        out += toLower(toString(event.priority));
+        out += '"';
+        if (!detailed) {
+            out += '}';
+            return;
+        }
+        out += ",\"color\":\"";
+        out += toLower(toString(event.color));
+        out += "\",\"location\":";
+        appendString(out, event.location);
+        out += ",\"description\":";
+        appendString(out, event.description);
+        out += ",\"attendees\":[";
+        for (size_t i = 0; i < event.attendees.size(); ++i) {
+            if (i) out += ',';
+            appendString(out, event.attendees[i]);
+        }
+        out += "],\"recurrence\":";
+        if (event.is_recurring) appendString(out, event.recurrence_pattern);
+        else out += "\"\"";
+        out += '}';
+    }
+
+    static bool parsePriority(const string& value, Priority& priority) {
+        string name = toLower(value);
+        if (name == "low") priority = Priority::LOW;
+        else if (name == "medium") priority = Priority::MEDIUM;
+        else if (name == "high") priority = Priority::HIGH;
+        else return false;
+        return true;
+    }
+
+    static bool parseColor(const string& value, Color& color) {
+        string name = toLower(value);
+        for (Color candidate : {Color::RED, Color::BLUE, Color::GREEN, Color::YELLOW,
+                                Color::PURPLE, Color::ORANGE, Color::GRAY, Color::DEFAULT}) {
+            if (name == toLower(toString(candidate))) {
+                color = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static NameList splitList(const string& value) {
+        NameList items;
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == string::npos) comma = value.size();
+            string_view item(value.data() + start, comma - start);
+            size_t first = item.find_first_not_of(" \t\n\r");
+            if (first != string_view::npos) {
+                item = item.substr(first, item.find_last_not_of(" \t\n\r") - first + 1);
+                items.emplace_back(item);
+            }
+            start = comma + 1;
+        }
+        return items;
+    }
+
+    // Applies the event fields present in the command; shared by add and
+    // edit. A new start without an end keeps the event's duration, as the
+    // interactive editor does.
+    static bool applyFields(const Command& command, Event& event, string& error) {
+        bool date_only = false;
+        time_t duration = event.end_time - event.start_time;
+        if (const string* value = command.get("title")) event.title = *value;
+        if (const string* value = command.get("all_day")) event.is_all_day = *value == "1" || toLower(*value) == "true";
+        if (command.get("start")) {
+            if (!timeArg(command, "start", event.start_time, date_only, error)) return false;
+            event.end_time = event.start_time + duration;
+        }
+        if (command.get("end")) {
+            bool end_date_only;
+            if (!timeArg(command, "end", event.end_time, end_date_only, error)) return false;
+            if (end_date_only) event.end_time = localDayStart(localDayNumber(event.end_time) + 1);
+        }
+        if (const string* value = command.get("priority")) {
+            if (!parsePriority(*value, event.priority)) {
+                error = "bad priority=" + *value;
+                return false;
+            }
+        }
+        if (const string* value = command.get("color")) {
+            if (!parseColor(*value, event.color)) {
+                error = "bad color=" + *value;
+                return false;
+            }
+        }
+        if (const string* value = command.get("description")) event.description = *value;
+        if (const string* value = command.get("location")) event.location = *value;
+        if (const string* value = command.get("attendees")) event.attendees = splitList(*value);
+        if (const string* value = command.get("recurrence")) {
+            event.is_recurring = !value->empty();
+            event.recurrence_pattern = *value;
+            if (event.is_recurring && !RecurrenceRule::parse(*value).valid()) {
+                error = "bad recurrence=" + *value;
+                return false;
+            }
+        }
+        if (event.title.empty()) {
+            error = "title= must not be empty";
+            return false;
+        }
+        if (event.end_time < event.start_time) {
+            error = "end= is before start=";
+            return false;
+        }
+        return true;
+    }
+
+    enum class Check { NONE, ALL, ATTENDEES };
+
+    // check=1 compares against every event, check=attendees only against
+    // events sharing an attendee.
+    static bool checkArg(const Command& command, Check& check, string& error) {
+        check = Check::NONE;
+        const string* value = command.get("check");
+        if (!value) return true;
+        string mode = toLower(*value);
+        if (mode == "1" || mode == "true") check = Check::ALL;
+        else if (mode == "attendees") check = Check::ATTENDEES;
+        else if (mode != "0" && mode != "false") {
+            error = "bad check=" + *value;
+            return false;
+        }
+        return true;
+    }
+
+    // Ids of the events the event overlaps, each once.
+    void appendConflicts(string& result, const Event& event, Check check) const {
+        if (check == Check::NONE) return;
+        pmr::vector<int> ids(ScratchArena::resource());
+        for (const Occurrence& o : calendar.conflictsWith(event, check == Check::ATTENDEES)) ids.push_back(o.event->id);
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        result += ",\"conflicts\":[";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (i) result += ',';
+            appendNumber(result, ids[i]);
+        }
+        result += ']';
+    }
+
+    bool add(const Command& command, string& result, string& error) {
+        time_t start;
+        bool date_only;
+        if (!command.get("title")) {
+            error = "missing title=";
+            return false;
+        }
+        if (!timeArg(command, "start", start, date_only, error)) return false;
+        const string* all_day = command.get("all_day");
+        bool whole_day = all_day ? (*all_day == "1" || toLower(*all_day) == "true") : date_only;
+        time_t end = whole_day ? localDayStart(localDayNumber(start) + 1) : start + 3600;
+
+        Event event(*command.get("title"), start, end);
+        event.is_all_day = whole_day;
+        Check check;
+        if (!applyFields(command, event, error) || !checkArg(command, check, error)) return false;
+        result += ",\"id\":";
+        appendNumber(result, event.id);
+        appendConflicts(result, event, check);
+        calendar.addEvent(move(event));
+        return true;
+    }
+
+    bool edit(const Command& command, string& result, string& error) {
+        int id;
+        if (!idArg(command, id, error)) return false;
+        const Event* current = calendar.findEvent(id);
+        if (!current || current->isDeleted()) {
+            error = "no event " + to_string(id);
+            return false;
+        }
+        Event edited = *current;
+        Check check;
+        if (!applyFields(command, edited, error) || !checkArg(command, check, error)) return false;
+        result += ",\"id\":";
+        appendNumber(result, id);
+        appendConflicts(result, edited, check);
+        calendar.updateEvent(edited);
+        return true;
+    }
+
+    bool remove(const Command& command, string& result, string& error) {
+        int id;
+        if (!idArg(command, id, error)) return false;
+        if (!calendar.deleteEvent(id)) {
+            error = "no event " + to_string(id);
+            return false;
+        }
+        result += ",\"id\":";
+        appendNumber(result, id);
+        return true;
+    }
+
+    bool get(const Command& command, string& result, string& error) {
+        int id;
+        if (!idArg(command, id, error)) return false;
+        const Event* event = calendar.findEvent(id);
+        if (!event || event->isDeleted()) {
+            error = "no event " + to_string(id);
+            return false;
+        }
+        result += ",\"event\":";
+        appendEvent(result, *event, event->start_time, event->end_time, true);
+        return true;
+    }
+
+    // The list goes straight into result and the count is slotted in
+    // ahead of it afterwards, so nothing else is buffered while the
+    // occurrences are counted.
+    template <typename Occurrences>
+    static void appendOccurrences(string& result, const Occurrences& occurrences) {
+        size_t count_at = result.size();
+        size_t count = 0;
+        result += ",\"events\":[";
+        for (const Occurrence& o : occurrences) {
+            if (count++) result += ',';
+            appendEvent(result, *o.event, o.start_time, o.end_time, false);
+        }
+        result += ']';
+        char field[32] = ",\"count\":";
+        char* end = to_chars(field + 9, field + sizeof(field), static_cast<long long>(count)).ptr;
+        result.insert(count_at, field, static_cast<size_t>(end - field));
+    }
+
+    bool query(const Command& command, string& result, string& error) {
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error)) return false;
+        const string* attendee = command.get("attendee");
+        if (mirror) {
+            ConcurrentCalendar::Snapshot version = mirror->snapshot();
+            if (attendee) appendOccurrences(result, version.attendeeEventsBetween(InternedString(*attendee), from, to));
+            else appendOccurrences(result, version.eventsBetween(from, to));
+        } else if (attendee) {
+            appendOccurrences(result, calendar.attendeeEventsBetween(InternedString(*attendee), from, to));
+        } else {
+            appendOccurrences(result, calendar.eventsBetween(from, to));
+        }
+        return true;
+    }
+
+    // Column scan over the stored one-off events: a count, plus the ids
+    // when asked for. Recurring series are not included.
+    bool scan(const Command& command, string& result, string& error) {
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error)) return false;
+        Priority min_priority = Priority::LOW;
+        if (const string* value = command.get("priority")) {
+            if (!parsePriority(*value, min_priority)) {
+                error = "bad priority=" + *value;
+                return false;
+            }
+        }
+        pmr::vector<int> ids = calendar.scanOneOffs(from, to, min_priority);
+        result += ",\"kernel\":\"";
+        result += EventColumns::kernelName();
+        result += "\",\"count\":";
+        appendNumber(result, static_cast<long long>(ids.size()));
+        const string* list = command.get("ids");
+        if (list && (*list == "1" || toLower(*list) == "true")) {
+            result += ",\"ids\":[";
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (i) result += ',';
+                appendNumber(result, ids[i]);
+            }
+            result += ']';
+        }
+        return true;
+    }
+
+    // Ranked keyword search; each hit is the event at its stored times.
+    bool search(const Command& command, string& result, string& error) {
+        const string* query = command.get("q");
+        if (!query) {
+            error = "missing q=";
+            return false;
+        }
+        size_t limit = 20;
+        if (const string* value = command.get("limit")) {
+            int parsed = safeStoi(*value, -1);
+            if (parsed < 0) {
+                error = "bad limit=" + *value;
+                return false;
+            }
+            limit = static_cast<size_t>(parsed);
+        }
+        size_t count = 0;
+        result += ",\"hits\":[";
+        for (const SearchHit& hit : calendar.search(*query, limit)) {
+            const Event* event = calendar.findEvent(hit.id);
+            if (!event) continue;
+            if (count++) result += ',';
+            char score[32];
+            snprintf(score, sizeof(score), "%.3f", hit.score);
+            result += "{\"score\":";
+            result += score;
+            result += ",\"event\":";
+            appendEvent(result, *event, event->start_time, event->end_time, false);
+            result += '}';
+        }
+        result += "],\"count\":";
+        appendNumber(result, static_cast<long long>(count));
+        return true;
+    }
+
+    bool day(const Command& command, string& result, string& error) {
+        time_t date;
+        bool date_only;
+        if (!timeArg(command, "date", date, date_only, error)) return false;
+        appendOccurrences(result, calendar.eventsOnDay(date));
+        return true;
+    }
+
+    static void appendBlock(string& out, bool comma, time_t start, time_t end) {
+        if (comma) out += ',';
+        out += '[';
+        appendNumber(out, start);
+        out += ',';
+        appendNumber(out, end);
+        out += ']';
+    }
+
+    // Busy blocks over [from, to), from the attendee's own schedule when
+    // one is named; free blocks are the gaps between them.
+    bool freeBusy(const Command& command, string& result, string& error) {
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error, true)) return false;
+        const string* attendee = command.get("attendee");
+        pmr::vector<TimeBlock> busy(ScratchArena::resource());
+        if (mirror) {
+            ConcurrentCalendar::Snapshot version = mirror->snapshot();
+            busy = attendee ? version.busyBlocks(InternedString(*attendee), from, to) : version.busyBlocks(from, to);
+        } else {
+            busy = attendee ? calendar.busyBlocks(InternedString(*attendee), from, to) : calendar.busyBlocks(from, to);
+        }
+
+        long long busy_seconds = 0;
+        for (const TimeBlock& block : busy) busy_seconds += block.end - block.start;
+        result += ",\"busy_seconds\":";
+        appendNumber(result, busy_seconds);
+        result += ",\"busy\":[";
+        for (size_t i = 0; i < busy.size(); ++i) appendBlock(result, i > 0, busy[i].start, busy[i].end);
+        result += "],\"free\":[";
+        time_t cursor = from;
+        bool any = false;
+        for (const TimeBlock& block : busy) {
+            if (block.start > cursor) {
+                appendBlock(result, any, cursor, block.start);
+                any = true;
+            }
+            cursor = block.end;
+        }
+        if (cursor < to) appendBlock(result, any, cursor, to);
+        result += ']';
+        return true;
+    }
+
+    // Earliest common free slots; duration is in minutes, and events below
+    // the blocking priority may be overridden.
+    bool findTime(const Command& command, string& result, string& error) {
+        const string* attendees = command.get("attendees");
+        if (!attendees) {
+            error = "missing attendees=";
+            return false;
+        }
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error, true)) return false;
+        MeetingSearch search;
+        if (const string* value = command.get("duration")) {
+            int minutes = safeStoi(*value, 0);
+            if (minutes <= 0) {
+                error = "bad duration=" + *value;
+                return false;
+            }
+            search.duration = static_cast<time_t>(minutes) * 60;
+        }
+        if (const string* value = command.get("hours")) {
+            if (!search.setWorkingHours(*value)) {
+                error = "bad hours=" + *value;
+                return false;
+            }
+        }
+        if (const string* value = command.get("weekends")) search.weekdays_only = !(*value == "1" || toLower(*value) == "true");
+        if (const string* value = command.get("blocking")) {
+            if (!parsePriority(*value, search.blocking)) {
+                error = "bad blocking=" + *value;
+                return false;
+            }
+        }
+        if (const string* value = command.get("limit")) {
+            int limit = safeStoi(*value, -1);
+            if (limit < 0) {
+                error = "bad limit=" + *value;
+                return false;
+            }
+            search.max_slots = static_cast<size_t>(limit);
+        }
+        pmr::vector<TimeBlock> slots = calendar.findMeetingSlots(splitList(*attendees), from, to, search);
+        result += ",\"slots\":[";
+        for (size_t i = 0; i < slots.size(); ++i) appendBlock(result, i > 0, slots[i].start, slots[i].end);
+        result += "],\"count\":";
+        appendNumber(result, static_cast<long long>(slots.size()));
+        return true;
+    }
+
+    bool importFile(const Command& command, string& result, string& error) {
+        const string* path = command.get("path");
+        if (!path) {
+            error = "missing path=";
+            return false;
+        }
+        Check check;
+        if (!checkArg(command, check, error)) return false;
+        size_t imported = 0;
+        int first_id = Event::nextId();
+        TimeBlock span{};
+        if (!IcsReader::import(*path, calendar, imported, error, &span)) return false;
+        result += ",\"imported\":";
+        appendNumber(result, static_cast<long long>(imported));
+        if (check != Check::NONE) {
+            // One sweep over the imported span once the load is done, rather
+            // than an index query per event while it runs.
+            size_t overlaps = imported ? calendar.countOverlaps(span.start, span.end, check == Check::ATTENDEES, first_id) : 0;
+            result += ",\"overlaps\":";
+            appendNumber(result, static_cast<long long>(overlaps));
+        }
+        return true;
+    }
+
+    // Pairs of overlapping occurrences within [from, to]: the full count,
+    // and up to limit= pairs as [id, start, id, start].
+    bool overlaps(const Command& command, string& result, string& error) {
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error)) return false;
+        const string* attendees = command.get("attendees");
+        bool shared = attendees && (*attendees == "1" || toLower(*attendees) == "true");
+        size_t limit = 100;
+        if (const string* value = command.get("limit")) {
+            int parsed = safeStoi(*value, -1);
+            if (parsed < 0) {
+                error = "bad limit=" + *value;
+                return false;
+            }
+            limit = static_cast<size_t>(parsed);
+        }
+        size_t count = 0;
+        result += ",\"pairs\":[";
+        calendar.forEachOverlap(from, to, shared, [&](const Occurrence& a, const Occurrence& b) {
+            if (count++ >= limit) return;
+            if (count > 1) result += ',';
+            result += '[';
+            appendNumber(result, a.event->id);
+            result += ',';
+            appendNumber(result, a.start_time);
+            result += ',';
+            appendNumber(result, b.event->id);
+            result += ',';
+            appendNumber(result, b.start_time);
+            result += ']';
+        });
+        result += "],\"count\":";
+        appendNumber(result, static_cast<long long>(count));
+        return true;
+    }
+
+    // Analytics over [from, to): load by priority and color, then up to
+    // limit= attendee weeks and locations.
+    bool report(const Command& command, string& result, string& error) {
+        time_t from, to;
+        if (!rangeArgs(command, from, to, error, true)) return false;
+        size_t limit = 100;
+        if (const string* value = command.get("limit")) {
+            int parsed = safeStoi(*value, -1);
+            if (parsed < 0) {
+                error = "bad limit=" + *value;
+                return false;
+            }
+            limit = static_cast<size_t>(parsed);
+        }
+        CalendarReport report;
+        {
+            lock_guard<mutex> guard(report_lock);
+            if (!pool) pool = make_unique<WorkStealingPool>();
+            report = CalendarAnalytics::run(calendar, from, to, *pool);
+        }
+        result += ",\"occurrences\":";
+        appendNumber(result, static_cast<long long>(report.occurrences));
+        result += ",\"load\":[";
+        bool first = true;
+        for (int p = 0; p < 3; ++p) {
+            for (int c = 0; c < 8; ++c) {
+                const ReportTotals& load = report.load[p][c];
+                if (load.events == 0 && load.seconds == 0) continue;
+                result += first ? "{\"priority\":" : ",{\"priority\":";
+                first = false;
+                appendString(result, toLower(toString(static_cast<Priority>(p))));
+                result += ",\"color\":";
+                appendString(result, toLower(toString(static_cast<Color>(c))));
+                result += ",\"events\":";
+                appendNumber(result, static_cast<long long>(load.events));
+                result += ",\"seconds\":";
+                appendNumber(result, load.seconds);
+                result += '}';
+            }
+        }
+        result += "],\"attendees\":[";
+        for (size_t i = 0; i < report.attendee_weeks.size() && i < limit; ++i) {
+            const CalendarReport::AttendeeWeek& week = report.attendee_weeks[i];
+            result += i > 0 ? ",{\"name\":" : "{\"name\":";
+            appendString(result, week.attendee);
+            result += ",\"week\":";
+            appendNumber(result, week.week);
+            result += ",\"events\":";
+            appendNumber(result, static_cast<long long>(week.busy.events));
+            result += ",\"busy_seconds\":";
+            appendNumber(result, week.busy.seconds);
+            result += '}';
+        }
+        result += "],\"locations\":[";
+        for (size_t i = 0; i < report.locations.size() && i < limit; ++i) {
+            const CalendarReport::LocationUse& use = report.locations[i];
+            result += i > 0 ? ",{\"name\":" : "{\"name\":";
+            appendString(result, use.location);
+            result += ",\"events\":";
+            appendNumber(result, static_cast<long long>(use.booked.events));
+            result += ",\"booked_seconds\":";
+            appendNumber(result, use.booked.seconds);
+            char share[32];
+            snprintf(share, sizeof(share), ",\"utilization\":%.4f}", use.utilization);
+            result += share;
+        }
+        result += ']';
+        return true;
+    }
+
+    bool exportFile(const Command& command, string& result, string& error) {
+        const string* path = command.get("path");
+        if (!path) {
+            error = "missing path=";
+            return false;
+        }
+        bool everything = !command.get("from") && !command.get("to");
+        time_t from = 0, to = 0;
+        if (!everything && !rangeArgs(command, from, to, error)) return false;
+        size_t written = 0;
+        if (!IcsWriter::exportFile(*path, calendar, from, to, everything, written, error)) return false;
+        result += ",\"exported\":";
+        appendNumber(result, static_cast<long long>(written));
+        return true;
+    }
+
+    // Copies what the command just run changed into the mirror.
+    void publishChanges() {
+        unordered_set<int> seen;
+        vector<Event> changed;
+        vector<int> removed;
+        calendar.forEachChange([&](int id) {
+            if (!seen.insert(id).second) return;
+            const Event* event = calendar.findEvent(id);
+            if (event && !event->isDeleted()) changed.push_back(*event);
+            else removed.push_back(id);
+        });
+        for (int id : removed) mirror->remove(id);
+        if (changed.size() > MIRROR_BATCH) {
+            mirror->addAll(move(changed));
+        } else {
+            for (Event& event : changed) mirror->add(move(event));
+        }
+    }
+
+    bool compact(string& error) {
+        calendar.compact();
+        return !store || store->compact(calendar, error);
+    }
+
+    bool execute(const Command& command, string& result, string& error) {
+        const string& name = command.name;
+        if (name == "add") return add(command, result, error);
+        if (name == "edit") return edit(command, result, error);
+        if (name == "delete") return remove(command, result, error);
+        if (name == "get") return get(command, result, error);
+        if (name == "query") return query(command, result, error);
+        if (name == "day") return day(command, result, error);
+        if (name == "scan") return scan(command, result, error);
+        if (name == "search") return search(command, result, error);
+        if (name == "freebusy") return freeBusy(command, result, error);
+        if (name == "findtime") return findTime(command, result, error);
+        if (name == "overlaps") return overlaps(command, result, error);
+        if (name == "report") return report(command, result, error);
+        if (name == "import") return importFile(command, result, error);
+        if (name == "export") return exportFile(command, result, error);
+        if (name == "compact") return compact(error);
+        if (name == "count") {
+            result += ",\"count\":";
+            appendNumber(result, static_cast<long long>(mirror ? mirror->snapshot().size() : calendar.size()));
+            return true;
+        }
+        error = "unknown command";
+        return false;
+    }
+
+    void flushOutput() {
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        out.flush();
+        buffer.clear();
+    }
+
+public:
+    BatchRunner(Calendar& calendar, CalendarStore* store, ostream& out, bool alloc_stats = false)
+        : calendar(calendar), store(store), mirror(nullptr), out(out), alloc_stats(alloc_stats), line_number(0),
+          executed(0) {}
+
+    // From then on every change is copied into target, which must start
+    // out holding the same events, and the commands readsMirror() names
+    // are answered from it.
+    void mirrorTo(ConcurrentCalendar* target) { mirror = target; }
+
+    // Blank lines and # comments carry no command.
+    static bool isCommand(const string& line) {
+        size_t first = line.find_first_not_of(" \t\r");
+        return first != string::npos && line[first] != '#';
+    }
+
+    // Commands that only touch one event, or nothing at all.
+    static bool isQuick(const string& line) {
+        string name = commandName(line);
+        return name == "add" || name == "edit" || name == "delete" || name == "get" || name == "count";
+    }
+
+    // Commands that leave the calendar and its files alone. Several of
+    // them may run at once, but not alongside any other command.
+    static bool isReadOnly(const string& line) {
+        static const char* const READERS[] = {"get", "query", "day", "scan", "search", "freebusy",
+                                              "findtime", "overlaps", "report", "export", "count"};
+        string name = commandName(line);
+        for (const char* reader : READERS) {
+            if (name == reader) return true;
+        }
+        return false;
+    }
+
+    // Read-only commands answered from a version of the mirror, when there
+    // is one, so that they run alongside anything, writes included.
+    static bool readsMirror(const string& line) {
+        string name = commandName(line);
+        return name == "query" || name == "freebusy" || name == "count";
+    }
+
+    // Executes one command line and appends its JSON object, numbered
+    // number, to response. Returns whether the command succeeded.
+    //
+    // With a store, a command's journal records are written before its
+    // reply is made, and a command whose records cannot be written is
+    // undone and reported as failed, so ok:true means the change is in
+    // the journal file and ok:false means it did not happen. Maintenance
+    // between commands fails on its own, reported on stderr, since the
+    // journal still holds every change it could not fold away.
+    //
+    // Read-only commands (see isReadOnly) may be answered on several
+    // threads at once; any other command must run alone.
+    bool respond(const string& line, size_t number, string& response) {
+        Workspace& work = workspace();
+        Command& command = work.command;
+        string& result = work.result;
+        string& error = work.error;
+        result.clear();
+        error.clear();
+        uint64_t allocations = allocationCount();
+        bool ok;
+        bool writes = !isReadOnly(line);
+        bool tracked = writes && (store || mirror);
+        if (store && writes) store->beginCommand();
+        if (tracked) calendar.recordChanges();
+        {
+            ScratchArena::Scope scratch;
+            ok = tokenize(line, command, error) && execute(command, result, error);
+        }
+        if (tracked) {
+            string unsaved;
+            calendar.takeJournalError(unsaved);  // commit() retries what could not be written then
+            if (store && !store->commit(unsaved)) {
+                calendar.undoChanges();
+                if (ok) error = "not saved, so not applied: " + unsaved;
+                ok = false;
+            } else if (mirror) {
+                publishChanges();
+            }
+            calendar.stopRecording();
+        }
+        if (writes && ++executed % MAINTAIN_EVERY == 0) {
+            calendar.compactIfNeeded();
+            string failure;
+            if (store && !store->maintain(calendar, failure)) cerr << "Maintenance failed: " << failure << "\n";
+        }
+        allocations = allocationCount() - allocations;
+        response += "{\"ok\":";
+        response += ok ? "true" : "false";
+        response += ",\"line\":";
+        appendNumber(response, static_cast<long long>(number));
+        response += ",\"op\":";
+        appendString(response, command.name);
+        if (alloc_stats) {
+            response += ",\"allocations\":";
+            appendNumber(response, static_cast<long long>(allocations));
+        }
+        if (ok) {
+            response += result;
+        } else {
+            response += ",\"error\":";
+            appendString(response, error);
+        }
+        response += "}\n";
+        return ok;
+    }
+
+    // Runs every command in the stream and returns how many failed.
+    size_t run(istream& in) {
+        string line;
+        size_t failed = 0;
+        while (getline(in, line)) {
+            ++line_number;
+            if (!isCommand(line)) continue;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!respond(line, line_number, buffer)) ++failed;
+            if (buffer.size() >= OUTPUT_FLUSH) flushOutput();
+        }
+        flushOutput();
+        return failed;
+    }
+};
+
+// ==================== Local Server ====================
+// Where the server listens: a Unix domain socket, or a TCP port on the
+// loopback interface only.
+struct ServerAddress {
+    string unix_path;  // empty for TCP
+    int port = 0;
+
+    // A path containing '/' names a Unix socket; anything else is
+    // [localhost:|127.0.0.1:]PORT.
+    static bool parse(const string& text, ServerAddress& address, string& error) {
+        address = ServerAddress();
+        if (text.find('/') != string::npos) {
+            address.unix_path = text;
+            return true;
+        }
+        string port = text;
+        for (const char* host : {"localhost:", "127.0.0.1:"}) {
+            if (port.compare(0, strlen(host), host) == 0) port.erase(0, strlen(host));
+        }
+        address.port = safeStoi(port, -1);
+        if (port.empty() || !all_of(port.begin(), port.end(), ::isdigit) || address.port <= 0 || address.port > 65535) {
+            error = "expected a socket path or a port, not " + text;
+            return false;
+        }
+        return true;
+    }
+
+    string describe() const {
+        return unix_path.empty() ? "127.0.0.1:" + to_string(port) : unix_path;
+    }
+
+#ifdef CALENDAR_SERVER
+    // A non-blocking listening socket, or -1 with error set. A stale Unix
+    // socket file, one nothing answers on, is replaced.
+    int openListener(string& error) const {
+        int fd;
+        if (!unix_path.empty()) {
+            sockaddr_un address{};
+            if (!unixAddress(address, error)) return -1;
+            string unused;
+            int probe = openConnection(unused);
+            if (probe >= 0) {
+                ::close(probe);
+                error = unix_path + " is already served";
+                return -1;
+            }
+            struct stat info;
+            if (lstat(unix_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(unix_path.c_str());
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                error = "cannot bind " + unix_path + ": " + strerror(errno);
+                if (fd >= 0) ::close(fd);
+                return -1;
+            }
+        } else {
+            sockaddr_in address = loopback();
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int on = 1;
+            if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                error = "cannot bind " + describe() + ": " + strerror(errno);
+                if (fd >= 0) ::close(fd);
+                return -1;
+            }
+        }
+        if (::listen(fd, SOMAXCONN) != 0) {
+            error = string("cannot listen: ") + strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // A blocking connection to a server, or -1 with error set.
+    int openConnection(string& error) const {
+        int fd;
+        int result;
+        if (!unix_path.empty()) {
+            sockaddr_un address{};
+            if (!unixAddress(address, error)) return -1;
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            result = fd < 0 ? -1 : ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        } else {
+            sockaddr_in address = loopback();
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            result = fd < 0 ? -1 : ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            int on = 1;
+            if (result == 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        if (result != 0) {
+            error = "cannot connect to " + describe() + ": " + strerror(errno);
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+private:
+    bool unixAddress(sockaddr_un& address, string& error) const {
+        if (unix_path.size() >= sizeof(address.sun_path)) {
+            error = "socket path too long: " + unix_path;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, unix_path.c_str(), unix_path.size() + 1);
+        return true;
+    }
+
+    sockaddr_in loopback() const {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+#endif
+};
+
+#ifdef CALENDAR_SERVER
+// Serves batch commands to local clients: a client writes command lines
+// and reads one JSON object per line back, numbered by its line on the
+// connection and in the order sent. Connections stay open between
+// requests, and a client may pipeline as many as it likes.
+//
+// One thread runs a non-blocking epoll loop doing all socket I/O.
+// Commands that touch a single event run right there if the calendar is
+// free; everything else, and quick commands the calendar is busy for, go
+// to a worker pool with at most max_queued commands handed over at once.
+// Range queries, free/busy and counts read a version of a
+// ConcurrentCalendar copy of the calendar, so they never wait, not even
+// for writes. Other queries share the calendar, and the workers answer
+// them side by side. A command that changes the calendar waits for those
+// and runs alone, then copies its changes into the mirror.
+// Each connection has one command in flight at a time, so its replies
+// stay in order and its queries see its own writes; lines it sends
+// meanwhile wait in its buffer, and a connection that stops reading its
+// replies stops being served.
+class CalendarServer {
+private:
+    static const size_t MAX_LINE = 1 << 20;      // longest command accepted
+    static const size_t MAX_BUFFERED = 4 << 20;  // unhandled input or unsent output before pausing
+    static constexpr int IDLE_SECONDS = 300;      // idle connections are closed after this
+    static const uint64_t LISTENER = ~0ULL;       // epoll tags that are not connections
+    static const uint64_t WAKE = ~0ULL - 1;
+    static const uint64_t SIGNAL = ~0ULL - 2;
+
+    struct Connection {
+        uint64_t id;
+        int fd;
+        string inbox;
+        size_t inbox_used = 0;  // bytes of inbox already handled
+        string outbox;
+        size_t outbox_sent = 0;
+        size_t lines = 0;       // replies carry the line number, as in batch mode
+        bool busy = false;      // a command is with the workers
+        bool peer_closed = false;
+        bool watched = true;    // in the epoll set
+        uint32_t interest = 0;
+        chrono::steady_clock::time_point last_active;
+    };
+
+    struct Reply {
+        uint64_t connection;
+        string text;
+    };
+
+    Calendar& calendar;
+    BatchRunner runner;
+    ConcurrentCalendar mirror;    // what range queries read; writers copy their changes in
+    shared_mutex calendar_lock;   // shared by other queries, exclusive for anything else
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;                  // workers signal finished commands here
+    int signal_fd;                // SIGINT and SIGTERM stop the loop
+    string unix_path;             // removed on the way out
+    size_t max_queued;
+    size_t queued;                // commands with the workers
+    uint64_t next_id;
+    unordered_map<uint64_t, unique_ptr<Connection>> connections;
+    vector<uint64_t> waiting;     // held back while the workers were full
+    mutex replies_lock;
+    vector<Reply> replies;        // finished by workers, not yet collected
+    size_t accepted;
+    size_t served;
+    unique_ptr<ThreadPool> workers;
+
+    void watch(int fd, uint64_t tag, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void closeConnection(Connection& c) {
+        ::close(c.fd);  // also leaves the epoll set
+        connections.erase(c.id);
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));  // fails harmlessly on Unix sockets
+            unique_ptr<Connection> c(new Connection());
+            c->id = next_id++;
+            c->fd = fd;
+            c->interest = EPOLLIN | EPOLLRDHUP;
+            c->last_active = chrono::steady_clock::now();
+            watch(fd, c->id, c->interest);
+            connections.emplace(c->id, move(c));
+            ++accepted;
+        }
+    }
+
+    // Reads what has arrived; false if the connection failed.
+    bool receive(Connection& c) {
+        char chunk[64 * 1024];
+        while (c.inbox.size() - c.inbox_used < MAX_BUFFERED) {
+            ssize_t got = recv(c.fd, chunk, sizeof(chunk), 0);
+            if (got > 0) {
+                c.inbox.append(chunk, static_cast<size_t>(got));
+                c.last_active = chrono::steady_clock::now();
+                continue;
+            }
+            if (got == 0) {
+                c.peer_closed = true;
+                return true;
+            }
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        return true;
+    }
+
+    // Writes pending replies; false if the connection failed.
+    bool transmit(Connection& c) {
+        while (c.outbox_sent < c.outbox.size()) {
+            ssize_t sent = send(c.fd, c.outbox.data() + c.outbox_sent, c.outbox.size() - c.outbox_sent, MSG_NOSIGNAL);
+            if (sent > 0) {
+                c.outbox_sent += static_cast<size_t>(sent);
+                continue;
             }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            return false;
+        }
+        c.outbox.clear();
+        c.outbox_sent = 0;
+        return true;
+    }
+
+    // Runs a command under the lock it needs: none for those the mirror
+    // answers, shared for other queries and exclusive for the rest.
+    void respond(const string& line, size_t number, string& out) {
+        if (BatchRunner::readsMirror(line)) {
+            runner.respond(line, number, out);
+        } else if (BatchRunner::isReadOnly(line)) {
+            shared_lock<shared_mutex> guard(calendar_lock);
+            runner.respond(line, number, out);
         } else {
-            end = start + 3600; // Default 1 hour if not specified
+            lock_guard<shared_mutex> guard(calendar_lock);
+            runner.respond(line, number, out);
         }
     }
 
-    string desc = getInput("Description (optional): ");
-    string loc = getInput("Location (optional): ");
-    
-    // Set color based on priority
-    Color color;
-    switch (priority) {
-        case Priority::LOW: color = Color::BLUE; break;
-        case Priority::MEDIUM: color = Color::GREEN; break;
-        case Priority::HIGH: color = Color::RED; break;
+    void dispatch(Connection& c, string line) {
+        c.busy = true;
+        ++queued;
+        uint64_t id = c.id;
+        size_t number = c.lines;
+        workers->submit([this, id, number, line = move(line)]() {
+            Reply reply{id, string()};
+            respond(line, number, reply.text);
+            {
+                lock_guard<mutex> guard(replies_lock);
+                replies.push_back(move(reply));
+            }
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof(one)) < 0) {}  // the counter only overflows after 2^64 - 1 wakes
+        });
     }
-    cout << "Auto-selected color: " << getColorCode(color) 
-         << toString(color) << TermColor::RESET << "\n";
 
-    vector<string> attendees = promptAttendees();
+    // Answers a quick command right away unless the calendar is locked
+    // against it, in which case it goes to the workers instead.
+    bool tryRespond(const string& line, Connection& c) {
+        if (BatchRunner::readsMirror(line)) {
+            runner.respond(line, ++c.lines, c.outbox);
+        } else if (BatchRunner::isReadOnly(line)) {
+            shared_lock<shared_mutex> guard(calendar_lock, try_to_lock);
+            if (!guard.owns_lock()) return false;
+            runner.respond(line, ++c.lines, c.outbox);
+        } else {
+            unique_lock<shared_mutex> guard(calendar_lock, try_to_lock);
+            if (!guard.owns_lock()) return false;
+            runner.respond(line, ++c.lines, c.outbox);
+        }
+        return true;
+    }
 
-    Event new_event(title, start, end, color, priority, desc,loc, attendees);
-    calendar.addEvent(new_event);
+    // Runs the complete lines waiting in the inbox, stopping at one handed
+    // to the workers.
+    void handleLines(Connection& c) {
+        while (!c.busy && c.outbox.size() - c.outbox_sent < MAX_BUFFERED) {
+            size_t end = c.inbox.find('\n', c.inbox_used);
+            if (end == string::npos) {
+                if (c.inbox.size() - c.inbox_used > MAX_LINE) {
+                    c.outbox += "{\"ok\":false,\"error\":\"line too long\"}\n";
+                    c.inbox.clear();
+                    c.inbox_used = 0;
+                    c.peer_closed = true;  // no way to find the next line; close once the reply is out
+                }
+                break;
+            }
+            size_t start = c.inbox_used;
+            size_t length = end - start;
+            if (length > 0 && c.inbox[end - 1] == '\r') --length;
+            string line = c.inbox.substr(start, length);
+            if (BatchRunner::isCommand(line) && BatchRunner::isQuick(line) && tryRespond(line, c)) {
+                c.inbox_used = end + 1;
+                ++served;
+                continue;
+            }
+            if (BatchRunner::isCommand(line) && queued >= max_queued) {
+                waiting.push_back(c.id);
+                break;
+            }
+            c.inbox_used = end + 1;
+            ++c.lines;
+            if (BatchRunner::isCommand(line)) dispatch(c, move(line));
+        }
+        if (c.inbox_used == c.inbox.size() || c.inbox_used >= MAX_LINE) {
+            c.inbox.erase(0, c.inbox_used);
+            c.inbox_used = 0;
+        }
+    }
 
-    cout << TermColor::GREEN << "\nEvent added successfully with ID: " 
-         << new_event.id << "!" << TermColor::RESET << "\n";
-    waitForEnter();
-}
-void editEvent() {
-    clearScreen();
-    cout << TermColor::BOLD << "=== Edit Event ===" << TermColor::RESET << "\n\n";
-    
-    int id = safeStoi(getInput("Enter event ID to edit: "), -1);
-    Event* event = calendar.findEvent(id);
-    if (!event) {
-        cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
-        waitForEnter();
-        return;
+    // Handles what the connection has sent, writes what is ready and
+    // settles what to wait for next. May close the connection.
+    void service(Connection& c) {
+        handleLines(c);
+        if (!transmit(c)) {
+            closeConnection(c);
+            return;
+        }
+        bool drained = c.inbox.find('\n', c.inbox_used) == string::npos;
+        if (c.peer_closed && !c.busy && drained && c.outbox.empty()) {
+            closeConnection(c);
+            return;
+        }
+        uint32_t interest = 0;
+        if (!c.peer_closed && c.inbox.size() - c.inbox_used < MAX_BUFFERED) interest |= EPOLLIN | EPOLLRDHUP;
+        if (!c.outbox.empty()) interest |= EPOLLOUT;
+        if (interest == 0 && c.peer_closed) {
+            // Nothing to wait for from the socket, which would otherwise
+            // keep reporting the hang-up; the workers or the queue bound
+            // bring the connection back.
+            if (c.watched) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+            c.watched = false;
+            return;
+        }
+        if (interest != c.interest || !c.watched) {
+            epoll_event event{};
+            event.events = interest;
+            event.data.u64 = c.id;
+            epoll_ctl(epoll_fd, c.watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c.fd, &event);
+            c.interest = interest;
+            c.watched = true;
+        }
     }
-    
-    // Show current details
-    cout << "Current details:\n";
-    event->printDetails();
-    cout << "\nLeave blank to keep current value.\n";
-    
-    // Edit title
-    string new_title = getInput("New title [" + event->title + "]: ");
-    if (!new_title.empty()) event->title = new_title;
-    
-    // Edit start time
-    string current_start = event->is_all_day ? dateToString(event->start_time) : timeToString(event->start_time);
-    string start_input = getInput("New start time [" + current_start + "]: ");
-    if (!start_input.empty()) {
-        time_t new_start = stringToTime(start_input, event->is_all_day ? "%Y-%m-%d" : "%Y-%m-%d %H:%M");
-        if (new_start != 0) {
-            time_t duration = event->end_time - event->start_time;
-            event->start_time = new_start;
-            event->end_time = new_start + duration;
-        } else {
-            cout << "Invalid time format, keeping original.\n";
+
+    void collectReplies() {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0) {}  // already reset by an earlier read
+        vector<Reply> finished;
+        {
+            lock_guard<mutex> guard(replies_lock);
+            finished.swap(replies);
+        }
+        for (Reply& reply : finished) {
+            --queued;
+            ++served;
+            auto it = connections.find(reply.connection);
+            if (it == connections.end()) continue;  // gone while its command ran
+            Connection& c = *it->second;
+            c.busy = false;
+            c.outbox += reply.text;
+            c.last_active = chrono::steady_clock::now();
+            service(c);
+        }
+        vector<uint64_t> retry;
+        retry.swap(waiting);
+        for (uint64_t id : retry) {
+            auto it = connections.find(id);
+            if (it != connections.end()) service(*it->second);
         }
     }
-    
-    // Edit end time (if not all-day)
-    if (!event->is_all_day) {
-        string end_input = getInput("New end time [" + timeToString(event->end_time) + "]: ");
-        if (!end_input.empty()) {
-            time_t new_end = stringToTime(end_input, "%Y-%m-%d %H:%M");
-            if (new_end != 0 && new_end > event->start_time) {
-                event->end_time = new_end;
-            } else {
-                cout << "Invalid time or before start time, keeping original.\n";
-            }
+
+    void closeIdle() {
+        auto cutoff = chrono::steady_clock::now() - chrono::seconds(IDLE_SECONDS);
+        vector<Connection*> idle;
+        for (auto& entry : connections) {
+            if (!entry.second->busy && entry.second->last_active < cutoff) idle.push_back(entry.second.get());
         }
+        for (Connection* c : idle) closeConnection(*c);
     }
-    
-    // Edit priority and color
-    cout << "Current priority: " << toString(event->priority) << "\n";
-    string priority_input = getInput("Change priority? (y/n) [n]: ");
-    if (toLower(priority_input) == "y") {
-        Priority old_priority = event->priority;
-        event->priority = promptPriority();
-        
-        // Update color if priority changed
-        if (event->priority != old_priority) {
-            switch (event->priority) {
-                case Priority::LOW: event->color = Color::BLUE; break;
-                case Priority::MEDIUM: event->color = Color::GREEN; break;
-                case Priority::HIGH: event->color = Color::RED; break;
+
+public:
+    CalendarServer(Calendar& calendar, CalendarStore* store, size_t worker_count)
+        : calendar(calendar), runner(calendar, store, cout), epoll_fd(-1), listen_fd(-1), wake_fd(-1),
+          signal_fd(-1), max_queued(4 * max<size_t>(1, worker_count)), queued(0), next_id(0),
+          accepted(0), served(0), workers(new ThreadPool(worker_count)) {
+        mirror.addAll(calendar);
+        runner.mirrorTo(&mirror);
+    }
+
+    ~CalendarServer() {
+        workers.reset();  // finishes what it was given while the descriptors are still open
+        for (auto& entry : connections) ::close(entry.second->fd);
+        for (int fd : {epoll_fd, listen_fd, wake_fd, signal_fd}) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    CalendarServer(const CalendarServer&) = delete;
+    CalendarServer& operator=(const CalendarServer&) = delete;
+
+    size_t acceptedCount() const { return accepted; }
+    size_t servedCount() const { return served; }
+
+    // Starts listening on address and sets up the event loop.
+    bool open(const ServerAddress& address, string& error) {
+        listen_fd = address.openListener(error);
+        if (listen_fd < 0) return false;
+        unix_path = address.unix_path;
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signal_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0 || signal_fd < 0) {
+            error = string("cannot set up the event loop: ") + strerror(errno);
+            return false;
+        }
+        watch(listen_fd, LISTENER, EPOLLIN);
+        watch(wake_fd, WAKE, EPOLLIN);
+        watch(signal_fd, SIGNAL, EPOLLIN);
+        return true;
+    }
+
+    // Serves until SIGINT or SIGTERM, which the caller must have blocked
+    // in every thread, then lets the commands with the workers finish.
+    bool run(string& error) {
+        epoll_event events[128];
+        auto last_sweep = chrono::steady_clock::now();
+        bool stopping = false;
+        while (!stopping || queued > 0) {
+            int ready = epoll_wait(epoll_fd, events, 128, 1000);
+            if (ready < 0 && errno != EINTR) {
+                error = string("epoll_wait failed: ") + strerror(errno);
+                break;
+            }
+            for (int i = 0; i < ready; ++i) {
+                uint64_t tag = events[i].data.u64;
+                if (tag == LISTENER) {
+                    if (!stopping) acceptAll();
+                } else if (tag == WAKE) {
+                    collectReplies();
+                } else if (tag == SIGNAL) {
+                    stopping = true;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+                } else {
+                    auto it = connections.find(tag);
+                    if (it == connections.end()) continue;  // closed earlier in this batch
+                    Connection& c = *it->second;
+                    if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !receive(c)) {
+                        closeConnection(c);
+                        continue;
+                    }
+                    service(c);
+                }
+            }
+            auto now = chrono::steady_clock::now();
+            if (now - last_sweep >= chrono::seconds(1)) {
+                closeIdle();
+                last_sweep = now;
             }
-            cout << "Color updated to: " << getColorCode(event->color) 
-                 << toString(event->color) << TermColor::RESET << "\n";
         }
+        if (!unix_path.empty()) unlink(unix_path.c_str());
+        return error.empty();
     }
-    
-    // Edit description
-    string new_desc = getInput("New description [" + event->description + "]: ");
-    if (!new_desc.empty()) event->description = new_desc;
-    
-    // Edit location
-    string new_loc = getInput("New location [" + event->location + "]: ");
-    if (!new_loc.empty()) event->location = new_loc;
-    
-    // Edit attendees
-    cout << "Current attendees: ";
-    if (event->attendees.empty()) {
-        cout << "None\n";
-    } else {
-        for (const auto& name : event->attendees) cout << name << ", ";
-        cout << "\n";
+};
+#endif
+
+// ==================== Main Function ====================
+// calendar [--calendar PATH]... [--batch [FILE] [--memory] [--alloc-stats]]
+// calendar --stress [SECONDS]
+// calendar --selftest
+// calendar [--calendar PATH] --serve ADDRESS [--workers N]
+// calendar --load ADDRESS [SECONDS] [--connections N] [--pipeline N] [--writes PERCENT]
+// Without --batch the interactive UI starts, overlaying every --calendar
+// given (calendar.snap when there are none). --batch reads commands from
+// FILE, or stdin when it is omitted or "-", against a single calendar, and
+// exits with 1 if any command failed; --memory runs it without loading or
+// saving a calendar, and --alloc-stats adds each command's heap allocation
+// count to its result (those made on the thread running it, so not a
+// report's workers). --stress measures ConcurrentCalendar's read
+// throughput per thread count, SECONDS (default 1) per step, and
+// --selftest checks it against Calendar over a fixed run. --serve
+// takes batch commands from local clients (see CalendarServer) on a Unix
+// socket path or a loopback TCP port, and --load measures a running
+// server's throughput and latency for SECONDS (default 5).
+int runBatch(const string& snapshot_path, const string& input_path, bool memory, bool alloc_stats) {
+    ios::sync_with_stdio(false);
+    ifstream file;
+    if (input_path != "-") {
+        file.open(input_path);
+        if (!file) {
+            cerr << "Cannot open " << input_path << "\n";
+            return 2;
+        }
     }
-    string att_input = getInput("Edit attendees? (y/n) [n]: ");
-    if (toLower(att_input) == "y") {
-        event->attendees = promptAttendees();
+    istream& in = input_path == "-" ? cin : file;
+
+    Calendar calendar;
+    // Commits are grouped and background snapshots are spaced further
+    // apart than in the UI, since each one rewrites the whole calendar;
+    // close() still leaves everything on disk when the run ends.
+    CalendarStore store(snapshot_path, Journal::Options{4096, 16}, 64u << 20);
+    if (!memory) {
+        size_t replayed = 0;
+        string error;
+        if (!store.open(calendar, replayed, error)) {
+            cerr << "Could not load " << snapshot_path << ": " << error << "\n";
+            return 2;
+        }
     }
-    
-    // Edit all-day status
-    string all_day_input = getInput("All-day event? (current: " + string(event->is_all_day ? "Yes" : "No") + ") (y/n) [" + (event->is_all_day ? "y" : "n") + "]: ");
-    if (!all_day_input.empty()) {
-        event->is_all_day = (toLower(all_day_input) == "y");
+
+    time_t started = time(nullptr);
+    BatchRunner runner(calendar, memory ? nullptr : &store, cout, alloc_stats);
+    size_t failed = runner.run(in);
+
+    string error;
+    if (!memory && !store.close(calendar, error)) {
+        cerr << "Could not compact " << snapshot_path << ": " << error << " (the journal still holds every change)\n";
     }
-    
-    // Edit recurrence
-    if (event->is_recurring) {
-        string recur_input = getInput("Current recurrence: " + event->recurrence_pattern + "\nChange recurrence pattern? (y/n) [n]: ");
-        if (toLower(recur_input) == "y") {
-            event->recurrence_pattern = getInput("New recurrence pattern (Daily/Weekly/Monthly): ");
+    cerr << "Batch finished in " << (time(nullptr) - started) << "s, " << failed << " failed, "
+         << calendar.size() << " events\n";
+    return failed == 0 ? 0 : 1;
+}
+
+// Read throughput of ConcurrentCalendar with 1, 2, 4... reader threads up
+// to the core count, while one writer keeps adding and removing events.
+// Each reader checks that its results are ordered and in range, and now
+// and then that re-reading its snapshot gives the same answer.
+int runStress(int seconds) {
+    const int EVENTS = 200000;
+    const time_t YEAR = 365 * 86400;
+    const time_t WEEK = 7 * 86400;
+    time_t base = localDayStart(localDayNumber(time(nullptr)));
+
+    ConcurrentCalendar calendar;
+    mt19937_64 random(42);
+    vector<Event> events;
+    events.reserve(EVENTS);
+    for (int i = 0; i < EVENTS; ++i) {
+        time_t start = base + static_cast<time_t>(random() % YEAR) / 900 * 900;
+        events.emplace_back("Load " + to_string(i), start, start + 900 * static_cast<time_t>(1 + random() % 8));
+        if (i % 1000 == 0) {
+            events.back().is_recurring = true;
+            events.back().recurrence_pattern = "Weekly";
         }
-    } else {
-        string recur_input = getInput("Make this a recurring event? (y/n) [n]: ");
-        if (toLower(recur_input) == "y") {
-            event->is_recurring = true;
-            event->recurrence_pattern = getInput("Recurrence pattern (Daily/Weekly/Monthly): ");
+    }
+    calendar.addAll(move(events));
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    cout << "Stress: " << EVENTS << " events, one-week range queries, one writer, " << cores << " cores\n";
+    cout << "readers     queries/s   speedup    writes/s\n";
+    double single = 0;
+    uint64_t failures = 0;
+    for (unsigned readers = 1;; readers = min(readers * 2, cores)) {
+        atomic<bool> stop{false};
+        atomic<uint64_t> queries{0}, writes{0}, failed{0};
+        vector<thread> threads;
+        for (unsigned r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r]() {
+                // What a read saw, to hold the same snapshot's second read to.
+                struct Seen {
+                    const Event* event;
+                    int id;
+                    time_t start;
+                    time_t end;
+                    uint32_t title;
+                };
+                mt19937_64 rng(r + 1);
+                uint64_t done = 0, bad = 0;
+                while (!stop.load(memory_order_relaxed)) {
+                    ScratchArena::Scope scratch;
+                    ConcurrentCalendar::Snapshot snapshot = calendar.snapshot();
+                    time_t from = base + static_cast<time_t>(rng() % YEAR);
+                    time_t to = from + WEEK;
+                    time_t last = numeric_limits<time_t>::min();
+                    bool reread = done % 16 == 0;
+                    pmr::vector<Seen> seen(ScratchArena::resource());
+                    for (const Occurrence& o : snapshot.eventsBetween(from, to)) {
+                        if (o.start_time < last || o.start_time > to || o.end_time < from) ++bad;
+                        last = o.start_time;
+                        if (reread) seen.push_back(Seen{o.event, o.event->id, o.start_time, o.end_time, o.event->title.id()});
+                    }
+                    if (reread) {
+                        // Every field again, so a torn or stale read shows up
+                        // even when the number of events happens to match.
+                        size_t i = 0;
+                        for (const Occurrence& o : snapshot.eventsBetween(from, to)) {
+                            if (i >= seen.size()) {
+                                ++bad;
+                                break;
+                            }
+                            const Seen& was = seen[i++];
+                            if (o.event != was.event || o.event->id != was.id || o.start_time != was.start ||
+                                o.end_time != was.end || o.event->title.id() != was.title) {
+                                ++bad;
+                            }
+                        }
+                        if (i != seen.size()) ++bad;
+                    }
+                    ++done;
+                }
+                queries += done;
+                failed += bad;
+            });
         }
+        thread writer([&]() {
+            mt19937_64 rng(readers);
+            deque<int> added;
+            uint64_t done = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                time_t start = base + static_cast<time_t>(rng() % YEAR) / 900 * 900;
+                added.push_back(calendar.add(Event("Write", start, start + 1800)));
+                if (added.size() > 1000) {
+                    calendar.remove(added.front());
+                    added.pop_front();
+                }
+                ++done;
+            }
+            for (int id : added) calendar.remove(id);
+            writes = done;
+        });
+
+        auto started = chrono::steady_clock::now();
+        this_thread::sleep_for(chrono::seconds(seconds));
+        stop = true;
+        for (thread& t : threads) t.join();
+        writer.join();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+        double rate = queries / elapsed;
+        if (readers == 1) single = rate;
+        failures += failed;
+        cout << setw(7) << readers << setw(14) << fixed << setprecision(0) << rate << setw(9) << setprecision(2)
+             << rate / single << "x" << setw(12) << setprecision(0) << writes / elapsed << "\n";
+        if (readers == cores) break;
     }
-    
-    cout << TermColor::GREEN << "\nEvent updated successfully!" << TermColor::RESET << "\n";
-    waitForEnter();
+
+    uint64_t freed = 0;
+    size_t waiting = 0;
+    calendar.reclamation(freed, waiting);
+    cout << "Versions reclaimed: " << freed << " (" << waiting << " still held)\n";
+    if (failures > 0) {
+        cout << failures << " inconsistent reads\n";
+        return 1;
+    }
+    cout << "All reads consistent\n";
+    return 0;
 }
-    
 
-    void deleteEvent() {
-        clearScreen();
-        cout << TermColor::BOLD << "=== Delete Event ===" << TermColor::RESET << "\n\n";
+// Deterministic check of ConcurrentCalendar against Calendar. Both get
+// the same seeded run of adds, same-id replacements, edits, removals and
+// bulk loads, and every few steps the same range queries must return the
+// same occurrences. A snapshot pinned halfway must still return what it
+// first saw once the run is over. Prints the first difference and returns
+// 1 on any mismatch.
+int runSelftest() {
+    const int STEPS = 6000;
+    const int CHECK_EVERY = 25;
+    const time_t SPAN = 90 * 86400;
+    const time_t base = localTimeFromCivil(2026, 1, 5);
 
-        int id = safeStoi(getInput("Enter event ID to delete: "), -1);
-        if (calendar.deleteEvent(id)) {
-            cout << TermColor::GREEN << "Event deleted successfully!" << TermColor::RESET << "\n";
-        } else {
-            cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
+    typedef tuple<int, time_t, time_t, string> Seen;
+    auto read = [](const auto& view) {
+        vector<Seen> seen;
+        for (const Occurrence& o : view) seen.emplace_back(o.event->id, o.start_time, o.end_time, o.event->title.str());
+        return seen;
+    };
+    auto report = [](const string& what, const vector<Seen>& expected, const vector<Seen>& actual) {
+        cout << "Selftest failed: " << what << ": expected " << expected.size() << " occurrences, got "
+             << actual.size() << "\n";
+        for (size_t i = 0; i < max(expected.size(), actual.size()); ++i) {
+            if (i < expected.size() && i < actual.size() && expected[i] == actual[i]) continue;
+            if (i < expected.size()) {
+                cout << "  expected #" << i << ": id " << get<0>(expected[i]) << " at " << get<1>(expected[i])
+                     << "-" << get<2>(expected[i]) << " \"" << get<3>(expected[i]) << "\"\n";
+            }
+            if (i < actual.size()) {
+                cout << "  got      #" << i << ": id " << get<0>(actual[i]) << " at " << get<1>(actual[i])
+                     << "-" << get<2>(actual[i]) << " \"" << get<3>(actual[i]) << "\"\n";
+            }
+            break;
         }
-        waitForEnter();
-    }
+        return 1;
+    };
 
-    
-void viewEventDetails() {
-    clearScreen();
-    cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << "\n\n";
+    mt19937_64 random(7);
+    auto pick = [&random](size_t n) { return static_cast<size_t>(random() % n); };
+    auto fresh = [&]() {
+        time_t start = base + static_cast<time_t>(pick(static_cast<size_t>(SPAN))) / 900 * 900;
+        Event event("Event", start, start + 900 * static_cast<time_t>(1 + pick(12)));
+        if (pick(20) == 0) {
+            event.is_recurring = true;
+            event.recurrence_pattern = pick(2) ? "Weekly" : "Daily;count=5";
+        }
+        return event;
+    };
+    auto reshape = [&](Event& event) {
+        event.title = "Edit " + to_string(pick(1000));
+        if (pick(2)) {
+            event.start_time = base + static_cast<time_t>(pick(static_cast<size_t>(SPAN))) / 900 * 900;
+            event.end_time = event.start_time + 900 * static_cast<time_t>(1 + pick(12));
+        }
+        if (pick(10) == 0) {
+            event.is_recurring = !event.is_recurring;
+            event.recurrence_pattern = event.is_recurring ? "Weekly" : "";
+        }
+    };
 
-    int id = safeStoi(getInput("Enter event ID to view: "), -1);
-    Event* event = calendar.findEvent(id);
-    if (event) {
-        string color_code = getColorCode(event->color);
-        cout << TermColor::BOLD << "=== Event Details ===" << TermColor::RESET << endl;
-        cout << color_code << "Title: " << event->title << TermColor::RESET << endl;
-        cout << "Time: ";
-        if (event->is_all_day) {
-            cout << dateToString(event->start_time) << " (All Day)";
+    Calendar reference;
+    ConcurrentCalendar concurrent;
+    vector<int> ids;  // every id handed out, removed ones included
+    unique_ptr<ConcurrentCalendar::Snapshot> pinned;
+    vector<pair<time_t, time_t>> pinned_ranges;
+    vector<vector<Seen>> pinned_seen;
+    size_t checks = 0;
+
+    auto compare = [&](const string& when) {
+        ConcurrentCalendar::Snapshot snapshot = concurrent.snapshot();
+        if (snapshot.size() != reference.size()) {
+            cout << "Selftest failed: " << when << ": " << snapshot.size() << " events, expected "
+                 << reference.size() << "\n";
+            return false;
+        }
+        for (int i = 0; i < 4; ++i) {
+            time_t from = base - 86400 + static_cast<time_t>(pick(static_cast<size_t>(SPAN)));
+            time_t to = from + static_cast<time_t>(pick(30 * 86400));
+            vector<Seen> expected = read(reference.eventsBetween(from, to));
+            vector<Seen> actual = read(snapshot.eventsBetween(from, to));
+            ++checks;
+            if (actual != expected) {
+                report(when + ", range " + to_string(from) + "-" + to_string(to), expected, actual);
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (int step = 1; step <= STEPS; ++step) {
+        ScratchArena::Scope scratch;
+        size_t op = pick(100);
+        if (op < 35 || ids.empty()) {
+            Event event = fresh();
+            ids.push_back(event.id);
+            reference.addEvent(event);
+            concurrent.add(event);
+        } else if (op < 50) {
+            // An add under a stored id replaces that event in both.
+            int id = ids[pick(ids.size())];
+            const Event* stored = reference.findEvent(id);
+            if (!stored) continue;
+            Event event = *stored;
+            reshape(event);
+            reference.addEvent(event);
+            concurrent.add(event);
+        } else if (op < 70) {
+            int id = ids[pick(ids.size())];
+            const Event* stored = reference.findEvent(id);
+            Event event = stored ? *stored : Event::withId(id);
+            reshape(event);
+            bool expected = reference.updateEvent(event);
+            if (concurrent.update(event) != expected) {
+                cout << "Selftest failed: step " << step << ": update of id " << id << " disagrees\n";
+                return 1;
+            }
+        } else if (op < 95) {
+            int id = ids[pick(ids.size())];
+            bool expected = reference.deleteEvent(id);
+            if (concurrent.remove(id) != expected) {
+                cout << "Selftest failed: step " << step << ": removal of id " << id << " disagrees\n";
+                return 1;
+            }
         } else {
-            cout << timeToString(event->start_time) << " to " << timeToString(event->end_time);
+            // Bulk load with ids repeated inside the batch and already stored.
+            vector<Event> batch;
+            for (int i = 0; i < 50; ++i) {
+                if (!batch.empty() && pick(10) == 0) {
+                    batch.push_back(batch[pick(batch.size())]);
+                    reshape(batch.back());
+                } else if (const Event* stored = pick(10) == 0 ? reference.findEvent(ids[pick(ids.size())]) : nullptr) {
+                    batch.push_back(*stored);
+                    reshape(batch.back());
+                } else {
+                    batch.push_back(fresh());
+                    ids.push_back(batch.back().id);
+                }
+            }
+            concurrent.addAll(batch);
+            reference.addEvents(move(batch));
         }
-        cout << "\nPriority: " << toString(event->priority);
-        cout << "\nColor: " << color_code << toString(event->color) << TermColor::RESET;
-        if (!event->location.empty()) cout << "\nLocation: " << event->location;
-        if (!event->description.empty()) cout << "\nDescription: " << event->description;
-        if (!event->attendees.empty()) {
-            cout << "\nAttendees: ";
-            for (const auto& name : event->attendees) cout << name << ", ";
+        reference.compactIfNeeded();
+
+        if (step == STEPS / 2) {
+            pinned.reset(new ConcurrentCalendar::Snapshot(concurrent.snapshot()));
+            for (int i = 0; i < 8; ++i) {
+                time_t from = base + static_cast<time_t>(pick(static_cast<size_t>(SPAN)));
+                pinned_ranges.emplace_back(from, from + 14 * 86400);
+                pinned_seen.push_back(read(pinned->eventsBetween(from, from + 14 * 86400)));
+            }
         }
-        cout << "\nAll-day event: " << (event->is_all_day ? "Yes" : "No");
-        if (event->is_recurring) cout << "\nRecurrence: " << event->recurrence_pattern;
-        cout << endl;
-    } else {
-        cout << TermColor::RED << "Event not found!" << TermColor::RESET << "\n";
+        if (step % CHECK_EVERY == 0 && !compare("step " + to_string(step))) return 1;
     }
-    waitForEnter();
+
+    // Draining most of the calendar empties chunks, so they get merged.
+    shuffle(ids.begin(), ids.end(), random);
+    for (size_t i = 0; i < ids.size() * 9 / 10; ++i) {
+        ScratchArena::Scope scratch;
+        bool expected = reference.deleteEvent(ids[i]);
+        if (concurrent.remove(ids[i]) != expected) {
+            cout << "Selftest failed: draining: removal of id " << ids[i] << " disagrees\n";
+            return 1;
+        }
+        reference.compactIfNeeded();
+        if (i % (4 * CHECK_EVERY) == 0 && !compare("draining at " + to_string(i))) return 1;
+    }
+
+    for (size_t i = 0; i < pinned_ranges.size(); ++i) {
+        ScratchArena::Scope scratch;
+        vector<Seen> again = read(pinned->eventsBetween(pinned_ranges[i].first, pinned_ranges[i].second));
+        ++checks;
+        if (again != pinned_seen[i]) return report("pinned snapshot changed", pinned_seen[i], again);
+    }
+    cout << "Selftest passed: " << STEPS << " steps, " << checks << " range checks, " << reference.size()
+         << " events\n";
+    return 0;
 }
 
-    void navigateToDate() {
-        clearScreen();
-        cout << TermColor::BOLD << "=== Navigate to Date ===" << TermColor::RESET << "\n\n";
-        current_date = promptDate("Enter date", false);
-        cout << "\nNow viewing: " << TermColor::BOLD << dateToString(current_date) 
-             << TermColor::RESET << "\n";
-        waitForEnter();
+// Serves the calendar at snapshot_path on address until SIGINT or SIGTERM.
+// Each change is written to the journal before its reply is sent, and
+// syncing to disk is left to the OS.
+int runServer(const string& snapshot_path, const string& address_text, size_t worker_count) {
+#ifdef CALENDAR_SERVER
+    ServerAddress address;
+    string error;
+    if (!ServerAddress::parse(address_text, address, error)) {
+        cerr << error << "\n";
+        return 2;
     }
+    // Blocked before any thread starts, so they reach the loop's signalfd
+    // and nothing else.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-    void showMainMenu() {
-        clearScreen();
-        cout << TermColor::BOLD << "=== Google Calendar Clone ===" << TermColor::RESET << "\n";
-        cout << "Today is " << TermColor::BOLD << dateToString(time(nullptr)) 
-             << TermColor::RESET << "\n\n";
-        
-        cout << "[D]ay View    [W]eek View    [M]onth View\n";
-        cout << "[A]genda View [L]ist All Events\n";
-        cout << "[N]ew Event   [E]dit Event   [X] Delete Event\n";
-        cout << "[V]iew Event  [G]o to Date   [Q]uit\n\n";
+    Calendar calendar;
+    CalendarStore store(snapshot_path, Journal::Options{1, 0}, 64u << 20);
+    size_t replayed = 0;
+    if (!store.open(calendar, replayed, error)) {
+        cerr << "Could not load " << snapshot_path << ": " << error << "\n";
+        return 2;
     }
+    bool ok;
+    size_t served, accepted;
+    {
+        CalendarServer server(calendar, &store, worker_count);
+        if (!server.open(address, error)) {
+            cerr << error << "\n";
+            return 2;
+        }
+        cerr << "Serving " << calendar.size() << " events from " << snapshot_path << " on " << address.describe()
+             << " with " << worker_count << " workers\n";
+        ok = server.run(error);
+        served = server.servedCount();
+        accepted = server.acceptedCount();
+    }
+    if (!ok) cerr << error << "\n";
+    if (!store.close(calendar, error)) {
+        cerr << "Could not compact " << snapshot_path << ": " << error << " (the journal still holds every change)\n";
+    }
+    cerr << "Served " << served << " requests on " << accepted << " connections\n";
+    return ok ? 0 : 1;
+#else
+    (void)snapshot_path;
+    (void)address_text;
+    (void)worker_count;
+    cerr << "--serve needs Linux (epoll)\n";
+    return 2;
+#endif
+}
 
-public:
-    CalendarUI() : current_date(time(nullptr)) {}
+// Load generator for a running server: each of `connections` clients
+// sends `pipeline` requests at a time and waits for their replies, for
+// `seconds`. Requests are one-week range queries and one-day free/busy
+// lookups around today, plus write_percent adds, edits and deletes of the
+// generator's own events, which it deletes again at the end. Latency runs
+// from sending a request's batch to reading its reply.
+int runLoad(const string& address_text, int seconds, int connections, int pipeline, int write_percent) {
+#ifdef CALENDAR_SERVER
+    ServerAddress address;
+    string error;
+    if (!ServerAddress::parse(address_text, address, error)) {
+        cerr << error << "\n";
+        return 2;
+    }
+    struct Client {
+        vector<uint32_t> read_latencies;  // microseconds
+        vector<uint32_t> write_latencies;
+        uint64_t failed = 0;
+        string error;
+    };
+    vector<Client> clients(static_cast<size_t>(connections));
+    time_t today = localDayStart(localDayNumber(time(nullptr)));
+    auto started = chrono::steady_clock::now();
+    auto deadline = started + chrono::seconds(seconds);
 
-    void run() {
-        char choice;
-        do {
-            showMainMenu();
-            cout << "Enter choice: ";
-            cin >> choice;
-            cin.ignore();
-            choice = tolower(choice);
+    vector<thread> threads;
+    for (int index = 0; index < connections; ++index) {
+        threads.emplace_back([&, index]() {
+            Client& client = clients[static_cast<size_t>(index)];
+            int fd = address.openConnection(client.error);
+            if (fd < 0) return;
+            mt19937_64 rng(static_cast<uint64_t>(index) + 1);
+            vector<int> own;         // ids of the events this client added
+            vector<bool> adds;       // which requests of the batch are adds
+            vector<bool> writes;     // and which change the calendar at all
+            string requests, inbox;
+            char chunk[64 * 1024];
 
-            switch (choice) {
-                case 'd': calendar.displayDay(current_date); break;
-                case 'w': calendar.displayWeek(current_date); break;
-                case 'm': calendar.displayMonth(current_date); break;
-                case 'a': {
-                    time_t start = promptDate("Start of Agenda View");
-                    time_t end = promptDate("End of Agenda View");
-                    calendar.displayAgenda(start, end);
-                    break;
+            auto exchange = [&](size_t count, bool record) {
+                auto sent = chrono::steady_clock::now();
+                for (size_t done = 0; done < requests.size();) {
+                    ssize_t n = send(fd, requests.data() + done, requests.size() - done, MSG_NOSIGNAL);
+                    if (n <= 0) {
+                        client.error = "connection lost";
+                        return false;
+                    }
+                    done += static_cast<size_t>(n);
                 }
-                case 'l': calendar.listAllEvents(); break;
-                case 'n': addEvent(); break;
-                case 'e': editEvent(); break;
-                case 'x': deleteEvent(); break;
-                case 'v': viewEventDetails(); break;
-                case 'g': navigateToDate(); break;
-                case 'q': cout << "Exiting...\n"; break;
-                default: 
-                    cout << TermColor::RED << "Invalid choice!" << TermColor::RESET << "\n";
-                    waitForEnter("Press Enter to try again...");
-                    break;
+                for (size_t reply = 0; reply < count;) {
+                    size_t end = inbox.find('\n');
+                    if (end == string::npos) {
+                        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                        if (n <= 0) {
+                            client.error = "connection lost";
+                            return false;
+                        }
+                        inbox.append(chunk, static_cast<size_t>(n));
+                        continue;
+                    }
+                    if (record) {
+                        auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - sent);
+                        vector<uint32_t>& latencies = writes[reply] ? client.write_latencies : client.read_latencies;
+                        latencies.push_back(static_cast<uint32_t>(micros.count()));
+                    }
+                    if (inbox.compare(0, 10, "{\"ok\":true") != 0) {
+                        ++client.failed;
+                    } else if (record && adds[reply]) {
+                        size_t id = inbox.find("\"id\":");
+                        if (id < end) own.push_back(atoi(inbox.c_str() + id + 5));
+                    }
+                    inbox.erase(0, end + 1);
+                    ++reply;
+                }
+                return true;
+            };
+
+            while (chrono::steady_clock::now() < deadline) {
+                requests.clear();
+                adds.assign(static_cast<size_t>(pipeline), false);
+                writes.assign(static_cast<size_t>(pipeline), false);
+                for (int i = 0; i < pipeline; ++i) {
+                    time_t day = today + static_cast<time_t>(rng() % 61) * 86400 - 30 * 86400;
+                    if (static_cast<int>(rng() % 100) < write_percent) {
+                        writes[static_cast<size_t>(i)] = true;
+                        if (!own.empty() && rng() % 2 == 0) {
+                            size_t pick = rng() % own.size();
+                            if (rng() % 2 == 0) {
+                                requests += "edit id=" + to_string(own[pick]) + " location=\"Room " +
+                                            to_string(rng() % 10) + "\"\n";
+                            } else {
+                                requests += "delete id=" + to_string(own[pick]) + "\n";
+                                own[pick] = own.back();
+                                own.pop_back();
+                            }
+                        } else {
+                            time_t start = day + static_cast<time_t>(rng() % 48) * 1800;
+                            requests += "add title=\"Load test\" start=" + to_string(start) + " end=" +
+                                        to_string(start + 1800) + " attendees=loadgen\n";
+                            adds[static_cast<size_t>(i)] = true;
+                        }
+                    } else if (rng() % 10 < 7) {
+                        requests += "query from=" + to_string(day) + " to=" + to_string(day + 7 * 86400 - 1) + "\n";
+                    } else {
+                        requests += "freebusy from=" + to_string(day) + " to=" + to_string(day + 86400) +
+                                    (rng() % 2 ? " attendee=loadgen\n" : "\n");
+                    }
+                }
+                if (!exchange(static_cast<size_t>(pipeline), true)) break;
             }
-        } while (choice != 'q');
+            if (client.error.empty() && !own.empty()) {
+                requests.clear();
+                for (int id : own) requests += "delete id=" + to_string(id) + "\n";
+                exchange(own.size(), false);
+            }
+            ::close(fd);
+        });
     }
-};
+    for (thread& t : threads) t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
 
-// ==================== Main Function ====================
-int main() {
-    CalendarUI ui;
+    // Reads and writes are timed apart: writes wait for each other and for
+    // the queries holding the calendar, which mirror reads never do.
+    vector<uint32_t> reads, writes;
+    uint64_t failed = 0;
+    for (const Client& client : clients) {
+        if (!client.error.empty()) {
+            cerr << client.error << "\n";
+            return 1;
+        }
+        reads.insert(reads.end(), client.read_latencies.begin(), client.read_latencies.end());
+        writes.insert(writes.end(), client.write_latencies.begin(), client.write_latencies.end());
+        failed += client.failed;
+    }
+    auto summary = [](const char* label, vector<uint32_t>& latencies) {
+        if (latencies.empty()) return;
+        sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) {
+            size_t index = min(latencies.size() - 1, static_cast<size_t>(p / 100 * latencies.size()));
+            return latencies[index] / 1000.0;
+        };
+        cout << label << latencies.size() << ", p50 " << percentile(50) << " ms, p90 " << percentile(90)
+             << " ms, p99 " << percentile(99) << " ms, max " << percentile(100) << " ms\n";
+    };
+    size_t total = reads.size() + writes.size();
+    cout << "Load: " << connections << " connections, " << pipeline << " pipelined, " << write_percent
+         << "% writes, " << seconds << "s against " << address.describe() << "\n";
+    cout << "Requests: " << total << " (" << failed << " failed), " << fixed << setprecision(0)
+         << total / elapsed << " requests/s\n";
+    cout << setprecision(3);
+    summary("Reads:  ", reads);
+    summary("Writes: ", writes);
+    return failed == 0 ? 0 : 1;
+#else
+    (void)address_text;
+    (void)seconds;
+    (void)connections;
+    (void)pipeline;
+    (void)write_percent;
+    cerr << "--load needs Linux\n";
+    return 2;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> snapshot_paths;
+    string input_path;
+    string serve_address, load_address;
+    bool batch = false, memory = false, alloc_stats = false;
+    bool selftest = false;
+    int stress_seconds = 0, load_seconds = 5, connections = 4, pipeline = 16, write_percent = 10;
+    size_t workers = max(2u, thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--batch") {
+            batch = true;
+            input_path = "-";
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || string(argv[i + 1]) == "-")) input_path = argv[++i];
+        } else if (arg == "--calendar" && i + 1 < argc) {
+            snapshot_paths.push_back(argv[++i]);
+        } else if (arg == "--memory") {
+            memory = true;
+        } else if (arg == "--alloc-stats") {
+            alloc_stats = true;
+        } else if (arg == "--stress") {
+            stress_seconds = 1;
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                stress_seconds = max(1, safeStoi(argv[++i], 1));
+            }
+        } else if (arg == "--selftest") {
+            selftest = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_address = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = static_cast<size_t>(max(1, safeStoi(argv[++i], 1)));
+        } else if (arg == "--load" && i + 1 < argc) {
+            load_address = argv[++i];
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                load_seconds = max(1, safeStoi(argv[++i], 5));
+            }
+        } else if (arg == "--connections" && i + 1 < argc) {
+            connections = max(1, safeStoi(argv[++i], 4));
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            pipeline = max(1, safeStoi(argv[++i], 16));
+        } else if (arg == "--writes" && i + 1 < argc) {
+            write_percent = min(100, max(0, safeStoi(argv[++i], 10)));
+        } else {
+            cerr << "Usage: " << argv[0] << " [--calendar PATH]... [--batch [FILE] [--memory] [--alloc-stats]]"
+                 << " | --stress [SECONDS] | --selftest | [--calendar PATH] --serve ADDRESS [--workers N]"
+                 << " | --load ADDRESS [SECONDS] [--connections N] [--pipeline N] [--writes PERCENT]\n";
+            return 2;
+        }
+    }
+
+    if (batch && !serve_address.empty()) {
+        cerr << "--batch and --serve do not mix\n";
+        return 2;
+    }
+    if ((memory || alloc_stats) && !batch) {
+        cerr << "--memory and --alloc-stats only apply to --batch\n";
+        return 2;
+    }
+    if (selftest) return runSelftest();
+    if (stress_seconds > 0) return runStress(stress_seconds);
+    if (!load_address.empty()) return runLoad(load_address, load_seconds, connections, pipeline, write_percent);
+    if (snapshot_paths.empty()) snapshot_paths.push_back("calendar.snap");
+    if ((batch || !serve_address.empty()) && snapshot_paths.size() > 1) {
+        cerr << (batch ? "--batch" : "--serve") << " works on a single --calendar\n";
+        return 2;
+    }
+    if (!serve_address.empty()) return runServer(snapshot_paths[0], serve_address, workers);
+    if (batch) return runBatch(snapshot_paths[0], input_path, memory, alloc_stats);
+    CalendarUI ui(snapshot_paths);
     ui.run();
     return 0;
 }
\ No newline at end of file